@@ -0,0 +1,822 @@
+// Copyright (c) Arni Mar Jonsson.
+// See LICENSE for details.
+
+// Block caches of databases opened from Python.
+//
+// A cache is reference counted: by the BlockCache object it was created for, if any, and by each
+// database using it, so several databases in one process can share one cache, which lives as long
+// as any of them. Lookups are counted, to report hit rates.
+//
+// Policies:
+//
+//   lru   leveldb's own LRU cache
+//   slru  segmented LRU: blocks enter a probationary segment, and move to a protected segment,
+//         holding at most pyleveldb_slru_protected of the capacity, when they are hit again.
+//         Blocks only read once, as by a scan, are evicted from the probationary segment
+//         without pushing out the blocks point reads keep coming back to.
+//   clock CLOCK: a hit only sets a reference bit, instead of moving the entry to the end of a list,
+//         so lookups take their shard's lock shared, and releases take none. Threads hitting the
+//         same shard still write the lock word and the entry's reference count atomically, so
+//         they do not wait for each other, but do share those cache lines.
+//
+// The slru and clock caches are split into a configurable number of shards, each with its own lock.
+
+#include "leveldb_ext.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+const char* const pyleveldb_cache_policies[] = {
+	"lru",
+	"slru",
+	"clock",
+	0
+};
+
+// share of the capacity of a segmented LRU cache the protected segment may hold, in percent
+static const size_t pyleveldb_slru_protected = 80;
+
+// shards of the slru and clock caches, unless given
+const size_t pyleveldb_cache_default_shards = 16;
+const size_t pyleveldb_cache_max_shards = 4096;
+
+struct PyLevelDBCacheEntry {
+	std::string key;
+	void* value;
+	void (*deleter)(const leveldb::Slice& key, void* value);
+	size_t charge;
+	uint32_t hash;
+
+	// references held by clients, plus one while the entry is in the cache
+	int refs;
+
+	// segment the entry is on, -1 once it has been removed from the cache
+	int segment;
+
+	PyLevelDBCacheEntry* next_hash;
+	PyLevelDBCacheEntry* next;
+	PyLevelDBCacheEntry* prev;
+};
+
+static uint32_t pyleveldb_cache_hash(const leveldb::Slice& key)
+{
+	// FNV-1a
+	uint32_t h = 2166136261u;
+
+	for (size_t i = 0; i < key.size(); i++)
+		h = (h ^ (unsigned char)key[i]) * 16777619u;
+
+	return h;
+}
+
+// a shard of a segmented LRU cache
+class PyLevelDBSegmentedCacheShard
+{
+public:
+	enum { PROBATION = 0, PROTECTED = 1 };
+
+	PyLevelDBSegmentedCacheShard() :
+		capacity(0),
+		buckets(16),
+		size(0)
+	{
+		pthread_mutex_init(&mutex, 0);
+		table = new PyLevelDBCacheEntry*[buckets]();
+
+		for (int s = 0; s < 2; s++) {
+			lists[s].next = lists[s].prev = &lists[s];
+			usage[s] = 0;
+			hits[s] = 0;
+		}
+	}
+
+	~PyLevelDBSegmentedCacheShard()
+	{
+		for (int s = 0; s < 2; s++) {
+			while (lists[s].next != &lists[s])
+				Remove(lists[s].next);
+		}
+
+		delete[] table;
+		pthread_mutex_destroy(&mutex);
+	}
+
+	void SetCapacity(size_t c)
+	{
+		capacity = c;
+	}
+
+	leveldb::Cache::Handle* Insert(const leveldb::Slice& key, uint32_t hash, void* value, size_t charge, void (*deleter)(const leveldb::Slice& key, void* value))
+	{
+		PyLevelDBCacheEntry* e = new PyLevelDBCacheEntry;
+		e->key = key.ToString();
+		e->value = value;
+		e->deleter = deleter;
+		e->charge = charge;
+		e->hash = hash;
+		e->refs = 2;
+		e->segment = PROBATION;
+
+		pthread_mutex_lock(&mutex);
+
+		PyLevelDBCacheEntry* old = Find(key, hash);
+
+		if (old)
+			Remove(old);
+
+		Append(e, PROBATION);
+		e->next_hash = table[hash & (buckets - 1)];
+		table[hash & (buckets - 1)] = e;
+
+		if (++size > buckets)
+			Resize();
+
+		// evict from the probationary segment first, the entry just inserted last
+		while (usage[PROBATION] + usage[PROTECTED] > capacity) {
+			PyLevelDBCacheEntry* victim = lists[PROBATION].next;
+
+			if (victim == e)
+				victim = lists[PROTECTED].next;
+
+			if (victim == &lists[PROTECTED])
+				break;
+
+			Remove(victim);
+		}
+
+		pthread_mutex_unlock(&mutex);
+		return (leveldb::Cache::Handle*)e;
+	}
+
+	leveldb::Cache::Handle* Lookup(const leveldb::Slice& key, uint32_t hash)
+	{
+		pthread_mutex_lock(&mutex);
+
+		PyLevelDBCacheEntry* e = Find(key, hash);
+
+		if (e) {
+			e->refs++;
+			hits[e->segment]++;
+
+			// hit again: promote to the protected segment, demoting its least recently used entries
+			Unlink(e);
+			Append(e, PROTECTED);
+
+			while (usage[PROTECTED] > capacity * pyleveldb_slru_protected / 100 && lists[PROTECTED].next != e) {
+				PyLevelDBCacheEntry* d = lists[PROTECTED].next;
+				Unlink(d);
+				Append(d, PROBATION);
+			}
+		}
+
+		pthread_mutex_unlock(&mutex);
+		return (leveldb::Cache::Handle*)e;
+	}
+
+	void Release(leveldb::Cache::Handle* handle)
+	{
+		pthread_mutex_lock(&mutex);
+		Unref((PyLevelDBCacheEntry*)handle);
+		pthread_mutex_unlock(&mutex);
+	}
+
+	void Erase(const leveldb::Slice& key, uint32_t hash)
+	{
+		pthread_mutex_lock(&mutex);
+
+		PyLevelDBCacheEntry* e = Find(key, hash);
+
+		if (e)
+			Remove(e);
+
+		pthread_mutex_unlock(&mutex);
+	}
+
+	// drop the entries no client holds
+	void Prune()
+	{
+		pthread_mutex_lock(&mutex);
+
+		for (int s = 0; s < 2; s++) {
+			PyLevelDBCacheEntry* e = lists[s].next;
+
+			while (e != &lists[s]) {
+				PyLevelDBCacheEntry* next = e->next;
+
+				if (e->refs == 1)
+					Remove(e);
+
+				e = next;
+			}
+		}
+
+		pthread_mutex_unlock(&mutex);
+	}
+
+	void Stats(PyLevelDBCacheStats* stats)
+	{
+		pthread_mutex_lock(&mutex);
+		stats->segmented = 1;
+		stats->usage += usage[PROBATION] + usage[PROTECTED];
+		stats->probation_usage += usage[PROBATION];
+		stats->protected_usage += usage[PROTECTED];
+		stats->probation_hits += hits[PROBATION];
+		stats->protected_hits += hits[PROTECTED];
+		pthread_mutex_unlock(&mutex);
+	}
+
+	size_t TotalCharge()
+	{
+		pthread_mutex_lock(&mutex);
+		size_t n = usage[PROBATION] + usage[PROTECTED];
+		pthread_mutex_unlock(&mutex);
+		return n;
+	}
+
+private:
+	PyLevelDBCacheEntry* Find(const leveldb::Slice& key, uint32_t hash)
+	{
+		PyLevelDBCacheEntry* e = table[hash & (buckets - 1)];
+
+		while (e && !(e->hash == hash && leveldb::Slice(e->key) == key))
+			e = e->next_hash;
+
+		return e;
+	}
+
+	void Resize()
+	{
+		size_t n = buckets * 2;
+		PyLevelDBCacheEntry** t = new PyLevelDBCacheEntry*[n]();
+
+		for (size_t i = 0; i < buckets; i++) {
+			PyLevelDBCacheEntry* e = table[i];
+
+			while (e) {
+				PyLevelDBCacheEntry* next = e->next_hash;
+				e->next_hash = t[e->hash & (n - 1)];
+				t[e->hash & (n - 1)] = e;
+				e = next;
+			}
+		}
+
+		delete[] table;
+		table = t;
+		buckets = n;
+	}
+
+	// most recently used entries are at the end of a segment
+	void Append(PyLevelDBCacheEntry* e, int s)
+	{
+		e->segment = s;
+		e->next = &lists[s];
+		e->prev = lists[s].prev;
+		e->prev->next = e;
+		e->next->prev = e;
+		usage[s] += e->charge;
+	}
+
+	void Unlink(PyLevelDBCacheEntry* e)
+	{
+		e->next->prev = e->prev;
+		e->prev->next = e->next;
+		usage[e->segment] -= e->charge;
+	}
+
+	// remove from the cache, freeing the entry once clients have released it
+	void Remove(PyLevelDBCacheEntry* e)
+	{
+		PyLevelDBCacheEntry** p = &table[e->hash & (buckets - 1)];
+
+		while (*p != e)
+			p = &(*p)->next_hash;
+
+		*p = e->next_hash;
+		size--;
+
+		Unlink(e);
+		e->segment = -1;
+		Unref(e);
+	}
+
+	void Unref(PyLevelDBCacheEntry* e)
+	{
+		if (--e->refs == 0) {
+			(*e->deleter)(e->key, e->value);
+			delete e;
+		}
+	}
+
+	pthread_mutex_t mutex;
+	size_t capacity;
+
+	// hash table, chained through next_hash
+	PyLevelDBCacheEntry** table;
+	size_t buckets;
+	size_t size;
+
+	// dummy heads of the segments, least recently used first
+	PyLevelDBCacheEntry lists[2];
+	size_t usage[2];
+	uint64_t hits[2];
+};
+
+// a shard of a CLOCK cache: lookups only take a shared lock, marking the entry referenced and
+// taking a reference atomically, releases take no lock at all, only dropping that reference
+// atomically. Inserts take the lock exclusively, and sweep the clock hand over the entries,
+// evicting those neither referenced since the last sweep nor held by clients.
+class PyLevelDBClockCacheShard
+{
+public:
+	PyLevelDBClockCacheShard() :
+		capacity(0),
+		usage(0),
+		hand(0),
+		buckets(16),
+		size(0)
+	{
+		pthread_rwlock_init(&lock, 0);
+		table = new PyLevelDBCacheEntry*[buckets]();
+	}
+
+	~PyLevelDBClockCacheShard()
+	{
+		while (hand)
+			Remove(hand);
+
+		delete[] table;
+		pthread_rwlock_destroy(&lock);
+	}
+
+	void SetCapacity(size_t c)
+	{
+		capacity = c;
+	}
+
+	leveldb::Cache::Handle* Insert(const leveldb::Slice& key, uint32_t hash, void* value, size_t charge, void (*deleter)(const leveldb::Slice& key, void* value))
+	{
+		PyLevelDBCacheEntry* e = new PyLevelDBCacheEntry;
+		e->key = key.ToString();
+		e->value = value;
+		e->deleter = deleter;
+		e->charge = charge;
+		e->hash = hash;
+		e->refs = 2;
+		e->segment = 0;
+
+		pthread_rwlock_wrlock(&lock);
+
+		PyLevelDBCacheEntry* old = Find(key, hash);
+
+		if (old)
+			Remove(old);
+
+		// behind the hand, i.e. the last entry the next sweep reaches
+		if (hand) {
+			e->next = hand;
+			e->prev = hand->prev;
+			e->prev->next = e;
+			e->next->prev = e;
+		} else {
+			e->next = e->prev = e;
+			hand = e;
+		}
+
+		usage += charge;
+		e->next_hash = table[hash & (buckets - 1)];
+		table[hash & (buckets - 1)] = e;
+
+		if (++size > buckets)
+			Resize();
+
+		// at most two sweeps: the first may only clear reference bits
+		for (size_t n = 2 * size; usage > capacity && n > 0 && size > 1; n--) {
+			PyLevelDBCacheEntry* victim = hand;
+			hand = hand->next;
+
+			if (victim == e)
+				continue;
+
+			if (__atomic_load_n(&victim->segment, __ATOMIC_RELAXED))
+				__atomic_store_n(&victim->segment, 0, __ATOMIC_RELAXED);
+			else if (__sync_fetch_and_add(&victim->refs, 0) == 1)
+				Remove(victim);
+		}
+
+		pthread_rwlock_unlock(&lock);
+		return (leveldb::Cache::Handle*)e;
+	}
+
+	leveldb::Cache::Handle* Lookup(const leveldb::Slice& key, uint32_t hash)
+	{
+		pthread_rwlock_rdlock(&lock);
+
+		PyLevelDBCacheEntry* e = Find(key, hash);
+
+		// the cache holds a reference while the entry is in the table, which only changes under the exclusive lock
+		if (e) {
+			__sync_fetch_and_add(&e->refs, 1);
+
+			// the reference bit, written only if clear, not to bounce the cache line between readers
+			if (!__atomic_load_n(&e->segment, __ATOMIC_RELAXED))
+				__atomic_store_n(&e->segment, 1, __ATOMIC_RELAXED);
+		}
+
+		pthread_rwlock_unlock(&lock);
+		return (leveldb::Cache::Handle*)e;
+	}
+
+	void Release(leveldb::Cache::Handle* handle)
+	{
+		Unref((PyLevelDBCacheEntry*)handle);
+	}
+
+	void Erase(const leveldb::Slice& key, uint32_t hash)
+	{
+		pthread_rwlock_wrlock(&lock);
+
+		PyLevelDBCacheEntry* e = Find(key, hash);
+
+		if (e)
+			Remove(e);
+
+		pthread_rwlock_unlock(&lock);
+	}
+
+	// drop the entries no client holds
+	void Prune()
+	{
+		pthread_rwlock_wrlock(&lock);
+
+		for (size_t n = size; n > 0 && hand; n--) {
+			PyLevelDBCacheEntry* e = hand;
+			hand = hand->next;
+
+			if (__sync_fetch_and_add(&e->refs, 0) == 1)
+				Remove(e);
+		}
+
+		pthread_rwlock_unlock(&lock);
+	}
+
+	void Stats(PyLevelDBCacheStats* stats)
+	{
+		stats->usage += TotalCharge();
+	}
+
+	size_t TotalCharge()
+	{
+		pthread_rwlock_rdlock(&lock);
+		size_t n = usage;
+		pthread_rwlock_unlock(&lock);
+		return n;
+	}
+
+private:
+	PyLevelDBCacheEntry* Find(const leveldb::Slice& key, uint32_t hash)
+	{
+		PyLevelDBCacheEntry* e = table[hash & (buckets - 1)];
+
+		while (e && !(e->hash == hash && leveldb::Slice(e->key) == key))
+			e = e->next_hash;
+
+		return e;
+	}
+
+	void Resize()
+	{
+		size_t n = buckets * 2;
+		PyLevelDBCacheEntry** t = new PyLevelDBCacheEntry*[n]();
+
+		for (size_t i = 0; i < buckets; i++) {
+			PyLevelDBCacheEntry* e = table[i];
+
+			while (e) {
+				PyLevelDBCacheEntry* next = e->next_hash;
+				e->next_hash = t[e->hash & (n - 1)];
+				t[e->hash & (n - 1)] = e;
+				e = next;
+			}
+		}
+
+		delete[] table;
+		table = t;
+		buckets = n;
+	}
+
+	// remove from the cache, freeing the entry once clients have released it
+	void Remove(PyLevelDBCacheEntry* e)
+	{
+		PyLevelDBCacheEntry** p = &table[e->hash & (buckets - 1)];
+
+		while (*p != e)
+			p = &(*p)->next_hash;
+
+		*p = e->next_hash;
+		size--;
+		usage -= e->charge;
+
+		if (e->next == e) {
+			hand = 0;
+		} else {
+			if (hand == e)
+				hand = e->next;
+
+			e->next->prev = e->prev;
+			e->prev->next = e->next;
+		}
+
+		Unref(e);
+	}
+
+	void Unref(PyLevelDBCacheEntry* e)
+	{
+		if (__sync_sub_and_fetch(&e->refs, 1) == 0) {
+			(*e->deleter)(e->key, e->value);
+			delete e;
+		}
+	}
+
+	pthread_rwlock_t lock;
+	size_t capacity;
+	size_t usage;
+
+	// entries in a ring, swept from the hand, with segment as the reference bit
+	PyLevelDBCacheEntry* hand;
+
+	// hash table, chained through next_hash
+	PyLevelDBCacheEntry** table;
+	size_t buckets;
+	size_t size;
+};
+
+class PyLevelDBShardedCacheBase : public leveldb::Cache
+{
+public:
+	virtual void Stats(PyLevelDBCacheStats* stats) = 0;
+};
+
+// shards selected by the top bits of the key hash, each with its own lock
+template <class Shard>
+class PyLevelDBShardedCache : public PyLevelDBShardedCacheBase
+{
+public:
+	PyLevelDBShardedCache(size_t capacity, size_t n) :
+		shards(new Shard[n]),
+		n(n),
+		last_id(0)
+	{
+		for (size_t i = 0; i < n; i++)
+			shards[i].SetCapacity((capacity + n - 1) / n);
+	}
+
+	virtual ~PyLevelDBShardedCache()
+	{
+		delete[] shards;
+	}
+
+	virtual Handle* Insert(const leveldb::Slice& key, void* value, size_t charge, void (*deleter)(const leveldb::Slice& key, void* value))
+	{
+		uint32_t hash = pyleveldb_cache_hash(key);
+		return Select(hash).Insert(key, hash, value, charge, deleter);
+	}
+
+	virtual Handle* Lookup(const leveldb::Slice& key)
+	{
+		uint32_t hash = pyleveldb_cache_hash(key);
+		return Select(hash).Lookup(key, hash);
+	}
+
+	virtual void Release(Handle* handle)
+	{
+		Select(((PyLevelDBCacheEntry*)handle)->hash).Release(handle);
+	}
+
+	virtual void* Value(Handle* handle)
+	{
+		return ((PyLevelDBCacheEntry*)handle)->value;
+	}
+
+	virtual void Erase(const leveldb::Slice& key)
+	{
+		uint32_t hash = pyleveldb_cache_hash(key);
+		Select(hash).Erase(key, hash);
+	}
+
+	virtual uint64_t NewId()
+	{
+		return __sync_add_and_fetch(&last_id, 1);
+	}
+
+	virtual void Prune()
+	{
+		for (size_t i = 0; i < n; i++)
+			shards[i].Prune();
+	}
+
+	virtual size_t TotalCharge() const
+	{
+		size_t total = 0;
+
+		for (size_t i = 0; i < n; i++)
+			total += shards[i].TotalCharge();
+
+		return total;
+	}
+
+	virtual void Stats(PyLevelDBCacheStats* stats)
+	{
+		stats->shards = n;
+
+		for (size_t i = 0; i < n; i++)
+			shards[i].Stats(stats);
+	}
+
+private:
+	// the low bits of the hash select the bucket within the shard
+	Shard& Select(uint32_t hash) const
+	{
+		return shards[(hash >> 20) & (n - 1)];
+	}
+
+	Shard* shards;
+	size_t n;
+	uint64_t last_id;
+};
+
+// hit and miss counters, striped over threads, so lookups on different threads do not contend on them
+static const int pyleveldb_cache_stripes = 16;
+
+static __thread int pyleveldb_cache_stripe = -1;
+static int pyleveldb_cache_next_stripe = 0;
+
+// one cache line per stripe, the array is allocated aligned to one
+static const size_t pyleveldb_cache_line = 64;
+
+struct PyLevelDBCacheCounters {
+	uint64_t hits;
+	uint64_t misses;
+
+	char padding[pyleveldb_cache_line - 2 * sizeof(uint64_t)];
+};
+
+class PyLevelDBCache : public leveldb::Cache
+{
+public:
+	PyLevelDBCache(size_t capacity, leveldb::Cache* base, PyLevelDBShardedCacheBase* sharded, PyLevelDBCacheCounters* counters) :
+		base(base),
+		sharded(sharded),
+		capacity(capacity),
+		refs(1),
+		counters(counters)
+	{
+		memset(counters, 0, sizeof(PyLevelDBCacheCounters) * pyleveldb_cache_stripes);
+	}
+
+	virtual ~PyLevelDBCache()
+	{
+		delete base;
+		free(counters);
+	}
+
+	virtual Handle* Insert(const leveldb::Slice& key, void* value, size_t charge, void (*deleter)(const leveldb::Slice& key, void* value))
+	{
+		return base->Insert(key, value, charge, deleter);
+	}
+
+	virtual Handle* Lookup(const leveldb::Slice& key)
+	{
+		Handle* handle = base->Lookup(key);
+
+		if (pyleveldb_cache_stripe < 0)
+			pyleveldb_cache_stripe = __sync_fetch_and_add(&pyleveldb_cache_next_stripe, 1) % pyleveldb_cache_stripes;
+
+		PyLevelDBCacheCounters* c = &counters[pyleveldb_cache_stripe];
+		__sync_fetch_and_add(handle ? &c->hits : &c->misses, 1);
+		return handle;
+	}
+
+	virtual void Release(Handle* handle)
+	{
+		base->Release(handle);
+	}
+
+	virtual void* Value(Handle* handle)
+	{
+		return base->Value(handle);
+	}
+
+	virtual void Erase(const leveldb::Slice& key)
+	{
+		base->Erase(key);
+	}
+
+	virtual uint64_t NewId()
+	{
+		return base->NewId();
+	}
+
+	virtual void Prune()
+	{
+		base->Prune();
+	}
+
+	virtual size_t TotalCharge() const
+	{
+		return base->TotalCharge();
+	}
+
+	void Ref()
+	{
+		__sync_fetch_and_add(&refs, 1);
+	}
+
+	void Unref()
+	{
+		if (__sync_sub_and_fetch(&refs, 1) == 0)
+			delete this;
+	}
+
+	void Stats(PyLevelDBCacheStats* stats)
+	{
+		memset(stats, 0, sizeof(*stats));
+		stats->capacity = capacity;
+
+		for (int i = 0; i < pyleveldb_cache_stripes; i++) {
+			stats->hits += __sync_fetch_and_add(&counters[i].hits, 0);
+			stats->misses += __sync_fetch_and_add(&counters[i].misses, 0);
+		}
+
+		if (sharded) {
+			sharded->Stats(stats);
+		} else {
+			// leveldb's LRU cache
+			stats->usage = base->TotalCharge();
+			stats->shards = 16;
+		}
+	}
+
+private:
+	leveldb::Cache* base;
+
+	// base, unless it is leveldb's LRU cache
+	PyLevelDBShardedCacheBase* sharded;
+
+	size_t capacity;
+	int refs;
+
+	PyLevelDBCacheCounters* counters;
+};
+
+leveldb::Cache* pyleveldb_cache_new(size_t capacity, const char* policy, size_t shards)
+{
+	PyLevelDBShardedCacheBase* sharded = 0;
+	leveldb::Cache* base = 0;
+	bool lru = (policy == 0 || strcmp(policy, "lru") == 0);
+
+	// leveldb's LRU cache has a fixed number of shards
+	if (lru && shards != 0)
+		return 0;
+
+	if (shards == 0)
+		shards = pyleveldb_cache_default_shards;
+
+	if (shards > pyleveldb_cache_max_shards || (shards & (shards - 1)) != 0)
+		return 0;
+
+	if (lru)
+		base = leveldb::NewLRUCache(capacity);
+	else if (strcmp(policy, "slru") == 0)
+		base = sharded = new PyLevelDBShardedCache<PyLevelDBSegmentedCacheShard>(capacity, shards);
+	else if (strcmp(policy, "clock") == 0)
+		base = sharded = new PyLevelDBShardedCache<PyLevelDBClockCacheShard>(capacity, shards);
+	else
+		return 0;
+
+	// operator new only guarantees the alignment of the fundamental types
+	void* counters = 0;
+
+	if (posix_memalign(&counters, pyleveldb_cache_line, sizeof(PyLevelDBCacheCounters) * pyleveldb_cache_stripes) != 0) {
+		delete base;
+		return 0;
+	}
+
+	return new PyLevelDBCache(capacity, base, sharded, (PyLevelDBCacheCounters*)counters);
+}
+
+leveldb::Cache* pyleveldb_cache_ref(leveldb::Cache* cache)
+{
+	((PyLevelDBCache*)cache)->Ref();
+	return cache;
+}
+
+void pyleveldb_cache_unref(leveldb::Cache* cache)
+{
+	if (cache)
+		((PyLevelDBCache*)cache)->Unref();
+}
+
+void pyleveldb_cache_stats(leveldb::Cache* cache, PyLevelDBCacheStats* stats)
+{
+	((PyLevelDBCache*)cache)->Stats(stats);
+}
@@ -0,0 +1,619 @@
+// Copyright (c) Arni Mar Jonsson.
+// See LICENSE for details.
+
+// Native comparators, selectable by name instead of a Python comparison function.
+//
+// They never call into Python, so compactions and reads can order keys without holding the GIL.
+// The names returned by Name() are stored in the database, and must never change.
+
+#include "leveldb_ext.h"
+
+#include <string.h>
+#include <stdint.h>
+
+#include <algorithm>
+
+const char* const pyleveldb_native_comparators[] = {
+	"reverse-bytewise",
+	"uint64",
+	"int64",
+	"tuple",
+	"ascii-nocase",
+	0
+};
+
+static inline void pyleveldb_store_be64(char* p, uint64_t v)
+{
+	for (int i = 7; i >= 0; i--) {
+		p[i] = (char)(v & 0xff);
+		v >>= 8;
+	}
+}
+
+// bytewise order, reversed
+class PyLevelDBReverseBytewiseComparator : public leveldb::Comparator
+{
+public:
+	int Compare(const leveldb::Slice& a, const leveldb::Slice& b) const
+	{
+		return -a.compare(b);
+	}
+
+	const char* Name() const
+	{
+		return "py-leveldb.ReverseBytewiseComparator";
+	}
+
+	// start > limit bytewise, so any prefix of start longer than the common prefix lies in between
+	void FindShortestSeparator(std::string* start, const leveldb::Slice& limit) const
+	{
+		size_t n = std::min(start->size(), limit.size());
+		size_t i = 0;
+
+		while (i < n && (*start)[i] == limit[i])
+			i++;
+
+		if (i + 1 < start->size())
+			start->resize(i + 1);
+	}
+
+	// the empty key comes last
+	void FindShortSuccessor(std::string* key) const
+	{
+		key->clear();
+	}
+};
+
+// keys starting with a big-endian uint64, i.e. bytewise order, compared a word at a time
+class PyLevelDBUint64Comparator : public leveldb::Comparator
+{
+public:
+	int Compare(const leveldb::Slice& a, const leveldb::Slice& b) const
+	{
+		if (a.size() >= 8 && b.size() >= 8) {
+			uint64_t x = pyleveldb_load_be64(a.data());
+			uint64_t y = pyleveldb_load_be64(b.data());
+
+			if (x != y)
+				return (x < y) ? -1 : 1;
+		}
+
+		return a.compare(b);
+	}
+
+	const char* Name() const
+	{
+		return "py-leveldb.Uint64Comparator";
+	}
+
+	void FindShortestSeparator(std::string* start, const leveldb::Slice& limit) const
+	{
+		leveldb::BytewiseComparator()->FindShortestSeparator(start, limit);
+	}
+
+	void FindShortSuccessor(std::string* key) const
+	{
+		leveldb::BytewiseComparator()->FindShortSuccessor(key);
+	}
+};
+
+// keys starting with a big-endian two's complement int64, the rest ordered bytewise,
+// keys shorter than 8 bytes come first
+class PyLevelDBInt64Comparator : public leveldb::Comparator
+{
+public:
+	int Compare(const leveldb::Slice& a, const leveldb::Slice& b) const
+	{
+		if (a.size() < 8 || b.size() < 8) {
+			if (a.size() >= 8)
+				return 1;
+
+			if (b.size() >= 8)
+				return -1;
+
+			return a.compare(b);
+		}
+
+		int64_t x = (int64_t)pyleveldb_load_be64(a.data());
+		int64_t y = (int64_t)pyleveldb_load_be64(b.data());
+
+		if (x != y)
+			return (x < y) ? -1 : 1;
+
+		return leveldb::Slice(a.data() + 8, a.size() - 8).compare(leveldb::Slice(b.data() + 8, b.size() - 8));
+	}
+
+	const char* Name() const
+	{
+		return "py-leveldb.Int64Comparator";
+	}
+
+	void FindShortestSeparator(std::string* start, const leveldb::Slice& limit) const
+	{
+		if (start->size() < 8 || limit.size() < 8)
+			return;
+
+		int64_t x = (int64_t)pyleveldb_load_be64(start->data());
+		int64_t y = (int64_t)pyleveldb_load_be64(limit.data());
+		std::string suffix = start->substr(8);
+
+		if (x == y) {
+			leveldb::BytewiseComparator()->FindShortestSeparator(&suffix, leveldb::Slice(limit.data() + 8, limit.size() - 8));
+		} else if (x + 1 < y) {
+			// an integer in between separates them on its own
+			start->resize(8);
+			pyleveldb_store_be64(&(*start)[0], (uint64_t)(x + 1));
+			return;
+		} else {
+			leveldb::BytewiseComparator()->FindShortSuccessor(&suffix);
+		}
+
+		start->replace(8, std::string::npos, suffix);
+	}
+
+	void FindShortSuccessor(std::string* key) const
+	{
+		if (key->size() <= 8)
+			return;
+
+		int64_t x = (int64_t)pyleveldb_load_be64(key->data());
+
+		if (x == INT64_MAX)
+			return;
+
+		key->resize(8);
+		pyleveldb_store_be64(&(*key)[0], (uint64_t)(x + 1));
+	}
+};
+
+// read the next varint32 length-prefixed component, the rest of the key if malformed
+static inline leveldb::Slice pyleveldb_next_component(const char** p, const char* end)
+{
+	const char* q = *p;
+	uint32_t n = 0;
+
+	for (int shift = 0; shift <= 28 && q < end; shift += 7) {
+		uint32_t byte = (unsigned char)*q++;
+		n |= (byte & 0x7f) << shift;
+
+		if ((byte & 0x80) == 0) {
+			if (n <= (size_t)(end - q)) {
+				*p = q + n;
+				return leveldb::Slice(q, n);
+			}
+
+			break;
+		}
+	}
+
+	leveldb::Slice rest(*p, end - *p);
+	*p = end;
+	return rest;
+}
+
+// tuples of varint32 length-prefixed components (see PutLengthPrefixedSlice() in leveldb),
+// ordered component by component, a tuple coming before the tuples it is a prefix of, ties broken
+// bytewise so that distinct keys stay distinct (a length may be encoded in more than one way, and a
+// malformed tail may hold the same bytes as a well-formed component)
+class PyLevelDBTupleComparator : public leveldb::Comparator
+{
+public:
+	int Compare(const leveldb::Slice& a, const leveldb::Slice& b) const
+	{
+		const char* p = a.data();
+		const char* q = b.data();
+		const char* p_end = p + a.size();
+		const char* q_end = q + b.size();
+
+		while (p < p_end && q < q_end) {
+			int c = pyleveldb_next_component(&p, p_end).compare(pyleveldb_next_component(&q, q_end));
+
+			if (c)
+				return c;
+		}
+
+		if (p < p_end)
+			return 1;
+
+		if (q < q_end)
+			return -1;
+
+		return a.compare(b);
+	}
+
+	const char* Name() const
+	{
+		return "py-leveldb.TupleComparator";
+	}
+
+	// the equal leading components, and a short component in between the first differing ones
+	void FindShortestSeparator(std::string* start, const leveldb::Slice& limit) const
+	{
+		const char* p = start->data();
+		const char* q = limit.data();
+		const char* p_end = p + start->size();
+		const char* q_end = q + limit.size();
+
+		while (p < p_end && q < q_end) {
+			const char* prefix_end = p;
+			leveldb::Slice a = pyleveldb_next_component(&p, p_end);
+			leveldb::Slice b = pyleveldb_next_component(&q, q_end);
+
+			if (a.compare(b) != 0) {
+				std::string c = a.ToString();
+				leveldb::BytewiseComparator()->FindShortestSeparator(&c, b);
+
+				// an unchanged component would drop the components of start which follow it
+				if (a.compare(c) < 0)
+					Replace(start, prefix_end - start->data(), c);
+
+				return;
+			}
+		}
+	}
+
+	void FindShortSuccessor(std::string* key) const
+	{
+		const char* p = key->data();
+		leveldb::Slice a = pyleveldb_next_component(&p, p + key->size());
+		std::string c = a.ToString();
+		leveldb::BytewiseComparator()->FindShortSuccessor(&c);
+
+		if (a.compare(c) < 0)
+			Replace(key, 0, c);
+	}
+
+private:
+	// replace the components from offset on by component c, if shorter
+	static void Replace(std::string* key, size_t offset, const std::string& c)
+	{
+		char length[5];
+		size_t n = 0;
+		uint32_t v = (uint32_t)c.size();
+
+		while (v >= 0x80) {
+			length[n++] = (char)(v | 0x80);
+			v >>= 7;
+		}
+
+		length[n++] = (char)v;
+
+		if (offset + n + c.size() < key->size()) {
+			key->resize(offset);
+			key->append(length, n);
+			key->append(c);
+		}
+	}
+};
+
+static inline unsigned char pyleveldb_ascii_lower(unsigned char c)
+{
+	return (c >= 'A' && c <= 'Z') ? (unsigned char)(c + ('a' - 'A')) : c;
+}
+
+// ASCII letters ordered without regard to case, ties broken bytewise so that distinct keys stay distinct
+class PyLevelDBAsciiNocaseComparator : public leveldb::Comparator
+{
+public:
+	int Compare(const leveldb::Slice& a, const leveldb::Slice& b) const
+	{
+		size_t n = std::min(a.size(), b.size());
+
+		for (size_t i = 0; i < n; i++) {
+			unsigned char x = pyleveldb_ascii_lower((unsigned char)a[i]);
+			unsigned char y = pyleveldb_ascii_lower((unsigned char)b[i]);
+
+			if (x != y)
+				return (x < y) ? -1 : 1;
+		}
+
+		if (a.size() != b.size())
+			return (a.size() < b.size()) ? -1 : 1;
+
+		return a.compare(b);
+	}
+
+	const char* Name() const
+	{
+		return "py-leveldb.AsciiNocaseComparator";
+	}
+
+	void FindShortestSeparator(std::string*, const leveldb::Slice&) const
+	{
+	}
+
+	void FindShortSuccessor(std::string*) const
+	{
+	}
+};
+
+// order-preserving unsigned value of a fixed-width integer field
+static inline uint64_t pyleveldb_field_load(const PyLevelDBKeyField& f, const char* p)
+{
+	uint64_t v = 0;
+
+	for (int i = 0; i < f.width; i++)
+		v = (v << 8) | (unsigned char)p[i];
+
+	if (f.is_signed)
+		v ^= (uint64_t)1 << (8 * f.width - 1);
+
+	return v;
+}
+
+static inline void pyleveldb_field_store(const PyLevelDBKeyField& f, uint64_t v, std::string* out)
+{
+	if (f.is_signed)
+		v ^= (uint64_t)1 << (8 * f.width - 1);
+
+	for (int i = f.width - 1; i >= 0; i--)
+		out->push_back((char)((v >> (8 * i)) & 0xff));
+}
+
+// keys made of the fields of a KeySchema, each ascending or descending
+//
+// Integer fields are fixed-width and big-endian, byte string fields are varint32 length-prefixed,
+// except for a trailing one, which takes the rest of the key (when empty, the field is missing).
+// Keys with fewer fields come first, malformed trailing bytes come after a well-formed field and
+// are ordered bytewise. Keys whose fields are all equal, though their bytes differ (a length may be
+// encoded in more than one way), are ordered bytewise, so that distinct keys stay distinct.
+class PyLevelDBSchemaComparator : public leveldb::Comparator
+{
+public:
+	PyLevelDBSchemaComparator(const std::vector<PyLevelDBKeyField>& fields, const std::string& name) :
+		fields(fields),
+		name(name)
+	{
+	}
+
+	int Compare(const leveldb::Slice& a, const leveldb::Slice& b) const
+	{
+		int c = CompareFields(a, b);
+		return c ? c : a.compare(b);
+	}
+
+	const char* Name() const
+	{
+		return name.c_str();
+	}
+
+	// the equal leading fields, and a short field in between the first differing ones
+	void FindShortestSeparator(std::string* start, const leveldb::Slice& limit) const
+	{
+		const char* p = start->data();
+		const char* q = limit.data();
+		const char* p_end = p + start->size();
+		const char* q_end = q + limit.size();
+
+		for (size_t i = 0; i < fields.size() && p < p_end && q < q_end; i++) {
+			const char* prefix_end = p;
+			leveldb::Slice x;
+			leveldb::Slice y;
+
+			if (!Next(i, &p, p_end, &x) || !Next(i, &q, q_end, &y))
+				return;
+
+			if (CompareField(fields[i], x, y) != 0) {
+				std::string field;
+
+				if (Between(fields[i], i + 1 == fields.size(), x, &y, &field))
+					Replace(start, prefix_end - start->data(), i, field);
+
+				return;
+			}
+		}
+	}
+
+	void FindShortSuccessor(std::string* key) const
+	{
+		const char* p = key->data();
+		leveldb::Slice x;
+		std::string field;
+
+		if (fields.empty() || !Next(0, &p, p + key->size(), &x))
+			return;
+
+		if (Between(fields[0], fields.size() == 1, x, 0, &field))
+			Replace(key, 0, 0, field);
+	}
+
+private:
+	// the keys field by field, 0 if all fields are equal
+	int CompareFields(const leveldb::Slice& a, const leveldb::Slice& b) const
+	{
+		const char* p = a.data();
+		const char* q = b.data();
+		const char* p_end = p + a.size();
+		const char* q_end = q + b.size();
+
+		for (size_t i = 0; i < fields.size() && p < p_end && q < q_end; i++) {
+			const char* p_field = p;
+			const char* q_field = q;
+			leveldb::Slice x;
+			leveldb::Slice y;
+			bool x_ok = Next(i, &p, p_end, &x);
+			bool y_ok = Next(i, &q, q_end, &y);
+
+			// malformed fields come after well-formed ones
+			if (!x_ok || !y_ok) {
+				if (x_ok || y_ok)
+					return x_ok ? -1 : 1;
+
+				return leveldb::Slice(p_field, p_end - p_field).compare(leveldb::Slice(q_field, q_end - q_field));
+			}
+
+			int c = CompareField(fields[i], x, y);
+
+			if (c)
+				return c;
+		}
+
+		return leveldb::Slice(p, p_end - p).compare(leveldb::Slice(q, q_end - q));
+	}
+
+	// read field i, false if the key is malformed
+	bool Next(size_t i, const char** p, const char* end, leveldb::Slice* field) const
+	{
+		const PyLevelDBKeyField& f = fields[i];
+
+		if (f.width) {
+			if (end - *p < f.width)
+				return false;
+
+			*field = leveldb::Slice(*p, f.width);
+			*p += f.width;
+			return true;
+		}
+
+		// a trailing byte string takes the rest of the key
+		if (i + 1 == fields.size()) {
+			*field = leveldb::Slice(*p, end - *p);
+			*p = end;
+			return true;
+		}
+
+		const char* q = *p;
+		uint32_t n = 0;
+
+		for (int shift = 0; shift <= 28 && q < end; shift += 7) {
+			uint32_t byte = (unsigned char)*q++;
+			n |= (byte & 0x7f) << shift;
+
+			if ((byte & 0x80) == 0) {
+				if (n > (size_t)(end - q))
+					return false;
+
+				*field = leveldb::Slice(q, n);
+				*p = q + n;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	static int CompareField(const PyLevelDBKeyField& f, const leveldb::Slice& x, const leveldb::Slice& y)
+	{
+		int c;
+
+		if (f.width) {
+			uint64_t u = pyleveldb_field_load(f, x.data());
+			uint64_t v = pyleveldb_field_load(f, y.data());
+			c = (u < v) ? -1 : (u > v) ? 1 : 0;
+		} else {
+			c = x.compare(y);
+		}
+
+		return f.descending ? -c : c;
+	}
+
+	// a field strictly after x, and before y if given, false if there is none worth using
+	static bool Between(const PyLevelDBKeyField& f, bool trailing, const leveldb::Slice& x, const leveldb::Slice* y, std::string* field)
+	{
+		if (f.width) {
+			uint64_t u = pyleveldb_field_load(f, x.data());
+			uint64_t max = (f.width == 8) ? ~(uint64_t)0 : (((uint64_t)1 << (8 * f.width)) - 1);
+
+			// the next value in field order, which must not reach y
+			if (!f.descending) {
+				if (u == max || (y && u + 1 >= pyleveldb_field_load(f, y->data())))
+					return false;
+
+				pyleveldb_field_store(f, u + 1, field);
+			} else {
+				if (u == 0 || (y && u - 1 <= pyleveldb_field_load(f, y->data())))
+					return false;
+
+				pyleveldb_field_store(f, u - 1, field);
+			}
+
+			return true;
+		}
+
+		std::string c = x.ToString();
+
+		if (!f.descending) {
+			// bytewise shortening gives a string after x
+			if (y)
+				leveldb::BytewiseComparator()->FindShortestSeparator(&c, *y);
+			else
+				leveldb::BytewiseComparator()->FindShortSuccessor(&c);
+
+			if (x.compare(c) >= 0)
+				return false;
+		} else {
+			// descending, any prefix of x longer than the common prefix with y comes after x,
+			// and the empty string comes last, unless it is trailing, i.e. a missing field
+			size_t n = 0;
+
+			if (y) {
+				size_t m = std::min(x.size(), y->size());
+
+				while (n < m && x[n] == (*y)[n])
+					n++;
+
+				n += 1;
+			} else if (trailing) {
+				n = 1;
+			}
+
+			if (n >= x.size())
+				return false;
+
+			c.resize(n);
+		}
+
+		field->swap(c);
+		return true;
+	}
+
+	// replace the fields from offset on, starting with field i, by the given one, if shorter
+	void Replace(std::string* key, size_t offset, size_t i, const std::string& field) const
+	{
+		std::string s(key->data(), offset);
+
+		if (fields[i].width == 0 && i + 1 < fields.size()) {
+			uint32_t v = (uint32_t)field.size();
+
+			while (v >= 0x80) {
+				s.push_back((char)(v | 0x80));
+				v >>= 7;
+			}
+
+			s.push_back((char)v);
+		}
+
+		s.append(field);
+
+		if (s.size() < key->size())
+			key->swap(s);
+	}
+
+	std::vector<PyLevelDBKeyField> fields;
+	std::string name;
+};
+
+leveldb::Comparator* pyleveldb_schema_comparator_new(const std::vector<PyLevelDBKeyField>& fields, const std::string& name)
+{
+	return new PyLevelDBSchemaComparator(fields, name);
+}
+
+leveldb::Comparator* pyleveldb_native_comparator_new(const char* name)
+{
+	if (strcmp(name, "reverse-bytewise") == 0)
+		return new PyLevelDBReverseBytewiseComparator();
+
+	if (strcmp(name, "uint64") == 0)
+		return new PyLevelDBUint64Comparator();
+
+	if (strcmp(name, "int64") == 0)
+		return new PyLevelDBInt64Comparator();
+
+	if (strcmp(name, "tuple") == 0)
+		return new PyLevelDBTupleComparator();
+
+	if (strcmp(name, "ascii-nocase") == 0)
+		return new PyLevelDBAsciiNocaseComparator();
+
+	return 0;
+}
@@ -0,0 +1,602 @@
+// Copyright (c) Arni Mar Jonsson.
+// See LICENSE for details.
+
+// Env of each database opened from Python, wrapping leveldb::Env::Default().
+//
+// Table files are opened through a RandomAccessFile wrapper which, while the reading thread has
+// asked for read-ahead (see pyleveldb_set_readahead()), detects blocks being read back to back and
+// asks the kernel to fetch the following readahead bytes of the file asynchronously. Blocks are
+// then served from the page cache, instead of one small read per block.
+//
+// Background work is run with the compaction read-ahead of the database, and compaction input
+// already read is dropped from the page cache, so merging tables does not push out the blocks
+// foreground reads use. Only tables no foreground read has touched are dropped: the inputs of a
+// compaction stay live until it finishes, and pages of them that Get() or an iterator is using
+// would otherwise have to be read again.
+//
+// Blocks can also be kept in a second cache tier, as read from the file, i.e. compressed, which
+// is consulted before going to disk when a block misses the block cache. Many more blocks fit in
+// the same memory compressed, and decompressing one is far cheaper than reading it from disk.
+// Compaction input is not admitted.
+//
+// Below that, blocks can be kept in a persistent cache file on a fast local disk, see
+// leveldb_file_cache.cc, for table files on network or rotating volumes.
+//
+// The wrapper picks up the layout of a table from its footer, the first thing leveldb reads when
+// opening it, and its metaindex, and from then on tells the index, filter and metaindex blocks apart
+// from data blocks.
+// leveldb keeps those in the table cache while the table is open, not in the block cache, so they
+// are counted separately, and can be kept in a cache of their own, which data blocks never push
+// out, for when a table is opened again after it has dropped out of the table cache.
+
+#include "leveldb_ext.h"
+
+// to read compressed metaindex blocks
+#include "snappy.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// read-ahead asked for by the iterator currently running on this thread, 0 if none
+static __thread size_t pyleveldb_thread_readahead = 0;
+
+// whether the reads of this thread are compaction input, read once
+static __thread bool pyleveldb_thread_drop_behind = false;
+
+// sequential reads before read-ahead kicks in
+static const int pyleveldb_readahead_trigger = 2;
+
+enum {
+	pyleveldb_block_data,
+	pyleveldb_block_index,
+	pyleveldb_block_filter,
+
+	// footer and metaindex
+	pyleveldb_block_meta
+};
+
+// what the table files of an Env share
+struct PyLevelDBEnvTables {
+	// compressed block tier, and table metadata tier, if any
+	leveldb::Cache* compressed;
+	leveldb::Cache* metadata;
+
+	PyLevelDBFileCache* file_cache;
+
+	// id of the database, for the fingerprints of its tables, 0 until known
+	uint64_t database_id;
+
+	// bytes of index and filter blocks of the open tables
+	uint64_t index_usage;
+	uint64_t filter_usage;
+};
+
+size_t pyleveldb_set_readahead(size_t readahead)
+{
+	size_t previous = pyleveldb_thread_readahead;
+	pyleveldb_thread_readahead = readahead;
+	return previous;
+}
+
+class PyLevelDBReadaheadFile : public leveldb::RandomAccessFile
+{
+public:
+	PyLevelDBReadaheadFile(const std::string& fname, leveldb::RandomAccessFile* base, PyLevelDBEnvTables* tables) :
+		fname(fname),
+		base(base),
+		tables(tables),
+		compressed(tables->compressed),
+		id(compressed ? compressed->NewId() : 0),
+		file_cache(tables->file_cache),
+		fingerprint(0),
+		footer_hash(0),
+		table(false),
+		footer_offset(0),
+		metaindex_offset(0),
+		index_offset(0),
+		filter_offset((uint64_t)-1),
+		filter_size(0),
+		index_charge(0),
+		filter_charge(0),
+		fd(-1),
+		next(0),
+		window(0),
+		dropped(0),
+		sequential(0),
+		foreground(0)
+	{
+		pthread_mutex_init(&mutex, 0);
+	}
+
+	virtual ~PyLevelDBReadaheadFile()
+	{
+		__sync_fetch_and_sub(&tables->index_usage, index_charge);
+		__sync_fetch_and_sub(&tables->filter_usage, filter_charge);
+		delete base;
+
+		if (fd >= 0)
+			close(fd);
+
+		pthread_mutex_destroy(&mutex);
+	}
+
+	virtual leveldb::Status Read(uint64_t offset, size_t n, leveldb::Slice* result, char* scratch) const
+	{
+		int category = Classify(offset, n);
+
+		if (!pyleveldb_thread_drop_behind && __sync_fetch_and_add(&foreground, 0) == 0)
+			__sync_fetch_and_add(&foreground, 1);
+
+		if (category != pyleveldb_block_data && tables->metadata) {
+			leveldb::Status status = ReadMetadata(offset, n, result, scratch);
+
+			if (status.ok())
+				Opened(category, offset, n, *result);
+
+			return status;
+		}
+
+		leveldb::Status status = ReadBlock(offset, n, result, scratch);
+
+		if (status.ok() && category != pyleveldb_block_data)
+			Opened(category, offset, n, *result);
+
+		return status;
+	}
+
+private:
+	// what a block is, from the layout of the table; reads of the size of a footer are taken
+	// for one until a footer has been seen
+	int Classify(uint64_t offset, size_t n) const
+	{
+		if (!table)
+			return (n == pyleveldb_table_footer_size) ? pyleveldb_block_meta : pyleveldb_block_data;
+
+		if (offset == filter_offset && n == filter_size + pyleveldb_table_trailer_size)
+			return pyleveldb_block_filter;
+
+		if (offset == index_offset)
+			return pyleveldb_block_index;
+
+		if (offset == metaindex_offset || offset == footer_offset)
+			return pyleveldb_block_meta;
+
+		return pyleveldb_block_data;
+	}
+
+	// leveldb reads the footer, index, metaindex and filter of a table, in that order, when opening
+	// it, before the table is shared with other threads, so the layout needs no locking
+	void Opened(int category, uint64_t offset, size_t n, const leveldb::Slice& block) const
+	{
+		if (block.size() != n)
+			return;
+
+		if (category == pyleveldb_block_meta && !table && n == pyleveldb_table_footer_size) {
+			Footer(offset, block);
+			return;
+		}
+
+		if (category == pyleveldb_block_meta && offset == metaindex_offset) {
+			Metaindex(block);
+			return;
+		}
+
+		if (category == pyleveldb_block_index && index_charge == 0) {
+			index_charge = n;
+			__sync_fetch_and_add(&tables->index_usage, index_charge);
+			Fingerprint(block);
+		}
+
+		if (category == pyleveldb_block_filter && filter_charge == 0) {
+			filter_charge = n;
+			__sync_fetch_and_add(&tables->filter_usage, filter_charge);
+		}
+	}
+
+	void Footer(uint64_t offset, const leveldb::Slice& footer) const
+	{
+		const char* p = footer.data();
+		const char* end = p + footer.size();
+		uint64_t metaindex_size = 0;
+		uint64_t index_size = 0;
+
+		if (pyleveldb_load_le64(end - 8) != pyleveldb_table_magic ||
+			!pyleveldb_decode_varint64(&p, end, &metaindex_offset) || !pyleveldb_decode_varint64(&p, end, &metaindex_size) ||
+			!pyleveldb_decode_varint64(&p, end, &index_offset) || !pyleveldb_decode_varint64(&p, end, &index_size))
+			return;
+
+		table = true;
+		footer_offset = offset;
+
+		// the number, size and footer of the table
+		size_t slash = fname.rfind('/');
+		uint64_t id[2] = {strtoull(fname.c_str() + ((slash == std::string::npos) ? 0 : slash + 1), 0, 10), offset + footer.size()};
+		footer_hash = pyleveldb_hash64(footer.data(), footer.size(), pyleveldb_hash64((const char*)id, sizeof(id), 0));
+	}
+
+	// the metaindex maps "filter.<policy name>" to the filter block, leveldb only reads it with a filter policy
+	void Metaindex(const leveldb::Slice& block) const
+	{
+		if (block.size() < pyleveldb_table_trailer_size)
+			return;
+
+		size_t size = block.size() - pyleveldb_table_trailer_size;
+		leveldb::Slice contents(block.data(), size);
+		std::string uncompressed;
+		size_t n = 0;
+
+		// no compression, or snappy
+		if (block[size] == 1) {
+			if (!snappy::GetUncompressedLength(contents.data(), contents.size(), &n))
+				return;
+
+			uncompressed.resize(n);
+
+			if (!snappy::RawUncompress(contents.data(), contents.size(), &uncompressed[0]))
+				return;
+
+			contents = uncompressed;
+		}
+
+		// entries of shared key bytes, unshared key bytes and value size, followed by the restart array
+		if (contents.size() < 4)
+			return;
+
+		uint64_t restarts = pyleveldb_load_le32(contents.data() + contents.size() - 4);
+
+		if ((restarts + 1) * 4 > contents.size())
+			return;
+
+		const char* p = contents.data();
+		const char* end = contents.data() + contents.size() - (restarts + 1) * 4;
+		std::string key;
+
+		while (p < end) {
+			uint64_t shared = 0;
+			uint64_t unshared = 0;
+			uint64_t value_size = 0;
+
+			if (!pyleveldb_decode_varint64(&p, end, &shared) || !pyleveldb_decode_varint64(&p, end, &unshared) ||
+				!pyleveldb_decode_varint64(&p, end, &value_size) || shared > key.size() || unshared + value_size > (uint64_t)(end - p))
+				return;
+
+			key.resize(shared);
+			key.append(p, unshared);
+			p += unshared;
+
+			const char* value = p;
+			p += value_size;
+
+			if (key.compare(0, 7, "filter.") == 0) {
+				uint64_t offset = 0;
+				uint64_t size = 0;
+
+				if (pyleveldb_decode_varint64(&value, p, &offset) && pyleveldb_decode_varint64(&value, p, &size)) {
+					filter_offset = offset;
+					filter_size = size;
+				}
+
+				return;
+			}
+		}
+	}
+
+	// identifies the table in the persistent cache, across restarts: the database it belongs to,
+	// its footer and its index block, which is therefore never read from the cache itself
+	void Fingerprint(const leveldb::Slice& index) const
+	{
+		uint64_t database = __sync_fetch_and_add(&tables->database_id, 0);
+
+		if (file_cache == 0 || database == 0)
+			return;
+
+		uint64_t f = pyleveldb_hash64(index.data(), index.size(), pyleveldb_hash64((const char*)&database, sizeof(database), footer_hash));
+		fingerprint = f ? f : 1;
+	}
+
+	// table metadata, from its own tier, keyed by file name, offset and size, which outlive this file object
+	leveldb::Status ReadMetadata(uint64_t offset, size_t n, leveldb::Slice* result, char* scratch) const
+	{
+		uint64_t size = n;
+		std::string key(fname);
+		key.append((const char*)&offset, sizeof(offset));
+		key.append((const char*)&size, sizeof(size));
+
+		leveldb::Cache::Handle* handle = tables->metadata->Lookup(key);
+
+		if (handle) {
+			const std::string* block = (const std::string*)tables->metadata->Value(handle);
+			memcpy(scratch, block->data(), n);
+			*result = leveldb::Slice(scratch, n);
+			tables->metadata->Release(handle);
+			return leveldb::Status::OK();
+		}
+
+		leveldb::Status status = base->Read(offset, n, result, scratch);
+
+		if (status.ok() && result->size() == n) {
+			std::string* block = new std::string(result->data(), result->size());
+			tables->metadata->Release(tables->metadata->Insert(key, block, key.size() + block->size(), &PyLevelDBReadaheadFile::Delete));
+		}
+
+		return status;
+	}
+
+	// a block through the compressed and persistent tiers
+	leveldb::Status ReadBlock(uint64_t offset, size_t n, leveldb::Slice* result, char* scratch) const
+	{
+		// file id, offset and size
+		char key[24];
+
+		if (compressed) {
+			uint64_t size = n;
+			memcpy(key, &id, 8);
+			memcpy(key + 8, &offset, 8);
+			memcpy(key + 16, &size, 8);
+
+			if (Cached(leveldb::Slice(key, sizeof(key)), n, result, scratch))
+				return leveldb::Status::OK();
+		}
+
+		leveldb::Status status;
+		bool admit = !pyleveldb_thread_drop_behind;
+
+		if (file_cache && fingerprint && admit && pyleveldb_file_cache_lookup(file_cache, fingerprint, offset, n, scratch)) {
+			*result = leveldb::Slice(scratch, n);
+		} else {
+			size_t readahead = pyleveldb_thread_readahead;
+
+			if (readahead > 0)
+				Advise(offset, n, readahead);
+
+			status = base->Read(offset, n, result, scratch);
+
+			if (file_cache && fingerprint && admit && status.ok() && result->size() == n)
+				pyleveldb_file_cache_insert(file_cache, fingerprint, offset, *result);
+		}
+
+		if (compressed && admit && status.ok() && result->size() == n) {
+			std::string* block = new std::string(result->data(), result->size());
+			compressed->Release(compressed->Insert(leveldb::Slice(key, sizeof(key)), block, block->size(), &PyLevelDBReadaheadFile::Delete));
+		}
+
+		return status;
+	}
+
+	// a block read before, copied into scratch
+	bool Cached(const leveldb::Slice& key, size_t n, leveldb::Slice* result, char* scratch) const
+	{
+		leveldb::Cache::Handle* handle = compressed->Lookup(key);
+
+		if (handle == 0)
+			return false;
+
+		const std::string* block = (const std::string*)compressed->Value(handle);
+		memcpy(scratch, block->data(), n);
+		*result = leveldb::Slice(scratch, n);
+
+		compressed->Release(handle);
+		return true;
+	}
+
+	static void Delete(const leveldb::Slice& key, void* value)
+	{
+		delete (std::string*)value;
+	}
+
+	void Advise(uint64_t offset, size_t n, size_t readahead) const
+	{
+		pthread_mutex_lock(&mutex);
+
+		if (offset == next) {
+			sequential++;
+		} else {
+			sequential = 0;
+			window = 0;
+			dropped = offset & ~(uint64_t)4095;
+		}
+
+		next = offset + n;
+
+		// keep at least half of the read-ahead in front of the reader, fetching it a window at a time
+		if (sequential >= pyleveldb_readahead_trigger && next + readahead / 2 > window) {
+			uint64_t start = (window > next) ? window : next;
+			start &= ~(uint64_t)4095;
+			window = start + readahead;
+
+			// opened on first use, most table files are never scanned
+			if (fd < 0)
+				fd = open(fname.c_str(), O_RDONLY);
+
+			#if defined(POSIX_FADV_WILLNEED)
+			if (fd >= 0)
+				posix_fadvise(fd, (off_t)start, (off_t)readahead, POSIX_FADV_WILLNEED);
+			#elif defined(F_RDADVISE)
+			if (fd >= 0) {
+				struct radvisory advice;
+				advice.ra_offset = (off_t)start;
+				advice.ra_count = (int)readahead;
+				fcntl(fd, F_RDADVISE, &advice);
+			}
+			#endif
+
+			// compaction input is read once, drop what has been consumed since the last window,
+			// unless foreground reads use the table as well
+			#if defined(POSIX_FADV_DONTNEED)
+			uint64_t consumed = offset & ~(uint64_t)4095;
+
+			if (pyleveldb_thread_drop_behind && __sync_fetch_and_add(&foreground, 0) == 0 && fd >= 0 && consumed > dropped) {
+				posix_fadvise(fd, (off_t)dropped, (off_t)(consumed - dropped), POSIX_FADV_DONTNEED);
+				dropped = consumed;
+			}
+			#endif
+		}
+
+		pthread_mutex_unlock(&mutex);
+	}
+
+	std::string fname;
+	leveldb::RandomAccessFile* base;
+	PyLevelDBEnvTables* tables;
+
+	// compressed block tier, if any, and the id of the file in it
+	leveldb::Cache* compressed;
+	uint64_t id;
+
+	// persistent block cache, if any, and the fingerprint of the table in it, 0 until its index is
+	// read, and the hash of its footer until then
+	PyLevelDBFileCache* file_cache;
+	mutable uint64_t fingerprint;
+	mutable uint64_t footer_hash;
+
+	// layout of the table, once its footer is read, and where its filter is, once its metaindex is read
+	mutable bool table;
+	mutable uint64_t footer_offset;
+	mutable uint64_t metaindex_offset;
+	mutable uint64_t index_offset;
+	mutable uint64_t filter_offset;
+	mutable uint64_t filter_size;
+
+	// bytes of the index and filter blocks, while the table is open
+	mutable uint64_t index_charge;
+	mutable uint64_t filter_charge;
+
+	// sequential access state, shared by all readers of the table
+	mutable pthread_mutex_t mutex;
+	mutable int fd;
+	mutable uint64_t next;
+	mutable uint64_t window;
+	mutable uint64_t dropped;
+	mutable int sequential;
+
+	// non-zero once a foreground thread has read from the table, its pages are then never dropped
+	mutable int foreground;
+};
+
+class PyLevelDBEnv : public leveldb::EnvWrapper
+{
+public:
+	PyLevelDBEnv(leveldb::Env* target, size_t compaction_readahead, size_t compressed_cache_size, size_t metadata_cache_size, PyLevelDBFileCache* file_cache) :
+		leveldb::EnvWrapper(target),
+		compaction_readahead(compaction_readahead)
+	{
+		tables.compressed = compressed_cache_size ? pyleveldb_cache_new(compressed_cache_size, "lru", 0) : 0;
+		tables.metadata = metadata_cache_size ? pyleveldb_cache_new(metadata_cache_size, "lru", 0) : 0;
+		tables.file_cache = file_cache;
+		tables.database_id = 0;
+		tables.index_usage = 0;
+		tables.filter_usage = 0;
+	}
+
+	virtual ~PyLevelDBEnv()
+	{
+		pyleveldb_cache_unref(tables.compressed);
+		pyleveldb_cache_unref(tables.metadata);
+
+		if (tables.file_cache)
+			pyleveldb_file_cache_delete(tables.file_cache);
+	}
+
+	leveldb::Cache* CompressedCache() const
+	{
+		return tables.compressed;
+	}
+
+	leveldb::Cache* MetadataCache() const
+	{
+		return tables.metadata;
+	}
+
+	PyLevelDBFileCache* FileCache() const
+	{
+		return tables.file_cache;
+	}
+
+	void SetDatabaseId(uint64_t id)
+	{
+		__sync_lock_test_and_set(&tables.database_id, id);
+	}
+
+	void TableUsage(uint64_t* index, uint64_t* filter)
+	{
+		*index = __sync_fetch_and_add(&tables.index_usage, 0);
+		*filter = __sync_fetch_and_add(&tables.filter_usage, 0);
+	}
+
+	// background work (compactions, memtable flushes) runs with the compaction read-ahead, and its
+	// reads are marked as compaction input even without read-ahead, so they are never admitted to
+	// the cache tiers
+	virtual void Schedule(void (*function)(void*), void* arg)
+	{
+		PyLevelDBEnvWork* work = new PyLevelDBEnvWork;
+		work->function = function;
+		work->arg = arg;
+		work->readahead = compaction_readahead;
+		target()->Schedule(&PyLevelDBEnv::Run, work);
+	}
+
+	virtual leveldb::Status NewRandomAccessFile(const std::string& fname, leveldb::RandomAccessFile** result)
+	{
+		leveldb::Status status = target()->NewRandomAccessFile(fname, result);
+
+		if (status.ok())
+			*result = new PyLevelDBReadaheadFile(fname, *result, &tables);
+
+		return status;
+	}
+
+private:
+	struct PyLevelDBEnvWork {
+		void (*function)(void*);
+		void* arg;
+		size_t readahead;
+	};
+
+	static void Run(void* arg)
+	{
+		PyLevelDBEnvWork* work = (PyLevelDBEnvWork*)arg;
+		size_t readahead = pyleveldb_set_readahead(work->readahead);
+		pyleveldb_thread_drop_behind = true;
+
+		(*work->function)(work->arg);
+
+		pyleveldb_thread_drop_behind = false;
+		pyleveldb_set_readahead(readahead);
+		delete work;
+	}
+
+	size_t compaction_readahead;
+
+	PyLevelDBEnvTables tables;
+};
+
+leveldb::Env* pyleveldb_env_new(size_t compaction_readahead, size_t compressed_cache_size, size_t metadata_cache_size, PyLevelDBFileCache* file_cache)
+{
+	return new PyLevelDBEnv(leveldb::Env::Default(), compaction_readahead, compressed_cache_size, metadata_cache_size, file_cache);
+}
+
+leveldb::Cache* pyleveldb_env_metadata_cache(leveldb::Env* env)
+{
+	return ((PyLevelDBEnv*)env)->MetadataCache();
+}
+
+void pyleveldb_env_table_usage(leveldb::Env* env, uint64_t* index, uint64_t* filter)
+{
+	((PyLevelDBEnv*)env)->TableUsage(index, filter);
+}
+
+PyLevelDBFileCache* pyleveldb_env_file_cache(leveldb::Env* env)
+{
+	return ((PyLevelDBEnv*)env)->FileCache();
+}
+
+void pyleveldb_env_set_database_id(leveldb::Env* env, uint64_t id)
+{
+	((PyLevelDBEnv*)env)->SetDatabaseId(id);
+}
+
+leveldb::Cache* pyleveldb_env_compressed_cache(leveldb::Env* env)
+{
+	return ((PyLevelDBEnv*)env)->CompressedCache();
+}
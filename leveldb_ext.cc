@@ -9,6 +9,8 @@ static PyMethodDef leveldb_extension_methods[] =
 {
 	{ (char*)"RepairDB",  (PyCFunction)pyleveldb_repair_db,  METH_VARARGS | METH_KEYWORDS, (char*)pyleveldb_repair_db_doc  },
 	{ (char*)"DestroyDB", (PyCFunction)pyleveldb_destroy_db, METH_VARARGS, (char*)pyleveldb_destroy_db_doc },
+	{ (char*)"pack_key",  (PyCFunction)pyleveldb_pack_key,   METH_VARARGS, (char*)pyleveldb_pack_key_doc },
+	{ (char*)"unpack_key", (PyCFunction)pyleveldb_unpack_key, METH_VARARGS, (char*)pyleveldb_unpack_key_doc },
 	{NULL, NULL},
 };
 
@@ -95,6 +97,31 @@ extern "C" void initleveldb(void)
 		INITERROR;
 	}
 
+	if (PyType_Ready(&PyLevelDBMultiIter_Type) < 0) {
+		Py_DECREF(leveldb_module);
+		INITERROR;
+	}
+
+	if (PyType_Ready(&PyLevelDBBuffer_Type) < 0) {
+		Py_DECREF(leveldb_module);
+		INITERROR;
+	}
+
+	if (PyType_Ready(&PyLevelDBPinnedValue_Type) < 0) {
+		Py_DECREF(leveldb_module);
+		INITERROR;
+	}
+
+	if (PyType_Ready(&PyLevelDBKeySchema_Type) < 0) {
+		Py_DECREF(leveldb_module);
+		INITERROR;
+	}
+
+	if (PyType_Ready(&PyLevelDBBlockCache_Type) < 0) {
+		Py_DECREF(leveldb_module);
+		INITERROR;
+	}
+
 	// add custom types to the different modules
 	Py_INCREF(&PyLevelDB_Type);
 
@@ -117,6 +144,20 @@ extern "C" void initleveldb(void)
 		INITERROR;
 	}
 
+	Py_INCREF(&PyLevelDBKeySchema_Type);
+
+	if (PyModule_AddObject(leveldb_module, (char*)"KeySchema", (PyObject*)&PyLevelDBKeySchema_Type) != 0) {
+		Py_DECREF(leveldb_module);
+		INITERROR;
+	}
+
+	Py_INCREF(&PyLevelDBBlockCache_Type);
+
+	if (PyModule_AddObject(leveldb_module, (char*)"BlockCache", (PyObject*)&PyLevelDBBlockCache_Type) != 0) {
+		Py_DECREF(leveldb_module);
+		INITERROR;
+	}
+
 	PyEval_InitThreads();
 
 	#if PY_MAJOR_VERSION >= 3
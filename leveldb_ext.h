@@ -13,16 +13,23 @@ extern "C" {
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <stdint.h>
 #include <limits.h>
+#include <regex.h>
 }
 
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
 #include <leveldb/comparator.h>
 #include <leveldb/cache.h>
+#include <leveldb/env.h>
+#include <leveldb/filter_policy.h>
 
 #include <vector>
 
+class PyLevelDBRowCache;
+
 typedef struct {
 	PyObject_HEAD
 
@@ -32,6 +39,16 @@ typedef struct {
 	leveldb::Options* _options;
 	leveldb::Cache* _cache;
 	const leveldb::Comparator* _comparator;
+	leveldb::Env* _env;
+
+	// bloom filter policy of the tables, if any
+	const leveldb::FilterPolicy* _filter_policy;
+
+	// cache of values read by Get(), if any, see leveldb_row_cache.cc
+	PyLevelDBRowCache* _row_cache;
+
+	// database directory
+	std::string* _dbname;
 
 	// number of open snapshots, associated with LevelDB object
 	int n_snapshots;
@@ -48,8 +65,62 @@ typedef struct {
 
 	// the snapshot
 	const leveldb::Snapshot* snapshot;
+
+	// generation of the row cache the snapshot was taken at, 0 if it can not use the row cache
+	uint64_t row_generation;
 } PyLevelDBSnapshot;
 
+// entries decoded ahead by reverse iterators, in batches, so each step backwards does not cross into leveldb
+// with the GIL held (leveldb's own Prev() cost is unchanged)
+typedef struct {
+	std::vector<std::string> keys;
+	std::vector<std::string> values;
+
+	// number of buffered entries, and the next one to return
+	size_t n;
+	size_t pos;
+
+	// entries decoded per refill, grows up to pyleveldb_iter_cache_max_batch
+	size_t batch;
+} PyLevelDBIterCache;
+
+// native predicates, entries not matching all of them are skipped without crossing into Python
+typedef struct {
+	// POSIX extended regular expression, searched for in the key
+	bool has_key_regex;
+	regex_t key_regex;
+
+	bool has_value_prefix;
+	std::string value_prefix;
+
+	bool has_value_contains;
+	std::string value_contains;
+
+	// inclusive value size limits
+	size_t min_value_size;
+	size_t max_value_size;
+
+	// value[value_field_offset:value_field_offset + len(value_field)] == value_field
+	bool has_value_field;
+	size_t value_field_offset;
+	std::string value_field;
+} PyLevelDBIterFilter;
+
+// exporter for zero-copy iterator values, pointing into the iterator's current block
+typedef struct {
+	PyObject_HEAD
+
+	const char* data;
+	Py_ssize_t size;
+
+	// number of outstanding buffer exports, the iterator may not advance while any are alive
+	Py_ssize_t exports;
+
+	// iterator (and its database/snapshot) kept alive for exports outliving the iterator object
+	leveldb::Iterator* orphan;
+	PyObject* ref;
+} PyLevelDBPinnedValue;
+
 typedef struct {
 	PyObject_HEAD
 
@@ -70,8 +141,82 @@ typedef struct {
 
 	// if 1: return (k, v) 2-tuples, otherwise just k
 	int include_value;
+
+	// native filter, if any
+	PyLevelDBIterFilter* filter;
+
+	// if 1: values are read-only memoryviews into the current block, valid until the next advance
+	int value_view;
+
+	// the last returned value view and its exporter, the iterator is advanced lazily once both are released
+	PyObject* view;
+	PyLevelDBPinnedValue* pinned;
+
+	// decoded entries of reverse iterators, if any
+	PyLevelDBIterCache* cache;
+
+	// options the iterator was created with, used to re-create it on refresh()
+	leveldb::ReadOptions* read_options;
+
+	// what the iterator pins, as of its creation or last refresh(): table files and memtable bytes
+	uint64_t pinned_files;
+	uint64_t pinned_memtable_bytes;
+	uint64_t pinned_micros;
+
+	// read-ahead while advancing, see pyleveldb_set_readahead()
+	size_t readahead;
+
+	// 1 while a call advances the iterator, which may release the GIL half-way
+	int busy;
 } PyLevelDBIter;
 
+typedef struct {
+	// [start, end)
+	std::string start;
+	std::string end;
+
+	// position in the list of ranges passed in
+	Py_ssize_t index;
+} PyLevelDBRange;
+
+typedef struct {
+	PyObject_HEAD
+
+	// the associated LevelDB object or snapshot
+	PyObject* ref;
+
+	// the associated db object
+	PyLevelDB* db;
+
+	// the iterator, shared by all ranges
+	leveldb::Iterator* iterator;
+
+	// ranges, sorted by start key
+	std::vector<PyLevelDBRange>* ranges;
+
+	// the current range, and whether the iterator has been moved to its start yet
+	size_t range;
+	int positioned;
+
+	// if 1: return (i, k, v) 3-tuples, otherwise (i, k)
+	int include_value;
+
+	// 1 while next() runs, see PyLevelDBIter
+	int busy;
+} PyLevelDBMultiIter;
+
+typedef struct {
+	PyObject_HEAD
+
+	// the exported bytes, read-only once the object is created
+	std::string* data;
+
+	// buffer protocol format and item size, e.g. "i"/4 for offsets, "B"/1 for data
+	const char* format;
+	Py_ssize_t itemsize;
+	Py_ssize_t shape;
+} PyLevelDBBuffer;
+
 typedef struct {
 	bool is_put;
 	std::string key;
@@ -83,11 +228,39 @@ typedef struct {
 	std::vector<PyWriteBatchEntry>* ops;
 } PyWriteBatch;
 
+// a field of a KeySchema key
+typedef struct {
+	// bytes of a big-endian integer, 0 for a byte string
+	int width;
+	int is_signed;
+	int descending;
+} PyLevelDBKeyField;
+
+typedef struct {
+	PyObject_HEAD
+	std::vector<PyLevelDBKeyField>* fields;
+
+	// comparator name, identifying the schema in the database
+	std::string* name;
+} PyLevelDBKeySchema;
+
+typedef struct {
+	PyObject_HEAD
+
+	// shared with the databases using it, see leveldb_cache.cc
+	leveldb::Cache* cache;
+} PyLevelDBBlockCache;
+
 // custom types
 extern PyTypeObject PyLevelDB_Type;
 extern PyTypeObject PyLevelDBSnapshot_Type;
 extern PyTypeObject PyWriteBatch_Type;
 extern PyTypeObject PyLevelDBIter_Type;
+extern PyTypeObject PyLevelDBMultiIter_Type;
+extern PyTypeObject PyLevelDBBuffer_Type;
+extern PyTypeObject PyLevelDBPinnedValue_Type;
+extern PyTypeObject PyLevelDBKeySchema_Type;
+extern PyTypeObject PyLevelDBBlockCache_Type;
 
 #define PyLevelDB_Check(op) PyObject_TypeCheck(op, &PyLevelDB_Type)
 #define PyLevelDBSnapshotCheck(op) PyObject_TypeCheck(op, &PyLevelDBSnapshot_Type)
@@ -101,4 +274,213 @@ extern const char pyleveldb_destroy_db_doc[];
 extern PyObject* pyleveldb_repair_db(PyLevelDB* self, PyObject* args, PyObject* kwds);
 extern PyObject* pyleveldb_destroy_db(PyObject* self, PyObject* args);
 
+extern const char pyleveldb_pack_key_doc[];
+extern const char pyleveldb_unpack_key_doc[];
+
+extern PyObject* pyleveldb_pack_key(PyObject* self, PyObject* args);
+extern PyObject* pyleveldb_unpack_key(PyObject* self, PyObject* args);
+
+static inline uint64_t pyleveldb_load_be64(const char* p)
+{
+	const unsigned char* u = (const unsigned char*)p;
+
+	return ((uint64_t)u[0] << 56) | ((uint64_t)u[1] << 48) | ((uint64_t)u[2] << 40) | ((uint64_t)u[3] << 32) |
+		((uint64_t)u[4] << 24) | ((uint64_t)u[5] << 16) | ((uint64_t)u[6] << 8) | (uint64_t)u[7];
+}
+
+static inline uint32_t pyleveldb_load_le32(const char* p)
+{
+	const unsigned char* u = (const unsigned char*)p;
+
+	return ((uint32_t)u[3] << 24) | ((uint32_t)u[2] << 16) | ((uint32_t)u[1] << 8) | (uint32_t)u[0];
+}
+
+static inline uint64_t pyleveldb_load_le64(const char* p)
+{
+	const unsigned char* u = (const unsigned char*)p;
+
+	return ((uint64_t)u[7] << 56) | ((uint64_t)u[6] << 48) | ((uint64_t)u[5] << 40) | ((uint64_t)u[4] << 32) |
+		((uint64_t)u[3] << 24) | ((uint64_t)u[2] << 16) | ((uint64_t)u[1] << 8) | (uint64_t)u[0];
+}
+
+// leveldb's varint64, advancing *p, false if it runs past end
+static inline bool pyleveldb_decode_varint64(const char** p, const char* end, uint64_t* v)
+{
+	*v = 0;
+
+	for (int shift = 0; shift <= 63 && *p < end; shift += 7) {
+		uint64_t byte = (unsigned char)*(*p)++;
+		*v |= (byte & 0x7f) << shift;
+
+		if ((byte & 0x80) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+// footer of a table file: metaindex handle, index handle, padding and magic (see table/format.h),
+// and the type and crc following each block
+static const size_t pyleveldb_table_footer_size = 48;
+static const uint64_t pyleveldb_table_magic = 0xdb4775248b80fb57ull;
+static const size_t pyleveldb_table_trailer_size = 5;
+
+// key comparison in the scan and bound checking loops of the bindings, without a virtual call
+// for the default comparator, comparing keys a word at a time while they are equal
+static inline int pyleveldb_compare(const leveldb::Comparator* comparator, const leveldb::Slice& a, const leveldb::Slice& b)
+{
+	if (comparator != leveldb::BytewiseComparator())
+		return comparator->Compare(a, b);
+
+	const char* x = a.data();
+	const char* y = b.data();
+	size_t n = (a.size() < b.size()) ? a.size() : b.size();
+
+	for (; n >= 8; n -= 8, x += 8, y += 8) {
+		uint64_t u = pyleveldb_load_be64(x);
+		uint64_t v = pyleveldb_load_be64(y);
+
+		if (u != v)
+			return (u < v) ? -1 : 1;
+	}
+
+	int c = memcmp(x, y, n);
+
+	if (c != 0)
+		return c;
+
+	return (a.size() < b.size()) ? -1 : (a.size() > b.size()) ? 1 : 0;
+}
+
+// native comparator compiled from a KeySchema, see leveldb_comparator.cc
+extern leveldb::Comparator* pyleveldb_schema_comparator_new(const std::vector<PyLevelDBKeyField>& fields, const std::string& name);
+
+// names of the native comparators, null-terminated, see leveldb_comparator.cc
+extern const char* const pyleveldb_native_comparators[];
+
+// native comparator by name, 0 if there is none
+extern leveldb::Comparator* pyleveldb_native_comparator_new(const char* name);
+
+typedef struct {
+	size_t capacity;
+	size_t usage;
+	uint64_t hits;
+	uint64_t misses;
+	size_t shards;
+
+	// segmented LRU caches only
+	int segmented;
+	size_t probation_usage;
+	size_t protected_usage;
+	uint64_t probation_hits;
+	uint64_t protected_hits;
+} PyLevelDBCacheStats;
+
+// names of the block cache policies, null-terminated, see leveldb_cache.cc
+extern const char* const pyleveldb_cache_policies[];
+
+// shards of a block cache, unless given, and the most it can have
+extern const size_t pyleveldb_cache_default_shards;
+extern const size_t pyleveldb_cache_max_shards;
+
+// block cache holding one reference, with the policy's default number of shards if shards is 0,
+// 0 if the policy is unknown or does not support the number of shards, see leveldb_cache.cc
+extern leveldb::Cache* pyleveldb_cache_new(size_t capacity, const char* policy, size_t shards);
+
+// take/drop a reference to a cache made by pyleveldb_cache_new(), which is deleted with the last one
+extern leveldb::Cache* pyleveldb_cache_ref(leveldb::Cache* cache);
+extern void pyleveldb_cache_unref(leveldb::Cache* cache);
+
+extern void pyleveldb_cache_stats(leveldb::Cache* cache, PyLevelDBCacheStats* stats);
+
+// persistent block cache in a file, see leveldb_file_cache.cc
+class PyLevelDBFileCache;
+
+typedef struct {
+	uint64_t capacity;
+	uint64_t usage;
+	uint64_t hits;
+	uint64_t misses;
+
+	// blocks written, and blocks not written as they had not missed before
+	uint64_t inserts;
+	uint64_t rejected;
+
+	// blocks found in the file when it was opened
+	uint64_t recovered;
+} PyLevelDBFileCacheStats;
+
+extern uint64_t pyleveldb_hash64(const char* data, size_t n, uint64_t seed);
+
+// 0 and an error message if the file cannot be opened
+extern PyLevelDBFileCache* pyleveldb_file_cache_open(const std::string& path, uint64_t capacity, std::string* error);
+extern void pyleveldb_file_cache_delete(PyLevelDBFileCache* cache);
+
+// fingerprint identifies the table file, see leveldb_env.cc
+extern bool pyleveldb_file_cache_lookup(PyLevelDBFileCache* cache, uint64_t fingerprint, uint64_t offset, size_t n, char* scratch);
+extern void pyleveldb_file_cache_insert(PyLevelDBFileCache* cache, uint64_t fingerprint, uint64_t offset, const leveldb::Slice& data);
+extern void pyleveldb_file_cache_stats(PyLevelDBFileCache* cache, PyLevelDBFileCacheStats* stats);
+
+// id of the database in directory dbname, which table fingerprints cover, 0 if it has none yet;
+// a new one is written for a database created or first opened with a file cache, 0 if that fails
+extern uint64_t pyleveldb_file_cache_database_id(const std::string& dbname);
+extern uint64_t pyleveldb_file_cache_new_database_id(const std::string& dbname);
+extern void pyleveldb_file_cache_remove_database_id(const std::string& dbname);
+
+typedef struct {
+	uint64_t capacity;
+	uint64_t usage;
+	uint64_t hits;
+	uint64_t misses;
+
+	// values cached, and entries invalidated by writes
+	uint64_t inserts;
+	uint64_t invalidations;
+} PyLevelDBRowCacheStats;
+
+// byte_keys is false if keys comparing equal may differ, then writes invalidate all entries
+extern PyLevelDBRowCache* pyleveldb_row_cache_new(size_t capacity, bool byte_keys);
+extern void pyleveldb_row_cache_delete(PyLevelDBRowCache* cache);
+
+// generation of the database, 0 while writes are in flight
+extern uint64_t pyleveldb_row_cache_generation(PyLevelDBRowCache* cache);
+
+// handle of the value of key, as of the given generation of a snapshot, or (uint64_t)-1 for the latest,
+// 0 if it is not cached, the value is valid until the handle is released
+extern leveldb::Cache::Handle* pyleveldb_row_cache_lookup(PyLevelDBRowCache* cache, const leveldb::Slice& key, uint64_t snapshot);
+extern const std::string& pyleveldb_row_cache_value(PyLevelDBRowCache* cache, leveldb::Cache::Handle* handle);
+extern void pyleveldb_row_cache_release(PyLevelDBRowCache* cache, leveldb::Cache::Handle* handle);
+
+// cache the latest value of key, read after pyleveldb_row_cache_generation() returned generation,
+// unless a write has started since
+extern void pyleveldb_row_cache_insert(PyLevelDBRowCache* cache, const leveldb::Slice& key, const std::string& value, uint64_t generation);
+
+// around every write to the database, with the keys it writes
+extern void pyleveldb_row_cache_begin_write(PyLevelDBRowCache* cache);
+extern void pyleveldb_row_cache_end_write(PyLevelDBRowCache* cache, const leveldb::Slice* keys, size_t n);
+
+extern void pyleveldb_row_cache_stats(PyLevelDBRowCache* cache, PyLevelDBRowCacheStats* stats);
+
+// Env of a database, taking ownership of file_cache, if any, see leveldb_env.cc
+extern leveldb::Env* pyleveldb_env_new(size_t compaction_readahead, size_t compressed_cache_size, size_t metadata_cache_size, PyLevelDBFileCache* file_cache);
+
+// table metadata tier of an Env made by pyleveldb_env_new(), 0 if it has none
+extern leveldb::Cache* pyleveldb_env_metadata_cache(leveldb::Env* env);
+
+// bytes of the index and filter blocks of the tables open through an Env made by pyleveldb_env_new()
+extern void pyleveldb_env_table_usage(leveldb::Env* env, uint64_t* index, uint64_t* filter);
+
+// persistent block cache of an Env made by pyleveldb_env_new(), 0 if it has none
+extern PyLevelDBFileCache* pyleveldb_env_file_cache(leveldb::Env* env);
+
+// database id for the fingerprints of the tables opened through an Env made by pyleveldb_env_new()
+// from here on, until it is set those are not kept in its persistent block cache
+extern void pyleveldb_env_set_database_id(leveldb::Env* env, uint64_t id);
+
+// compressed block tier of an Env made by pyleveldb_env_new(), 0 if it has none
+extern leveldb::Cache* pyleveldb_env_compressed_cache(leveldb::Env* env);
+
+// read-ahead for sequential table reads on the calling thread, 0 to disable, returns the previous value
+extern size_t pyleveldb_set_readahead(size_t readahead);
+
 #endif
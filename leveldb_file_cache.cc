@@ -0,0 +1,441 @@
+// Copyright (c) Arni Mar Jonsson.
+// See LICENSE for details.
+
+// Persistent block cache in a single file, typically on a local SSD, in front of table files
+// stored on slower volumes. See leveldb_env.cc for where it sits in the read path.
+//
+// The file is a ring of records, each a header followed by a block as read from its table file,
+// aligned to pyleveldb_file_cache_align bytes. Records are written at the head of the ring,
+// overwriting the oldest ones. Blocks are keyed by a fingerprint of their table file and their
+// offset and size. The fingerprint covers the id of the database, kept in a file of its own in the
+// database directory, and the number, size, footer and index block of the table, so neither a
+// reused file number nor another database at the same path matches.
+//
+// The file is locked while open, only one database can use it at a time.
+//
+// The index is only kept in memory, and is rebuilt on open by following the records from the
+// start of the file, skipping over the remains of overwritten ones a slot at a time. Every hit
+// is checked against the checksum of its record, which also catches records overwritten while
+// they are being read, and a record failing it is dropped from the index.
+//
+// Records are written without holding the lock: their slot is reserved first, and they are only
+// indexed once written, unless the ring came round to the slot meanwhile.
+//
+// To keep one-off reads from churning the file, a block is only written once it has missed twice
+// within a while: misses are first recorded in a bitmap of key hashes, cleared when half full.
+
+#include "leveldb_ext.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/file.h>
+
+#include <map>
+
+static const uint32_t pyleveldb_file_cache_magic = 0x70796c63;
+static const uint64_t pyleveldb_file_cache_align = 512;
+
+// bits of the admission bitmap
+static const size_t pyleveldb_file_cache_admission_bits = 1 << 20;
+
+struct PyLevelDBFileCacheHeader {
+	uint32_t magic;
+	uint32_t size;
+	uint64_t seq;
+	uint64_t fingerprint;
+	uint64_t offset;
+
+	// of the data, and of the header fields above
+	uint64_t data_checksum;
+	uint64_t header_checksum;
+};
+
+struct PyLevelDBFileCacheKey {
+	uint64_t fingerprint;
+	uint64_t offset;
+	uint64_t size;
+
+	bool operator<(const PyLevelDBFileCacheKey& k) const
+	{
+		if (fingerprint != k.fingerprint)
+			return fingerprint < k.fingerprint;
+
+		if (offset != k.offset)
+			return offset < k.offset;
+
+		return size < k.size;
+	}
+};
+
+// a record in the file, only indexed once written
+struct PyLevelDBFileCacheRecord {
+	PyLevelDBFileCacheKey key;
+	uint64_t size;
+	uint64_t seq;
+	bool written;
+};
+
+// file in the database directory holding its id
+static const char pyleveldb_file_cache_id_name[] = "/PYLEVELDB-CACHE-ID";
+
+uint64_t pyleveldb_hash64(const char* data, size_t n, uint64_t seed)
+{
+	uint64_t h = seed ^ (n * 0x9e3779b97f4a7c15ull);
+
+	for (; n >= 8; n -= 8, data += 8) {
+		uint64_t w;
+		memcpy(&w, data, 8);
+		h = (h ^ (w * 0xff51afd7ed558ccdull)) * 0xc4ceb9fe1a85ec53ull;
+		h ^= h >> 29;
+	}
+
+	for (; n > 0; n--, data++)
+		h = (h ^ (unsigned char)*data) * 0x100000001b3ull;
+
+	return h ^ (h >> 32);
+}
+
+static uint64_t pyleveldb_file_cache_header_checksum(const PyLevelDBFileCacheHeader& h)
+{
+	return pyleveldb_hash64((const char*)&h, offsetof(PyLevelDBFileCacheHeader, data_checksum) + sizeof(h.data_checksum), 0);
+}
+
+static uint64_t pyleveldb_file_cache_aligned(uint64_t n)
+{
+	return (n + pyleveldb_file_cache_align - 1) & ~(pyleveldb_file_cache_align - 1);
+}
+
+class PyLevelDBFileCache
+{
+public:
+	PyLevelDBFileCache(int fd, uint64_t capacity) :
+		fd(fd),
+		capacity(capacity),
+		head(0),
+		seq(0),
+		usage(0),
+		admission(new uint64_t[pyleveldb_file_cache_admission_bits / 64]()),
+		admission_set(0)
+	{
+		pthread_mutex_init(&mutex, 0);
+		memset(&stats, 0, sizeof(stats));
+		stats.capacity = capacity;
+	}
+
+	~PyLevelDBFileCache()
+	{
+		close(fd);
+		delete[] admission;
+		pthread_mutex_destroy(&mutex);
+	}
+
+	// index the records left in the file, and continue after the most recent one
+	void Recover()
+	{
+		uint64_t pos = 0;
+		uint64_t last = 0;
+
+		while (pos + sizeof(PyLevelDBFileCacheHeader) <= capacity) {
+			PyLevelDBFileCacheHeader h;
+
+			if (pread(fd, &h, sizeof(h), (off_t)pos) != (ssize_t)sizeof(h))
+				break;
+
+			uint64_t n = pyleveldb_file_cache_aligned(sizeof(h) + h.size);
+
+			if (h.magic != pyleveldb_file_cache_magic || h.header_checksum != pyleveldb_file_cache_header_checksum(h) || pos + n > capacity) {
+				pos += pyleveldb_file_cache_align;
+				continue;
+			}
+
+			// a table's block is the same in every record of it, keep either
+			PyLevelDBFileCacheKey k = {h.fingerprint, h.offset, h.size};
+			std::map<PyLevelDBFileCacheKey, uint64_t>::iterator i = index.find(k);
+
+			if (i != index.end())
+				Evict(i->second);
+
+			Add(k, pos, n, h.seq, true);
+
+			if (h.seq >= seq) {
+				seq = h.seq;
+				last = pos + n;
+			}
+
+			pos += n;
+		}
+
+		head = last;
+		stats.recovered = index.size();
+	}
+
+	bool Lookup(uint64_t fingerprint, uint64_t offset, size_t n, char* scratch)
+	{
+		PyLevelDBFileCacheKey k = {fingerprint, offset, n};
+
+		pthread_mutex_lock(&mutex);
+		std::map<PyLevelDBFileCacheKey, uint64_t>::iterator i = index.find(k);
+		uint64_t pos = (i != index.end() && records[i->second].written) ? i->second : (uint64_t)-1;
+		pthread_mutex_unlock(&mutex);
+
+		// read without the lock, the record may be overwritten meanwhile, which the checks catch
+		PyLevelDBFileCacheHeader h;
+		bool hit = pos != (uint64_t)-1 &&
+			pread(fd, &h, sizeof(h), (off_t)pos) == (ssize_t)sizeof(h) &&
+			h.magic == pyleveldb_file_cache_magic && h.fingerprint == fingerprint && h.offset == offset && h.size == n &&
+			pread(fd, scratch, n, (off_t)(pos + sizeof(h))) == (ssize_t)n &&
+			pyleveldb_hash64(scratch, n, h.seq) == h.data_checksum;
+
+		pthread_mutex_lock(&mutex);
+
+		if (hit) {
+			stats.hits++;
+		} else {
+			stats.misses++;
+
+			// a damaged record would otherwise be read again on every miss
+			i = index.find(k);
+
+			if (pos != (uint64_t)-1 && i != index.end() && i->second == pos)
+				Evict(pos);
+		}
+
+		pthread_mutex_unlock(&mutex);
+		return hit;
+	}
+
+	void Insert(uint64_t fingerprint, uint64_t offset, const leveldb::Slice& data)
+	{
+		uint64_t n = pyleveldb_file_cache_aligned(sizeof(PyLevelDBFileCacheHeader) + data.size());
+
+		if (n > capacity)
+			return;
+
+		PyLevelDBFileCacheKey k = {fingerprint, offset, data.size()};
+
+		pthread_mutex_lock(&mutex);
+
+		if (index.find(k) != index.end() || !Admit(k)) {
+			pthread_mutex_unlock(&mutex);
+			return;
+		}
+
+		if (head + n > capacity)
+			head = 0;
+
+		// drop the records about to be overwritten, and reserve their slots
+		std::map<uint64_t, PyLevelDBFileCacheRecord>::iterator i = records.lower_bound(head);
+
+		while (i != records.end() && i->first < head + n)
+			Evict((i++)->first);
+
+		uint64_t pos = head;
+		uint64_t s = ++seq;
+		Add(k, pos, n, s, false);
+		head += n;
+		pthread_mutex_unlock(&mutex);
+
+		PyLevelDBFileCacheHeader h;
+		memset(&h, 0, sizeof(h));
+		h.magic = pyleveldb_file_cache_magic;
+		h.size = (uint32_t)data.size();
+		h.seq = s;
+		h.fingerprint = fingerprint;
+		h.offset = offset;
+		h.data_checksum = pyleveldb_hash64(data.data(), data.size(), h.seq);
+		h.header_checksum = pyleveldb_file_cache_header_checksum(h);
+
+		std::string record((const char*)&h, sizeof(h));
+		record.append(data.data(), data.size());
+		bool written = pwrite(fd, record.data(), record.size(), (off_t)pos) == (ssize_t)record.size();
+
+		// unless later inserts have taken the slot meanwhile
+		pthread_mutex_lock(&mutex);
+		i = records.find(pos);
+
+		if (i != records.end() && i->second.seq == s) {
+			if (written) {
+				i->second.written = true;
+				stats.inserts++;
+			} else {
+				Evict(pos);
+			}
+		}
+
+		pthread_mutex_unlock(&mutex);
+	}
+
+	void Stats(PyLevelDBFileCacheStats* s)
+	{
+		pthread_mutex_lock(&mutex);
+		*s = stats;
+		s->usage = usage;
+		pthread_mutex_unlock(&mutex);
+	}
+
+private:
+	// admit a block on its second miss since the bitmap was last cleared
+	bool Admit(const PyLevelDBFileCacheKey& k)
+	{
+		uint64_t bit = pyleveldb_hash64((const char*)&k, sizeof(k), 0) % pyleveldb_file_cache_admission_bits;
+		uint64_t mask = (uint64_t)1 << (bit % 64);
+
+		if (admission[bit / 64] & mask)
+			return true;
+
+		if (++admission_set > pyleveldb_file_cache_admission_bits / 2) {
+			memset(admission, 0, pyleveldb_file_cache_admission_bits / 8);
+			admission_set = 1;
+		}
+
+		admission[bit / 64] |= mask;
+		stats.rejected++;
+		return false;
+	}
+
+	void Add(const PyLevelDBFileCacheKey& k, uint64_t pos, uint64_t n, uint64_t s, bool written)
+	{
+		PyLevelDBFileCacheRecord r = {k, n, s, written};
+		index[k] = pos;
+		records[pos] = r;
+		usage += n;
+	}
+
+	void Evict(uint64_t pos)
+	{
+		std::map<uint64_t, PyLevelDBFileCacheRecord>::iterator i = records.find(pos);
+		index.erase(i->second.key);
+		usage -= i->second.size;
+		records.erase(i);
+	}
+
+	pthread_mutex_t mutex;
+	int fd;
+	uint64_t capacity;
+
+	// where the next record is written, and its sequence number
+	uint64_t head;
+	uint64_t seq;
+
+	// records by key and by position, including those being written, and the bytes they take
+	std::map<PyLevelDBFileCacheKey, uint64_t> index;
+	std::map<uint64_t, PyLevelDBFileCacheRecord> records;
+	uint64_t usage;
+
+	uint64_t* admission;
+	size_t admission_set;
+
+	PyLevelDBFileCacheStats stats;
+};
+
+PyLevelDBFileCache* pyleveldb_file_cache_open(const std::string& path, uint64_t capacity, std::string* error)
+{
+	int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+
+	if (fd < 0) {
+		*error = path + ": " + strerror(errno);
+		return 0;
+	}
+
+	// records of two databases would overwrite each other's
+	if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+		*error = path + ": " + ((errno == EWOULDBLOCK) ? "in use by another database" : strerror(errno));
+		close(fd);
+		return 0;
+	}
+
+	// a smaller capacity than before drops the records past it
+	off_t size = lseek(fd, 0, SEEK_END);
+
+	if (size > (off_t)capacity && ftruncate(fd, (off_t)capacity) != 0) {
+		*error = path + ": " + strerror(errno);
+		close(fd);
+		return 0;
+	}
+
+	PyLevelDBFileCache* cache = new PyLevelDBFileCache(fd, capacity);
+	cache->Recover();
+	return cache;
+}
+
+void pyleveldb_file_cache_delete(PyLevelDBFileCache* cache)
+{
+	delete cache;
+}
+
+bool pyleveldb_file_cache_lookup(PyLevelDBFileCache* cache, uint64_t fingerprint, uint64_t offset, size_t n, char* scratch)
+{
+	return cache->Lookup(fingerprint, offset, n, scratch);
+}
+
+void pyleveldb_file_cache_insert(PyLevelDBFileCache* cache, uint64_t fingerprint, uint64_t offset, const leveldb::Slice& data)
+{
+	cache->Insert(fingerprint, offset, data);
+}
+
+void pyleveldb_file_cache_stats(PyLevelDBFileCache* cache, PyLevelDBFileCacheStats* stats)
+{
+	cache->Stats(stats);
+}
+
+uint64_t pyleveldb_file_cache_database_id(const std::string& dbname)
+{
+	uint64_t id = 0;
+	int fd = open((dbname + pyleveldb_file_cache_id_name).c_str(), O_RDONLY);
+
+	if (fd < 0)
+		return 0;
+
+	if (read(fd, &id, sizeof(id)) != (ssize_t)sizeof(id))
+		id = 0;
+
+	close(fd);
+	return id;
+}
+
+uint64_t pyleveldb_file_cache_new_database_id(const std::string& dbname)
+{
+	uint64_t id = 0;
+	int fd = open("/dev/urandom", O_RDONLY);
+
+	if (fd >= 0) {
+		if (read(fd, &id, sizeof(id)) != (ssize_t)sizeof(id))
+			id = 0;
+
+		close(fd);
+	}
+
+	if (id == 0) {
+		uint64_t seed[3] = {(uint64_t)time(0), (uint64_t)getpid(), (uint64_t)(uintptr_t)&id};
+		id = pyleveldb_hash64((const char*)seed, sizeof(seed), clock());
+	}
+
+	id = id ? id : 1;
+
+	// written aside and renamed, so a crash leaves either no id or a whole one
+	std::string name = dbname + pyleveldb_file_cache_id_name;
+	std::string tmp = name + ".tmp";
+	fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	if (fd < 0)
+		return 0;
+
+	bool ok = write(fd, &id, sizeof(id)) == (ssize_t)sizeof(id) && fsync(fd) == 0;
+	close(fd);
+
+	if (!ok || rename(tmp.c_str(), name.c_str()) != 0) {
+		unlink(tmp.c_str());
+		return 0;
+	}
+
+	return id;
+}
+
+void pyleveldb_file_cache_remove_database_id(const std::string& dbname)
+{
+	unlink((dbname + pyleveldb_file_cache_id_name).c_str());
+}
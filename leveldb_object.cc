@@ -5,8 +5,32 @@
 
 #include <leveldb/comparator.h>
 
-static PyObject* PyLevelDBIter_New(PyObject* ref, PyLevelDB* db, leveldb::Iterator* iterator, std::string* bound, int include_value, int is_reverse);
-static PyObject* PyLevelDBSnapshot_New(PyLevelDB* db, const leveldb::Snapshot* snapshot);
+// to read compressed index blocks
+#include "snappy.h"
+
+#include <algorithm>
+
+static PyObject* PyLevelDBIter_New(PyObject* ref, PyLevelDB* db, leveldb::Iterator* iterator, const leveldb::ReadOptions& read_options, std::string* bound, int include_value, int is_reverse, PyLevelDBIterFilter* filter, int value_view, size_t readahead);
+static PyObject* PyLevelDBMultiIter_New(PyObject* ref, PyLevelDB* db, leveldb::Iterator* iterator, std::vector<PyLevelDBRange>* ranges, int include_value);
+static PyObject* PyLevelDBSnapshot_New(PyLevelDB* db, const leveldb::Snapshot* snapshot, uint64_t row_generation);
+static PyObject* PyLevelDBBuffer_New(std::string* data, const char* format, Py_ssize_t itemsize);
+
+// sets the read-ahead of the calling thread for its lifetime
+class PyLevelDBReadahead
+{
+public:
+	PyLevelDBReadahead(size_t readahead) : previous(pyleveldb_set_readahead(readahead))
+	{
+	}
+
+	~PyLevelDBReadahead()
+	{
+		pyleveldb_set_readahead(previous);
+	}
+
+private:
+	size_t previous;
+};
 
 static void PyLevelDB_set_error(leveldb::Status& status)
 {
@@ -29,6 +53,13 @@ PyObject* pyleveldb_destroy_db(PyObject* self, PyObject* args)
 
 	Py_BEGIN_ALLOW_THREADS
 	status = leveldb::DestroyDB(_db_dir.c_str(), options);
+
+	// leveldb leaves the directory in place while it holds files of ours
+	if (status.ok()) {
+		pyleveldb_file_cache_remove_database_id(_db_dir);
+		options.env->DeleteDir(_db_dir);
+	}
+
 	Py_END_ALLOW_THREADS
 
 	if (!status.ok()) {
@@ -45,17 +76,26 @@ static void PyLevelDB_dealloc(PyLevelDB* self)
 	Py_BEGIN_ALLOW_THREADS
 	delete self->_db;
 	delete self->_options;
-	delete self->_cache;
+	pyleveldb_cache_unref(self->_cache);
+	delete self->_env;
+	pyleveldb_row_cache_delete(self->_row_cache);
+	delete self->_dbname;
 
 	if (self->_comparator != leveldb::BytewiseComparator())
 		delete self->_comparator;
 
+	delete self->_filter_policy;
+
 	Py_END_ALLOW_THREADS
 
+	self->_dbname = 0;
 	self->_db = 0;
 	self->_options = 0;
 	self->_cache = 0;
 	self->_comparator = 0;
+	self->_filter_policy = 0;
+	self->_env = 0;
+	self->_row_cache = 0;
 	self->n_iterators = 0;
 	self->n_snapshots = 0;
 
@@ -108,6 +148,10 @@ static PyObject* PyLevelDB_new(PyTypeObject* type, PyObject* args, PyObject* kwd
 		self->_options = 0;
 		self->_cache = 0;
 		self->_comparator = 0;
+		self->_filter_policy = 0;
+		self->_env = 0;
+		self->_row_cache = 0;
+		self->_dbname = 0;
 		self->n_iterators = 0;
 		self->n_snapshots = 0;
 	}
@@ -179,18 +223,251 @@ static PyObject* PyLevelDBSnapshot_new(PyTypeObject* type, PyObject* args, PyObj
 #define PY_LEVELDB_STRING_OR_BYTEARRAY PyString_FromStringAndSize
 #endif
 
+// order-preserving key encoding: a type tag per item, followed by
+//
+//   int:   8 bytes, big-endian, sign bit flipped
+//   float: 8 bytes, big-endian IEEE 754, sign bit flipped if positive, all bits flipped if negative
+//   bytes/str: the bytes (UTF-8 for str), 0x00 escaped as 0x00 0xff, terminated by 0x00
+enum {
+	PYLEVELDB_KEY_NONE  = 0x01,
+	PYLEVELDB_KEY_BYTES = 0x02,
+	PYLEVELDB_KEY_STR   = 0x03,
+	PYLEVELDB_KEY_INT   = 0x04,
+	PYLEVELDB_KEY_FLOAT = 0x05
+};
+
+static void pyleveldb_pack_uint64(std::string* key, uint64_t v)
+{
+	for (int i = 7; i >= 0; i--)
+		key->push_back((char)((v >> (8 * i)) & 0xff));
+}
+
+static void pyleveldb_pack_string(std::string* key, const char* s, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		key->push_back(s[i]);
+
+		if (s[i] == 0)
+			key->push_back((char)0xff);
+	}
+
+	key->push_back(0);
+}
+
+static int pyleveldb_pack_item(std::string* key, PyObject* item)
+{
+	if (item == Py_None) {
+		key->push_back(PYLEVELDB_KEY_NONE);
+		return 1;
+	}
+
+	#if PY_MAJOR_VERSION < 3
+	if (PyInt_Check(item)) {
+		key->push_back(PYLEVELDB_KEY_INT);
+		pyleveldb_pack_uint64(key, (uint64_t)(PY_LONG_LONG)PyInt_AS_LONG(item) ^ ((uint64_t)1 << 63));
+		return 1;
+	}
+	#endif
+
+	if (PyLong_Check(item)) {
+		int overflow = 0;
+		PY_LONG_LONG v = PyLong_AsLongLongAndOverflow(item, &overflow);
+
+		if (overflow) {
+			PyErr_SetString(PyExc_OverflowError, "integer key items must fit in 64 bits");
+			return 0;
+		}
+
+		key->push_back(PYLEVELDB_KEY_INT);
+		pyleveldb_pack_uint64(key, (uint64_t)v ^ ((uint64_t)1 << 63));
+		return 1;
+	}
+
+	if (PyFloat_Check(item)) {
+		double d = PyFloat_AS_DOUBLE(item);
+		uint64_t v = 0;
+		memcpy(&v, &d, sizeof(v));
+		v = (v & ((uint64_t)1 << 63)) ? ~v : (v | ((uint64_t)1 << 63));
+
+		key->push_back(PYLEVELDB_KEY_FLOAT);
+		pyleveldb_pack_uint64(key, v);
+		return 1;
+	}
+
+	if (PyUnicode_Check(item)) {
+		PyObject* utf8 = PyUnicode_AsUTF8String(item);
+
+		if (utf8 == 0)
+			return 0;
+
+		key->push_back(PYLEVELDB_KEY_STR);
+		#if PY_MAJOR_VERSION >= 3
+		pyleveldb_pack_string(key, PyBytes_AS_STRING(utf8), (size_t)PyBytes_GET_SIZE(utf8));
+		#else
+		pyleveldb_pack_string(key, PyString_AS_STRING(utf8), (size_t)PyString_GET_SIZE(utf8));
+		#endif
+		Py_DECREF(utf8);
+		return 1;
+	}
+
+	PY_LEVELDB_DEFINE_BUFFER(s);
+
+	if (!PyArg_Parse(item, (char*)PARAM_S, PARAM_V(s))) {
+		PyErr_SetString(PyExc_TypeError, "key items must be None, int, float, str or bytes");
+		return 0;
+	}
+
+	leveldb::Slice v = PY_LEVELDB_SLICE_VALUE(s);
+	key->push_back(PYLEVELDB_KEY_BYTES);
+	pyleveldb_pack_string(key, v.data(), v.size());
+	PY_LEVELDB_RELEASE_BUFFER(s);
+	return 1;
+}
+
+const char pyleveldb_pack_key_doc[] =
+"leveldb.pack_key(items) -> key\n\nEncode a tuple of None, int (64 bits), float, str and bytes items into a key whose\n"
+"bytewise order is the order of the tuples, so composite keys work with the default comparator.\n"
+"Items of different types are ordered None < bytes < str < int < float."
+;
+PyObject* pyleveldb_pack_key(PyObject* self, PyObject* args)
+{
+	PyObject* items = 0;
+
+	if (!PyArg_ParseTuple(args, (char*)"O", &items))
+		return 0;
+
+	PyObject* seq = PySequence_Fast(items, "items must be a tuple or a list");
+
+	if (seq == 0)
+		return 0;
+
+	std::string key;
+
+	for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(seq); i++) {
+		if (!pyleveldb_pack_item(&key, PySequence_Fast_GET_ITEM(seq, i))) {
+			Py_DECREF(seq);
+			return 0;
+		}
+	}
+
+	Py_DECREF(seq);
+	return PY_LEVELDB_STRING_OR_BYTEARRAY(key.data(), key.size());
+}
+
+// read an escaped, terminated string, false if malformed
+static bool pyleveldb_unpack_string(const char** p, const char* end, std::string* s)
+{
+	while (*p < end) {
+		char c = *(*p)++;
+
+		if (c != 0) {
+			s->push_back(c);
+			continue;
+		}
+
+		if (*p < end && (unsigned char)**p == 0xff) {
+			s->push_back(0);
+			(*p)++;
+			continue;
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+static uint64_t pyleveldb_unpack_uint64(const char* p)
+{
+	uint64_t v = 0;
+
+	for (int i = 0; i < 8; i++)
+		v = (v << 8) | (unsigned char)p[i];
+
+	return v;
+}
+
+const char pyleveldb_unpack_key_doc[] =
+"leveldb.unpack_key(key) -> tuple\n\nDecode a key made by pack_key() back into a tuple."
+;
+PyObject* pyleveldb_unpack_key(PyObject* self, PyObject* args)
+{
+	PY_LEVELDB_DEFINE_BUFFER(key);
+
+	if (!PyArg_ParseTuple(args, (char*)PARAM_S, PARAM_V(key)))
+		return 0;
+
+	std::string k = PY_LEVELDB_STRING(key);
+	PY_LEVELDB_RELEASE_BUFFER(key);
+
+	PyObject* items = PyList_New(0);
+
+	if (items == 0)
+		return 0;
+
+	const char* p = k.data();
+	const char* end = p + k.size();
+
+	while (p < end) {
+		int tag = (unsigned char)*p++;
+		PyObject* item = 0;
+		std::string s;
+
+		if (tag == PYLEVELDB_KEY_NONE) {
+			Py_INCREF(Py_None);
+			item = Py_None;
+		} else if ((tag == PYLEVELDB_KEY_INT || tag == PYLEVELDB_KEY_FLOAT) && end - p >= 8) {
+			uint64_t v = pyleveldb_unpack_uint64(p);
+			p += 8;
+
+			if (tag == PYLEVELDB_KEY_INT) {
+				item = PyLong_FromLongLong((PY_LONG_LONG)(v ^ ((uint64_t)1 << 63)));
+			} else {
+				double d = 0;
+				v = (v & ((uint64_t)1 << 63)) ? (v & ~((uint64_t)1 << 63)) : ~v;
+				memcpy(&d, &v, sizeof(d));
+				item = PyFloat_FromDouble(d);
+			}
+		} else if ((tag == PYLEVELDB_KEY_BYTES || tag == PYLEVELDB_KEY_STR) && pyleveldb_unpack_string(&p, end, &s)) {
+			if (tag == PYLEVELDB_KEY_BYTES)
+				item = PY_LEVELDB_STRING_OR_BYTEARRAY(s.data(), s.size());
+			else
+				item = PyUnicode_DecodeUTF8(s.data(), s.size(), 0);
+		} else {
+			PyErr_SetString(PyExc_ValueError, "malformed key");
+		}
+
+		if (item == 0 || PyList_Append(items, item) != 0) {
+			Py_XDECREF(item);
+			Py_DECREF(items);
+			return 0;
+		}
+
+		Py_DECREF(item);
+	}
+
+	PyObject* ret = PyList_AsTuple(items);
+	Py_DECREF(items);
+	return ret;
+}
+
 class PythonComparatorWrapper : public leveldb::Comparator {
 
 public:
 
-	PythonComparatorWrapper(const char* name, PyObject* comparator) :
+	PythonComparatorWrapper(const char* name, PyObject* comparator, PyObject* separator, PyObject* successor, bool bytewise_shortening) :
 		name(name),
 		comparator(comparator),
+		separator(separator),
+		successor(successor),
+		bytewise_shortening(bytewise_shortening),
 		last_exception_type(0),
 		last_exception_value(0),
 		last_exception_traceback(0)
 	{
 		Py_INCREF(comparator);
+		Py_XINCREF(separator);
+		Py_XINCREF(successor);
 		#if PY_MAJOR_VERSION >= 3
 		zero = PyLong_FromLong(0);
 		#else
@@ -201,6 +478,8 @@ public:
 	~PythonComparatorWrapper()
 	{
 		Py_DECREF(comparator);
+		Py_XDECREF(separator);
+		Py_XDECREF(successor);
 		Py_XDECREF(last_exception_type);
 		Py_XDECREF(last_exception_value);
 		Py_XDECREF(last_exception_traceback);
@@ -304,13 +583,77 @@ public:
 		return name.c_str();
 	}
 
-	void FindShortestSeparator(std::string*, const leveldb::Slice&) const { }
-	void FindShortSuccessor(std::string*) const { }
+	// index blocks store a key per data block, shortened by these when the comparator tuple allows it
+	void FindShortestSeparator(std::string* start, const leveldb::Slice& limit) const
+	{
+		std::string s(*start);
+
+		if (bytewise_shortening)
+			leveldb::BytewiseComparator()->FindShortestSeparator(&s, limit);
+		else if (separator == 0 || !Shorten(separator, *start, &limit, &s))
+			return;
+
+		// a key outside of [start, limit) would misdirect lookups
+		if (s.size() < start->size() && Compare(*start, s) <= 0 && Compare(s, limit) < 0)
+			start->swap(s);
+	}
+
+	void FindShortSuccessor(std::string* key) const
+	{
+		std::string s(*key);
+
+		if (bytewise_shortening)
+			leveldb::BytewiseComparator()->FindShortSuccessor(&s);
+		else if (successor == 0 || !Shorten(successor, *key, 0, &s))
+			return;
+
+		if (s.size() < key->size() && Compare(*key, s) <= 0)
+			key->swap(s);
+	}
 
 private:
 
+	// call separator(start, limit) or successor(key), errors are reported but otherwise ignored
+	bool Shorten(PyObject* func, const std::string& key, const leveldb::Slice* limit, std::string* result) const
+	{
+		PyGILState_STATE gstate;
+		gstate = PyGILState_Ensure();
+
+		PyObject* a_ = PY_LEVELDB_STRING_OR_BYTEARRAY(key.data(), key.size());
+		PyObject* b_ = limit ? PY_LEVELDB_STRING_OR_BYTEARRAY(limit->data(), limit->size()) : 0;
+		PyObject* r = 0;
+		bool ok = false;
+
+		if (a_ && (limit == 0 || b_))
+			r = PyObject_CallFunctionObjArgs(func, a_, b_, 0);
+
+		Py_XDECREF(a_);
+		Py_XDECREF(b_);
+
+		if (r) {
+			PY_LEVELDB_DEFINE_BUFFER(s);
+
+			if (PyArg_Parse(r, (char*)PARAM_S, PARAM_V(s))) {
+				*result = PY_LEVELDB_STRING(s);
+				PY_LEVELDB_RELEASE_BUFFER(s);
+				ok = true;
+			}
+
+			Py_DECREF(r);
+		}
+
+		if (!ok)
+			PyErr_WriteUnraisable(func);
+
+		PyGILState_Release(gstate);
+		return ok;
+	}
+
 	std::string name;
 	PyObject* comparator;
+	PyObject* separator;
+	PyObject* successor;
+	bool bytewise_shortening;
 	PyObject* last_exception_type;
 	PyObject* last_exception_value;
 	PyObject* last_exception_traceback;
@@ -338,8 +681,15 @@ static PyObject* PyLevelDB_Put(PyLevelDB* self, PyObject* args, PyObject* kwds)
 	leveldb::Slice value_slice = PY_LEVELDB_SLICE_VALUE(value);
 
 	options.sync = (sync == Py_True) ? true : false;
+
+	if (self->_row_cache)
+		pyleveldb_row_cache_begin_write(self->_row_cache);
+
 	status = self->_db->Put(options, key_slice, value_slice);
 
+	if (self->_row_cache)
+		pyleveldb_row_cache_end_write(self->_row_cache, &key_slice, 1);
+
 	PY_LEVELDB_END_ALLOW_THREADS
 
 	PY_LEVELDB_RELEASE_BUFFER(key);
@@ -354,7 +704,8 @@ static PyObject* PyLevelDB_Put(PyLevelDB* self, PyObject* args, PyObject* kwds)
 	return Py_None;
 }
 
-static PyObject* PyLevelDB_Get_(PyLevelDB* self, leveldb::DB* db, const leveldb::Snapshot* snapshot, PyObject* args, PyObject* kwds)
+// row_generation is that of the snapshot, if any, see leveldb_row_cache.cc
+static PyObject* PyLevelDB_Get_(PyLevelDB* self, leveldb::DB* db, const leveldb::Snapshot* snapshot, uint64_t row_generation, PyObject* args, PyObject* kwds)
 {
 	PyObject* verify_checksums = Py_False;
 	PyObject* fill_cache = Py_True;
@@ -370,6 +721,21 @@ static PyObject* PyLevelDB_Get_(PyLevelDB* self, leveldb::DB* db, const leveldb:
 	if (!PyArg_ParseTupleAndKeywords(args, kwds, (char*)PARAM_S "|O!O!O", (char**)kwargs, PARAM_V(key), &PyBool_Type, &verify_checksums, &PyBool_Type, &fill_cache, &failobj))
 		return 0;
 
+	// hot keys are returned from the row cache, without releasing the GIL
+	PyLevelDBRowCache* row_cache = (verify_checksums == Py_False && row_generation != 0) ? self->_row_cache : 0;
+
+	if (row_cache) {
+		leveldb::Cache::Handle* handle = pyleveldb_row_cache_lookup(row_cache, PY_LEVELDB_SLICE_VALUE(key), row_generation);
+
+		if (handle) {
+			const std::string& v = pyleveldb_row_cache_value(row_cache, handle);
+			PyObject* r = PY_LEVELDB_STRING_OR_BYTEARRAY(v.c_str(), v.length());
+			pyleveldb_row_cache_release(row_cache, handle);
+			PY_LEVELDB_RELEASE_BUFFER(key);
+			return r;
+		}
+	}
+
 	PY_LEVELDB_BEGIN_ALLOW_THREADS
 
 	leveldb::Slice key_slice = PY_LEVELDB_SLICE_VALUE(key);
@@ -379,8 +745,14 @@ static PyObject* PyLevelDB_Get_(PyLevelDB* self, leveldb::DB* db, const leveldb:
 	options.fill_cache = (fill_cache == Py_True) ? true : false;
 	options.snapshot = snapshot;
 
+	// only reads of the latest state fill the row cache
+	uint64_t generation = (row_cache && snapshot == 0 && options.fill_cache) ? pyleveldb_row_cache_generation(row_cache) : 0;
+
 	status = db->Get(options, key_slice, &value);
 
+	if (generation != 0 && status.ok())
+		pyleveldb_row_cache_insert(row_cache, key_slice, value, generation);
+
 	PY_LEVELDB_END_ALLOW_THREADS
 
 	PY_LEVELDB_RELEASE_BUFFER(key);
@@ -405,12 +777,12 @@ static PyObject* PyLevelDB_Get_(PyLevelDB* self, leveldb::DB* db, const leveldb:
 
 static PyObject* PyLevelDB_Get(PyLevelDB* self, PyObject* args, PyObject* kwds)
 {
-	return PyLevelDB_Get_(self, self->_db, 0, args, kwds);
+	return PyLevelDB_Get_(self, self->_db, 0, (uint64_t)-1, args, kwds);
 }
 
 static PyObject* PyLevelDBSnaphot_Get(PyLevelDBSnapshot* self, PyObject* args, PyObject* kwds)
 {
-	return PyLevelDB_Get_(self->db, self->db->_db, self->snapshot, args, kwds);
+	return PyLevelDB_Get_(self->db, self->db->_db, self->snapshot, self->row_generation, args, kwds);
 }
 
 static PyObject* PyLevelDB_Delete(PyLevelDB* self, PyObject* args, PyObject* kwds)
@@ -432,8 +804,14 @@ static PyObject* PyLevelDB_Delete(PyLevelDB* self, PyObject* args, PyObject* kwd
 	leveldb::WriteOptions options;
 	options.sync = (sync == Py_True) ? true : false;
 
+	if (self->_row_cache)
+		pyleveldb_row_cache_begin_write(self->_row_cache);
+
 	status = self->_db->Delete(options, key_slice);
 
+	if (self->_row_cache)
+		pyleveldb_row_cache_end_write(self->_row_cache, &key_slice, 1);
+
 	PY_LEVELDB_END_ALLOW_THREADS
 
 	PY_LEVELDB_RELEASE_BUFFER(key);
@@ -513,6 +891,7 @@ static PyObject* PyLevelDB_Write(PyLevelDB* self, PyObject* args, PyObject* kwds
 	options.sync = (sync == Py_True) ? true : false;
 	leveldb::WriteBatch batch;
 	leveldb::Status status;
+	std::vector<leveldb::Slice> keys;
 
 	for (size_t i = 0; i < write_batch->ops->size(); i++) {
 		PyWriteBatchEntry& op = (*write_batch->ops)[i];
@@ -524,10 +903,21 @@ static PyObject* PyLevelDB_Write(PyLevelDB* self, PyObject* args, PyObject* kwds
 		} else {
 			batch.Delete(key);
 		}
+
+		if (self->_row_cache)
+			keys.push_back(key);
 	}
 
 	Py_BEGIN_ALLOW_THREADS
+
+	if (self->_row_cache)
+		pyleveldb_row_cache_begin_write(self->_row_cache);
+
 	status = self->_db->Write(options, &batch);
+
+	if (self->_row_cache)
+		pyleveldb_row_cache_end_write(self->_row_cache, keys.empty() ? 0 : &keys[0], keys.size());
+
 	Py_END_ALLOW_THREADS
 
 	if (!status.ok()) {
@@ -539,7 +929,162 @@ static PyObject* PyLevelDB_Write(PyLevelDB* self, PyObject* args, PyObject* kwds
 	return Py_None;
 }
 
-static PyObject* PyLevelDB_RangeIter_(PyLevelDB* self, const leveldb::Snapshot* snapshot, PyObject* args, PyObject* kwds)
+// parse a (start, end) 2-tuple of byte strings, copying both keys
+static int pyleveldb_parse_range(PyObject* range, std::string* start, std::string* end)
+{
+	PY_LEVELDB_DEFINE_BUFFER(a);
+	PY_LEVELDB_DEFINE_BUFFER(b);
+
+	if (!PyTuple_Check(range) || PyTuple_GET_SIZE(range) != 2) {
+		PyErr_SetString(PyExc_TypeError, "ranges must be 2-tuples of (start, end) byte strings");
+		return 0;
+	}
+
+	// parse the keys one at a time, so a bad end key releases the start key, and its error is kept
+	if (!PyArg_Parse(PyTuple_GET_ITEM(range, 0), (char*)PARAM_S, PARAM_V(a)))
+		return 0;
+
+	if (!PyArg_Parse(PyTuple_GET_ITEM(range, 1), (char*)PARAM_S, PARAM_V(b))) {
+		PY_LEVELDB_RELEASE_BUFFER(a);
+		return 0;
+	}
+
+	*start = PY_LEVELDB_STRING(a);
+	*end = PY_LEVELDB_STRING(b);
+
+	PY_LEVELDB_RELEASE_BUFFER(a);
+	PY_LEVELDB_RELEASE_BUFFER(b);
+	return 1;
+}
+
+static void pyleveldb_filter_delete(PyLevelDBIterFilter* filter)
+{
+	if (filter == 0)
+		return;
+
+	if (filter->has_key_regex)
+		regfree(&filter->key_regex);
+
+	delete filter;
+}
+
+static int pyleveldb_filter_string(PyObject* o, bool* has, std::string* s)
+{
+	PY_LEVELDB_DEFINE_BUFFER(v);
+
+	if (o == Py_None)
+		return 1;
+
+	if (!PyArg_Parse(o, (char*)PARAM_S, PARAM_V(v)))
+		return 0;
+
+	*has = true;
+	*s = PY_LEVELDB_STRING(v);
+	PY_LEVELDB_RELEASE_BUFFER(v);
+	return 1;
+}
+
+static PyLevelDBIterFilter* pyleveldb_filter_new(PyObject* key_regex, PyObject* value_prefix, PyObject* value_contains, Py_ssize_t min_value_size, Py_ssize_t max_value_size, PyObject* value_field)
+{
+	PyLevelDBIterFilter* filter = new PyLevelDBIterFilter;
+
+	filter->has_key_regex = false;
+	filter->has_value_prefix = false;
+	filter->has_value_contains = false;
+	filter->min_value_size = (min_value_size >= 0) ? (size_t)min_value_size : 0;
+	filter->max_value_size = (max_value_size >= 0) ? (size_t)max_value_size : (size_t)-1;
+	filter->has_value_field = false;
+	filter->value_field_offset = 0;
+
+	if (!pyleveldb_filter_string(value_prefix, &filter->has_value_prefix, &filter->value_prefix) ||
+		!pyleveldb_filter_string(value_contains, &filter->has_value_contains, &filter->value_contains)) {
+		pyleveldb_filter_delete(filter);
+		return 0;
+	}
+
+	if (value_field != Py_None) {
+		Py_ssize_t offset = 0;
+		PyObject* field = 0;
+
+		if (!PyArg_Parse(value_field, (char*)"(nO)", &offset, &field) || offset < 0) {
+			PyErr_SetString(PyExc_TypeError, "value_field must be a 2-tuple (offset, bytes), with a non-negative offset");
+			pyleveldb_filter_delete(filter);
+			return 0;
+		}
+
+		if (!pyleveldb_filter_string(field, &filter->has_value_field, &filter->value_field)) {
+			pyleveldb_filter_delete(filter);
+			return 0;
+		}
+
+		filter->value_field_offset = (size_t)offset;
+	}
+
+	if (key_regex != Py_None) {
+		const char* pattern = 0;
+
+		if (!PyArg_Parse(key_regex, (char*)"s", &pattern)) {
+			pyleveldb_filter_delete(filter);
+			return 0;
+		}
+
+		int r = regcomp(&filter->key_regex, pattern, REG_EXTENDED | REG_NOSUB);
+
+		if (r != 0) {
+			char error[256];
+			regerror(r, &filter->key_regex, error, sizeof(error));
+			PyErr_Format(PyExc_ValueError, "invalid key_regex: %s", error);
+			pyleveldb_filter_delete(filter);
+			return 0;
+		}
+
+		filter->has_key_regex = true;
+	}
+
+	return filter;
+}
+
+// does not need the GIL
+static bool pyleveldb_filter_match(const PyLevelDBIterFilter* filter, const leveldb::Slice& key, const leveldb::Slice& value)
+{
+	if (value.size() < filter->min_value_size || value.size() > filter->max_value_size)
+		return false;
+
+	if (filter->has_value_prefix && !value.starts_with(filter->value_prefix))
+		return false;
+
+	if (filter->has_value_field) {
+		const std::string& field = filter->value_field;
+
+		if (value.size() < filter->value_field_offset + field.size() || memcmp(value.data() + filter->value_field_offset, field.data(), field.size()) != 0)
+			return false;
+	}
+
+	if (filter->has_value_contains) {
+		const std::string& needle = filter->value_contains;
+
+		if (std::search(value.data(), value.data() + value.size(), needle.begin(), needle.end()) == value.data() + value.size() && !needle.empty())
+			return false;
+	}
+
+	if (filter->has_key_regex) {
+		#ifdef REG_STARTEND
+		regmatch_t m;
+		m.rm_so = 0;
+		m.rm_eo = (regoff_t)key.size();
+
+		if (regexec(&filter->key_regex, key.data(), 1, &m, REG_STARTEND) != 0)
+			return false;
+		#else
+		if (regexec(&filter->key_regex, key.ToString().c_str(), 0, 0, 0) != 0)
+			return false;
+		#endif
+	}
+
+	return true;
+}
+
+static PyObject* PyLevelDB_RangeIter_(PyLevelDB* self, PyObject* ref, const leveldb::Snapshot* snapshot, PyObject* args, PyObject* kwds)
 {
 	int is_from = 0;
 	int is_to = 0;
@@ -551,10 +1096,41 @@ static PyObject* PyLevelDB_RangeIter_(PyLevelDB* self, const leveldb::Snapshot*
 	PyObject* fill_cache = Py_True;
 	PyObject* include_value = Py_True;
 	PyObject* is_reverse = Py_False;
-	const char* kwargs[] = {"key_from", "key_to", "verify_checksums", "fill_cache", "include_value", "reverse", 0};
+	PyObject* key_regex = Py_None;
+	PyObject* value_prefix = Py_None;
+	PyObject* value_contains = Py_None;
+	PyObject* value_field = Py_None;
+	Py_ssize_t min_value_size = -1;
+	Py_ssize_t max_value_size = -1;
+	PyObject* value_view = Py_False;
+	Py_ssize_t readahead_size = 0;
+	const char* kwargs[] = {"key_from", "key_to", "verify_checksums", "fill_cache", "include_value", "reverse",
+		"key_regex", "value_prefix", "value_contains", "min_value_size", "max_value_size", "value_field", "value_view", "readahead_size", 0};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, (char*)"|OOO!O!O!O!OOOnnOO!n", (char**)kwargs, &_a, &_b, &PyBool_Type, &verify_checksums, &PyBool_Type, &fill_cache, &PyBool_Type, &include_value, &PyBool_Type, &is_reverse,
+		&key_regex, &value_prefix, &value_contains, &min_value_size, &max_value_size, &value_field, &PyBool_Type, &value_view, &readahead_size))
+		return 0;
+
+	if (readahead_size < 0) {
+		PyErr_SetString(PyExc_ValueError, "readahead_size must be non-negative");
+		return 0;
+	}
 
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, (char*)"|OOO!O!O!O!", (char**)kwargs, &_a, &_b, &PyBool_Type, &verify_checksums, &PyBool_Type, &fill_cache, &PyBool_Type, &include_value, &PyBool_Type, &is_reverse))
+	#if PY_MAJOR_VERSION < 3
+	if (value_view == Py_True) {
+		PyErr_SetString(PyExc_NotImplementedError, "value_view requires Python 3");
 		return 0;
+	}
+	#endif
+
+	PyLevelDBIterFilter* filter = 0;
+
+	if (key_regex != Py_None || value_prefix != Py_None || value_contains != Py_None || value_field != Py_None || min_value_size >= 0 || max_value_size >= 0) {
+		filter = pyleveldb_filter_new(key_regex, value_prefix, value_contains, min_value_size, max_value_size, value_field);
+
+		if (filter == 0)
+			return 0;
+	}
 
 	std::string from;
 	std::string to;
@@ -567,15 +1143,22 @@ static PyObject* PyLevelDB_RangeIter_(PyLevelDB* self, const leveldb::Snapshot*
 	if (_a != Py_None) {
 		is_from = 1;
 
-		if (!PyArg_Parse(_a, (char*)PARAM_S, PARAM_V(a)))
+		if (!PyArg_Parse(_a, (char*)PARAM_S, PARAM_V(a))) {
+			pyleveldb_filter_delete(filter);
 			return 0;
+		}
 	}
 
 	if (_b != Py_None) {
 		is_to = 1;
 
-		if (!PyArg_Parse(_b, (char*)PARAM_S, PARAM_V(b)))
+		if (!PyArg_Parse(_b, (char*)PARAM_S, PARAM_V(b))) {
+			if (is_from)
+				PY_LEVELDB_RELEASE_BUFFER(a);
+
+			pyleveldb_filter_delete(filter);
 			return 0;
+		}
 	}
 
 	if (is_from)
@@ -597,6 +1180,7 @@ static PyObject* PyLevelDB_RangeIter_(PyLevelDB* self, const leveldb::Snapshot*
 
 	Py_BEGIN_ALLOW_THREADS
 
+	PyLevelDBReadahead readahead((size_t)readahead_size);
 	iter = self->_db->NewIterator(read_options);
 
 	// if we have an iterator
@@ -620,7 +1204,7 @@ static PyObject* PyLevelDB_RangeIter_(PyLevelDB* self, const leveldb::Snapshot*
 				} else {
 					leveldb::Slice a = key;
 					leveldb::Slice b = iter->key();
-					int c = self->_options->comparator->Compare(a, b);
+					int c = pyleveldb_compare(self->_options->comparator, a, b);
 
 					if (c) {
 						iter->Prev();
@@ -632,15 +1216,18 @@ static PyObject* PyLevelDB_RangeIter_(PyLevelDB* self, const leveldb::Snapshot*
 
 	Py_END_ALLOW_THREADS
 
-	if (iter == 0)
+	if (iter == 0) {
+		pyleveldb_filter_delete(filter);
 		return PyErr_NoMemory();
+	}
 
 	// if iterator is empty, return an empty iterator object
 	if (!iter->Valid()) {
 		Py_BEGIN_ALLOW_THREADS
 		delete iter;
 		Py_END_ALLOW_THREADS
-		return PyLevelDBIter_New(0, 0, 0, 0, 0, 0);
+		pyleveldb_filter_delete(filter);
+		return PyLevelDBIter_New(0, 0, 0, read_options, 0, 0, 0, 0, 0, 0);
 	}
 
 	// otherwise, we're good
@@ -653,6 +1240,7 @@ static PyObject* PyLevelDB_RangeIter_(PyLevelDB* self, const leveldb::Snapshot*
 			Py_BEGIN_ALLOW_THREADS
 			delete iter;
 			Py_END_ALLOW_THREADS
+			pyleveldb_filter_delete(filter);
 			return PyErr_NoMemory();
 		}
 	} else if (is_reverse == Py_True && is_from) {
@@ -662,25 +1250,450 @@ static PyObject* PyLevelDB_RangeIter_(PyLevelDB* self, const leveldb::Snapshot*
 			Py_BEGIN_ALLOW_THREADS
 			delete iter;
 			Py_END_ALLOW_THREADS
+			pyleveldb_filter_delete(filter);
 			return PyErr_NoMemory();
 		}
 	}
 
-	return PyLevelDBIter_New((PyObject*)self, self, iter, s, (include_value == Py_True) ? 1 : 0, (is_reverse == Py_True) ? 1 : 0);
+	return PyLevelDBIter_New(ref, self, iter, read_options, s, (include_value == Py_True) ? 1 : 0, (is_reverse == Py_True) ? 1 : 0, filter, (include_value == Py_True && value_view == Py_True) ? 1 : 0, (size_t)readahead_size);
 }
 
 static PyObject* PyLevelDB_RangeIter(PyLevelDB* self, PyObject* args, PyObject* kwds)
 {
-	return PyLevelDB_RangeIter_(self, 0, args, kwds);
+	return PyLevelDB_RangeIter_(self, (PyObject*)self, 0, args, kwds);
 }
 
 static PyObject* PyLevelDBSnapshot_RangeIter(PyLevelDBSnapshot* self, PyObject* args, PyObject* kwds)
 {
-	return PyLevelDB_RangeIter_(self->db, self->snapshot, args, kwds);
+	// the iterator keeps the snapshot alive, for refresh()
+	return PyLevelDB_RangeIter_(self->db, (PyObject*)self, self->snapshot, args, kwds);
 }
 
-static PyObject* PyLevelDB_GetStatus(PyLevelDB* self)
-{
+class PyLevelDBRangeLess {
+
+public:
+
+	PyLevelDBRangeLess(const leveldb::Comparator* comparator) : comparator(comparator) { }
+
+	bool operator()(const PyLevelDBRange& a, const PyLevelDBRange& b) const
+	{
+		return pyleveldb_compare(comparator, a.start, b.start) < 0;
+	}
+
+private:
+
+	const leveldb::Comparator* comparator;
+};
+
+static PyObject* PyLevelDB_MultiRangeIter_(PyLevelDB* self, const leveldb::Snapshot* snapshot, PyObject* args, PyObject* kwds)
+{
+	PyObject* ranges = 0;
+	PyObject* verify_checksums = Py_False;
+	PyObject* fill_cache = Py_True;
+	PyObject* include_value = Py_True;
+	const char* kwargs[] = {"ranges", "verify_checksums", "fill_cache", "include_value", 0};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, (char*)"O|O!O!O!", (char**)kwargs, &ranges, &PyBool_Type, &verify_checksums, &PyBool_Type, &fill_cache, &PyBool_Type, &include_value))
+		return 0;
+
+	PyObject* seq = PySequence_Fast(ranges, "ranges must be a sequence of (start, end) 2-tuples");
+
+	if (seq == 0)
+		return 0;
+
+	std::vector<PyLevelDBRange>* r = new std::vector<PyLevelDBRange>(PySequence_Fast_GET_SIZE(seq));
+
+	for (size_t i = 0; i < r->size(); i++) {
+		(*r)[i].index = (Py_ssize_t)i;
+
+		if (!pyleveldb_parse_range(PySequence_Fast_GET_ITEM(seq, i), &(*r)[i].start, &(*r)[i].end)) {
+			Py_DECREF(seq);
+			delete r;
+			return 0;
+		}
+	}
+
+	Py_DECREF(seq);
+
+	// the comparator may call back into Python, so compare and sort with the GIL held
+	for (size_t i = 0; i < r->size(); i++) {
+		if (pyleveldb_compare(self->_options->comparator, (*r)[i].start, (*r)[i].end) > 0) {
+			PyErr_Format(PyExc_ValueError, "range %d has a start key after its end key", (int)i);
+			delete r;
+			return 0;
+		}
+	}
+
+	std::stable_sort(r->begin(), r->end(), PyLevelDBRangeLess(self->_options->comparator));
+
+	leveldb::ReadOptions read_options;
+	read_options.verify_checksums = (verify_checksums == Py_True) ? true : false;
+	read_options.fill_cache = (fill_cache == Py_True) ? true : false;
+	read_options.snapshot = snapshot;
+
+	leveldb::Iterator* iter = 0;
+
+	Py_BEGIN_ALLOW_THREADS
+	iter = self->_db->NewIterator(read_options);
+	Py_END_ALLOW_THREADS
+
+	if (iter == 0) {
+		delete r;
+		return PyErr_NoMemory();
+	}
+
+	return PyLevelDBMultiIter_New((PyObject*)self, self, iter, r, (include_value == Py_True) ? 1 : 0);
+}
+
+static PyObject* PyLevelDB_MultiRangeIter(PyLevelDB* self, PyObject* args, PyObject* kwds)
+{
+	return PyLevelDB_MultiRangeIter_(self, 0, args, kwds);
+}
+
+static PyObject* PyLevelDBSnapshot_MultiRangeIter(PyLevelDBSnapshot* self, PyObject* args, PyObject* kwds)
+{
+	return PyLevelDB_MultiRangeIter_(self->db, self->snapshot, args, kwds);
+}
+
+typedef struct {
+	uint64_t count;
+	uint64_t key_bytes;
+	uint64_t value_bytes;
+	uint64_t min_value_size;
+	uint64_t max_value_size;
+	bool approximate;
+} PyLevelDBRangeStats;
+
+// number of entries scanned, before an approximate count is extrapolated from on-disk sizes, doubled
+// for as long as the sample has no on-disk size, i.e. is only in the memtable
+static const uint64_t pyleveldb_range_stats_sample = 1024;
+
+// aggregate over [start, end), where a null start/end means unbounded, must be called without the GIL
+static leveldb::Status pyleveldb_range_stats(PyLevelDB* self, const leveldb::Snapshot* snapshot, const std::string* start, const std::string* end, bool approximate, PyLevelDBRangeStats* stats)
+{
+	leveldb::ReadOptions read_options;
+	read_options.fill_cache = false;
+	read_options.snapshot = snapshot;
+
+	const leveldb::Comparator* comparator = self->_options->comparator;
+	leveldb::Iterator* iter = self->_db->NewIterator(read_options);
+
+	stats->count = 0;
+	stats->key_bytes = 0;
+	stats->value_bytes = 0;
+	stats->min_value_size = 0;
+	stats->max_value_size = 0;
+	stats->approximate = false;
+
+	if (start)
+		iter->Seek(*start);
+	else
+		iter->SeekToFirst();
+
+	std::string first = iter->Valid() ? iter->key().ToString() : std::string();
+	std::string limit;
+	uint64_t sample = pyleveldb_range_stats_sample;
+
+	for (; iter->Valid(); iter->Next()) {
+		leveldb::Slice key = iter->key();
+
+		if (end && pyleveldb_compare(comparator, key, *end) >= 0)
+			break;
+
+		// extrapolate from the sample, once it is known to cover some table data
+		if (approximate && stats->count == sample) {
+			if (end) {
+				limit = *end;
+			} else if (limit.empty()) {
+				leveldb::Iterator* last = self->_db->NewIterator(read_options);
+				last->SeekToLast();
+				limit = last->Valid() ? last->key().ToString() : key.ToString();
+				delete last;
+			}
+
+			leveldb::Range r[2] = {leveldb::Range(first, key), leveldb::Range(first, limit)};
+			uint64_t sizes[2] = {0, 0};
+			self->_db->GetApproximateSizes(r, 2, sizes);
+
+			if (sizes[0] > 0) {
+				double scale = (double)(sizes[1] > sizes[0] ? sizes[1] : sizes[0]) / (double)sizes[0];
+				stats->count = (uint64_t)(stats->count * scale);
+				stats->key_bytes = (uint64_t)(stats->key_bytes * scale);
+				stats->value_bytes = (uint64_t)(stats->value_bytes * scale);
+				stats->approximate = true;
+				break;
+			}
+
+			// sample is still in the memtable, or in a single block, try again with a larger one, so
+			// at worst the part of the range in the memtable is scanned
+			sample *= 2;
+		}
+
+		uint64_t value_size = iter->value().size();
+
+		if (stats->count == 0 || value_size < stats->min_value_size)
+			stats->min_value_size = value_size;
+
+		if (value_size > stats->max_value_size)
+			stats->max_value_size = value_size;
+
+		stats->count += 1;
+		stats->key_bytes += key.size();
+		stats->value_bytes += value_size;
+	}
+
+	leveldb::Status status = iter->status();
+	delete iter;
+	return status;
+}
+
+static int pyleveldb_range_stats_args(PyLevelDB* self, const leveldb::Snapshot* snapshot, PyObject* args, PyObject* kwds, PyLevelDBRangeStats* stats)
+{
+	PyObject* _start = Py_None;
+	PyObject* _end = Py_None;
+	PyObject* approximate = Py_False;
+
+	PY_LEVELDB_DEFINE_BUFFER(a);
+	PY_LEVELDB_DEFINE_BUFFER(b);
+
+	const char* kwargs[] = {"start", "end", "approximate", 0};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, (char*)"|OOO!", (char**)kwargs, &_start, &_end, &PyBool_Type, &approximate))
+		return 0;
+
+	std::string start;
+	std::string end;
+
+	if (_start != Py_None) {
+		if (!PyArg_Parse(_start, (char*)PARAM_S, PARAM_V(a)))
+			return 0;
+
+		start = PY_LEVELDB_STRING(a);
+		PY_LEVELDB_RELEASE_BUFFER(a);
+	}
+
+	if (_end != Py_None) {
+		if (!PyArg_Parse(_end, (char*)PARAM_S, PARAM_V(b)))
+			return 0;
+
+		end = PY_LEVELDB_STRING(b);
+		PY_LEVELDB_RELEASE_BUFFER(b);
+	}
+
+	leveldb::Status status;
+
+	Py_BEGIN_ALLOW_THREADS
+	status = pyleveldb_range_stats(self, snapshot, _start != Py_None ? &start : 0, _end != Py_None ? &end : 0, approximate == Py_True, stats);
+	Py_END_ALLOW_THREADS
+
+	if (!status.ok()) {
+		PyLevelDB_set_error(status);
+		return 0;
+	}
+
+	return 1;
+}
+
+static PyObject* PyLevelDB_CountRange_(PyLevelDB* self, const leveldb::Snapshot* snapshot, PyObject* args, PyObject* kwds)
+{
+	PyLevelDBRangeStats stats;
+
+	if (!pyleveldb_range_stats_args(self, snapshot, args, kwds, &stats))
+		return 0;
+
+	return PyLong_FromUnsignedLongLong(stats.count);
+}
+
+static PyObject* PyLevelDB_RangeStats_(PyLevelDB* self, const leveldb::Snapshot* snapshot, PyObject* args, PyObject* kwds)
+{
+	PyLevelDBRangeStats stats;
+
+	if (!pyleveldb_range_stats_args(self, snapshot, args, kwds, &stats))
+		return 0;
+
+	if (stats.count == 0)
+		return Py_BuildValue("{s:K,s:K,s:K,s:O,s:O,s:O}",
+			"count", stats.count,
+			"key_bytes", stats.key_bytes,
+			"value_bytes", stats.value_bytes,
+			"min_value_size", Py_None,
+			"max_value_size", Py_None,
+			"approximate", stats.approximate ? Py_True : Py_False);
+
+	return Py_BuildValue("{s:K,s:K,s:K,s:K,s:K,s:O}",
+		"count", stats.count,
+		"key_bytes", stats.key_bytes,
+		"value_bytes", stats.value_bytes,
+		"min_value_size", stats.min_value_size,
+		"max_value_size", stats.max_value_size,
+		"approximate", stats.approximate ? Py_True : Py_False);
+}
+
+static PyObject* PyLevelDB_CountRange(PyLevelDB* self, PyObject* args, PyObject* kwds)
+{
+	return PyLevelDB_CountRange_(self, 0, args, kwds);
+}
+
+static PyObject* PyLevelDBSnapshot_CountRange(PyLevelDBSnapshot* self, PyObject* args, PyObject* kwds)
+{
+	return PyLevelDB_CountRange_(self->db, self->snapshot, args, kwds);
+}
+
+static PyObject* PyLevelDB_RangeStats(PyLevelDB* self, PyObject* args, PyObject* kwds)
+{
+	return PyLevelDB_RangeStats_(self, 0, args, kwds);
+}
+
+static PyObject* PyLevelDBSnapshot_RangeStats(PyLevelDBSnapshot* self, PyObject* args, PyObject* kwds)
+{
+	return PyLevelDB_RangeStats_(self->db, self->snapshot, args, kwds);
+}
+
+static PyObject* PyLevelDB_ScanColumnar_(PyLevelDB* self, const leveldb::Snapshot* snapshot, PyObject* args, PyObject* kwds)
+{
+	PyObject* _start = Py_None;
+	PyObject* _end = Py_None;
+	PyObject* _limit = Py_None;
+	PyObject* verify_checksums = Py_False;
+	PyObject* fill_cache = Py_True;
+
+	PY_LEVELDB_DEFINE_BUFFER(a);
+	PY_LEVELDB_DEFINE_BUFFER(b);
+
+	const char* kwargs[] = {"start", "end", "limit", "verify_checksums", "fill_cache", 0};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, (char*)"|OOOO!O!", (char**)kwargs, &_start, &_end, &_limit, &PyBool_Type, &verify_checksums, &PyBool_Type, &fill_cache))
+		return 0;
+
+	std::string start;
+	std::string end;
+	Py_ssize_t limit = -1;
+
+	if (_limit != Py_None) {
+		limit = PyNumber_AsSsize_t(_limit, PyExc_OverflowError);
+
+		if (limit == -1 && PyErr_Occurred())
+			return 0;
+
+		if (limit < 0) {
+			PyErr_SetString(PyExc_ValueError, "negative limit");
+			return 0;
+		}
+	}
+
+	if (_start != Py_None) {
+		if (!PyArg_Parse(_start, (char*)PARAM_S, PARAM_V(a)))
+			return 0;
+
+		start = PY_LEVELDB_STRING(a);
+		PY_LEVELDB_RELEASE_BUFFER(a);
+	}
+
+	if (_end != Py_None) {
+		if (!PyArg_Parse(_end, (char*)PARAM_S, PARAM_V(b)))
+			return 0;
+
+		end = PY_LEVELDB_STRING(b);
+		PY_LEVELDB_RELEASE_BUFFER(b);
+	}
+
+	leveldb::ReadOptions read_options;
+	read_options.verify_checksums = (verify_checksums == Py_True) ? true : false;
+	read_options.fill_cache = (fill_cache == Py_True) ? true : false;
+	read_options.snapshot = snapshot;
+
+	// arrow binary layout: n + 1 int32 offsets into one contiguous data buffer
+	std::string* key_offsets = new std::string;
+	std::string* key_data = new std::string;
+	std::string* value_offsets = new std::string;
+	std::string* value_data = new std::string;
+
+	leveldb::Status status;
+	bool overflow = false;
+
+	Py_BEGIN_ALLOW_THREADS
+
+	const leveldb::Comparator* comparator = self->_options->comparator;
+	leveldb::Iterator* iter = self->_db->NewIterator(read_options);
+	int32_t offset = 0;
+
+	key_offsets->append((const char*)&offset, sizeof(offset));
+	value_offsets->append((const char*)&offset, sizeof(offset));
+
+	if (_start != Py_None)
+		iter->Seek(start);
+	else
+		iter->SeekToFirst();
+
+	for (Py_ssize_t n = 0; iter->Valid() && n != limit; iter->Next(), n++) {
+		leveldb::Slice key = iter->key();
+		leveldb::Slice value = iter->value();
+
+		if (_end != Py_None && pyleveldb_compare(comparator, key, end) >= 0)
+			break;
+
+		if (key_data->size() + key.size() > INT32_MAX || value_data->size() + value.size() > INT32_MAX) {
+			overflow = true;
+			break;
+		}
+
+		key_data->append(key.data(), key.size());
+		value_data->append(value.data(), value.size());
+
+		offset = (int32_t)key_data->size();
+		key_offsets->append((const char*)&offset, sizeof(offset));
+		offset = (int32_t)value_data->size();
+		value_offsets->append((const char*)&offset, sizeof(offset));
+	}
+
+	status = iter->status();
+	delete iter;
+
+	Py_END_ALLOW_THREADS
+
+	if (!status.ok() || overflow) {
+		delete key_offsets;
+		delete key_data;
+		delete value_offsets;
+		delete value_data;
+
+		if (overflow)
+			PyErr_SetString(PyExc_OverflowError, "scan exceeds 2GB of key or value data, use a smaller limit");
+		else
+			PyLevelDB_set_error(status);
+
+		return 0;
+	}
+
+	// the buffers take ownership of the strings
+	PyObject* ko = PyLevelDBBuffer_New(key_offsets, "i", sizeof(int32_t));
+	PyObject* kd = PyLevelDBBuffer_New(key_data, "B", 1);
+	PyObject* vo = PyLevelDBBuffer_New(value_offsets, "i", sizeof(int32_t));
+	PyObject* vd = PyLevelDBBuffer_New(value_data, "B", 1);
+
+	if (ko == 0 || kd == 0 || vo == 0 || vd == 0) {
+		Py_XDECREF(ko);
+		Py_XDECREF(kd);
+		Py_XDECREF(vo);
+		Py_XDECREF(vd);
+		return 0;
+	}
+
+	return Py_BuildValue("((NN)(NN))", ko, kd, vo, vd);
+}
+
+static PyObject* PyLevelDB_ScanColumnar(PyLevelDB* self, PyObject* args, PyObject* kwds)
+{
+	return PyLevelDB_ScanColumnar_(self, 0, args, kwds);
+}
+
+static PyObject* PyLevelDBSnapshot_ScanColumnar(PyLevelDBSnapshot* self, PyObject* args, PyObject* kwds)
+{
+	return PyLevelDB_ScanColumnar_(self->db, self->snapshot, args, kwds);
+}
+
+static PyObject* PyLevelDB_GetStatus(PyLevelDB* self)
+{
 	std::string value;
 
 	if (!self->_db->GetProperty(leveldb::Slice("leveldb.stats"), &value)) {
@@ -695,11 +1708,23 @@ static PyObject* PyLevelDB_GetStatus(PyLevelDB* self)
 	#endif
 }
 
+// the row cache serves a snapshot if no write was in flight while it was taken
+static const leveldb::Snapshot* pyleveldb_get_snapshot(PyLevelDB* db, uint64_t* row_generation)
+{
+	uint64_t before = db->_row_cache ? pyleveldb_row_cache_generation(db->_row_cache) : 0;
+	const leveldb::Snapshot* snapshot = db->_db->GetSnapshot();
+	uint64_t after = db->_row_cache ? pyleveldb_row_cache_generation(db->_row_cache) : 0;
+
+	*row_generation = (before == after) ? before : 0;
+	return snapshot;
+}
+
 static PyObject* PyLevelDB_CreateSnapshot(PyLevelDB* self)
 {
-	const leveldb::Snapshot* snapshot = self->_db->GetSnapshot();
+	uint64_t row_generation = 0;
+	const leveldb::Snapshot* snapshot = pyleveldb_get_snapshot(self, &row_generation);
 	//! TBD: check for GetSnapshot() failures
-	return PyLevelDBSnapshot_New(self, snapshot);
+	return PyLevelDBSnapshot_New(self, snapshot, row_generation);
 }
 
 static PyObject* PyLevelDB_CompactRange(PyLevelDB* self, PyObject* args, PyObject* kwds)
@@ -757,681 +1782,2611 @@ static PyObject* PyLevelDB_CompactRange(PyLevelDB* self, PyObject* args, PyObjec
 	return Py_None;
 }
 
-static PyMethodDef PyLevelDB_methods[] = {
-	{(char*)"Put",            (PyCFunction)PyLevelDB_Put,       METH_VARARGS | METH_KEYWORDS, (char*)"add a key/value pair to database, with an optional synchronous disk write" },
-	{(char*)"Get",            (PyCFunction)PyLevelDB_Get,       METH_VARARGS | METH_KEYWORDS, (char*)"get a value from the database" },
-	{(char*)"Delete",         (PyCFunction)PyLevelDB_Delete,    METH_VARARGS | METH_KEYWORDS, (char*)"delete a value in the database" },
-	{(char*)"Write",          (PyCFunction)PyLevelDB_Write,     METH_VARARGS | METH_KEYWORDS, (char*)"apply a write-batch"},
-	{(char*)"RangeIter",      (PyCFunction)PyLevelDB_RangeIter, METH_VARARGS | METH_KEYWORDS, (char*)"key/value range scan"},
-	{(char*)"GetStats",       (PyCFunction)PyLevelDB_GetStatus, METH_NOARGS,   (char*)"get a mapping of all DB statistics"},
-	{(char*)"CreateSnapshot", (PyCFunction)PyLevelDB_CreateSnapshot, METH_NOARGS, (char*)"create a new snapshot from current DB state"},
-	{(char*)"CompactRange", (PyCFunction)PyLevelDB_CompactRange, METH_VARARGS | METH_KEYWORDS, (char*)"Compact keys in the range"},
-	{NULL}
-};
-
-static PyMethodDef PyWriteBatch_methods[] = {
-	{(char*)"Put",    (PyCFunction)PyWriteBatch_Put,    METH_VARARGS, (char*)"add a put op to batch" },
-	{(char*)"Delete", (PyCFunction)PyWriteBatch_Delete, METH_VARARGS, (char*)"add a delete op to batch" },
-	{NULL}
-};
+static PyObject* PyLevelDB_ApproximateSizes(PyLevelDB* self, PyObject* args, PyObject* kwds)
+{
+	PyObject* ranges = 0;
+	const char* kwargs[] = {"ranges", 0};
 
-static PyMethodDef PyLevelDBSnapshot_methods[] = {
-	{(char*)"Get",       (PyCFunction)PyLevelDBSnaphot_Get,        METH_VARARGS | METH_KEYWORDS, (char*)"get a value from the snapshot" },
-	{(char*)"RangeIter", (PyCFunction)PyLevelDBSnapshot_RangeIter, METH_VARARGS | METH_KEYWORDS, (char*)"key/value range scan"},
-	{NULL}
-};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, (char*)"O", (char**)kwargs, &ranges))
+		return 0;
 
-static int pyleveldb_str_eq(PyObject* p, const char* s)
-{
-	// 8-bit string
-	#if PY_MAJOR_VERSION < 3
-	if (PyString_Check(p) && strcmp(PyString_AS_STRING(p), "bytewise") == 0)
-		return 1;
-	#endif
+	PyObject* seq = PySequence_Fast(ranges, "ranges must be a sequence of (start, end) 2-tuples");
 
-	// unicode string
-	if (PyUnicode_Check(p)) {
-		size_t i = 0;
-		Py_UNICODE* c = PyUnicode_AS_UNICODE(p);
+	if (seq == 0)
+		return 0;
 
-		while (s[i] && c[i] && (int)s[i] == (int)c[i])
-			i++;
+	Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+	std::vector<std::string> keys(2 * n);
 
-		return ((int)s[i] == (int)c[i]);
+	for (Py_ssize_t i = 0; i < n; i++) {
+		if (!pyleveldb_parse_range(PySequence_Fast_GET_ITEM(seq, i), &keys[2 * i], &keys[2 * i + 1])) {
+			Py_DECREF(seq);
+			return 0;
+		}
 	}
 
-	return 0;
-}
+	Py_DECREF(seq);
 
-static const leveldb::Comparator* pyleveldb_get_comparator(PyObject* comparator)
-{
-	// default comparator
-	if (comparator == 0 || pyleveldb_str_eq(comparator, "bytewise"))
-		return leveldb::BytewiseComparator();
+	std::vector<leveldb::Range> r(n);
+	std::vector<uint64_t> sizes(n);
 
-	// (name-ascii, python-callable)
-	const char* cmp_name = 0;
-	PyObject* cmp = 0;
+	for (Py_ssize_t i = 0; i < n; i++)
+		r[i] = leveldb::Range(keys[2 * i], keys[2 * i + 1]);
 
-	if (!PyArg_Parse(comparator, (char*)"(sO)", &cmp_name, &cmp) || !PyCallable_Check(cmp)) {
-		PyErr_SetString(PyExc_TypeError, "comparator must be a string, or a 2-tuple (name, func)");
-		return 0;
-	}
+	Py_BEGIN_ALLOW_THREADS
 
-	const leveldb::Comparator* c = new PythonComparatorWrapper(cmp_name, cmp);
+	if (n > 0)
+		self->_db->GetApproximateSizes(&r[0], (int)n, &sizes[0]);
 
-	if (c == 0) {
-		PyErr_NoMemory();
+	Py_END_ALLOW_THREADS
+
+	PyObject* ret = PyList_New(n);
+
+	if (ret == 0)
 		return 0;
+
+	for (Py_ssize_t i = 0; i < n; i++) {
+		PyObject* size = PyLong_FromUnsignedLongLong(sizes[i]);
+
+		if (size == 0) {
+			Py_DECREF(ret);
+			return 0;
+		}
+
+		PyList_SET_ITEM(ret, i, size);
 	}
 
-	return c;
+	return ret;
 }
 
-const char pyleveldb_repair_db_doc[] =
-"leveldb.RepairDB(db_dir)\n\nAttempts to recover as much data as possible from a corrupt database."
-;
-PyObject* pyleveldb_repair_db(PyLevelDB* self, PyObject* args, PyObject* kwds)
+// midpoint of two keys, read as base-256 fractions, i.e. in bytewise order a <= m <= b
+static std::string pyleveldb_key_midpoint(const std::string& a, const std::string& b)
 {
-	const char* db_dir = 0;
+	size_t n = (a.size() > b.size() ? a.size() : b.size()) + 1;
+	std::vector<unsigned int> sum(n, 0);
+	std::string m(n, '\0');
+	unsigned int carry = 0;
+
+	for (size_t i = n; i > 0; i--) {
+		unsigned int x = (i - 1 < a.size()) ? (unsigned char)a[i - 1] : 0;
+		unsigned int y = (i - 1 < b.size()) ? (unsigned char)b[i - 1] : 0;
+		sum[i - 1] = x + y + carry;
+		carry = sum[i - 1] >> 8;
+		sum[i - 1] &= 0xff;
+	}
 
-	const char* kwargs[] = {"filename", "comparator", 0};
-	PyObject* comparator = 0;
+	for (size_t i = 0; i < n; i++) {
+		unsigned int d = (carry << 8) | sum[i];
+		m[i] = (char)(d >> 1);
+		carry = d & 1;
+	}
 
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, (char*)"s|O", (char**)kwargs,
-									 &db_dir,
-									 &comparator))
+	// trailing zeros only make the key longer
+	while (m.size() > 1 && m[m.size() - 1] == '\0' && m.compare(0, m.size() - 1, a) > 0)
+		m.resize(m.size() - 1);
+
+	return m;
+}
+
+static PyObject* PyLevelDB_SplitPoints(PyLevelDB* self, PyObject* args, PyObject* kwds)
+{
+	PY_LEVELDB_DEFINE_BUFFER(a);
+	PY_LEVELDB_DEFINE_BUFFER(b);
+	int n = 2;
+	const char* kwargs[] = {"start", "end", "n", 0};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, (char*)PARAM_S PARAM_S "|i", (char**)kwargs, PARAM_V(a), PARAM_V(b), &n))
 		return 0;
 
-	// get comparator
-	const leveldb::Comparator* c = pyleveldb_get_comparator(comparator);
-	if (c == 0) {
-		PyErr_SetString(leveldb_exception, "error loading comparator");
-		return NULL;
+	std::string start = PY_LEVELDB_STRING(a);
+	std::string end = PY_LEVELDB_STRING(b);
+
+	PY_LEVELDB_RELEASE_BUFFER(a);
+	PY_LEVELDB_RELEASE_BUFFER(b);
+
+	if (n < 1) {
+		PyErr_SetString(PyExc_ValueError, "n must be positive");
+		return 0;
 	}
 
-	std::string _db_dir(db_dir);
-	leveldb::Status status;
-	leveldb::Options options;
+	// synthesized split keys are only ordered correctly under bytewise order
+	if (self->_comparator != leveldb::BytewiseComparator()) {
+		PyErr_SetString(PyExc_ValueError, "SplitPoints requires the bytewise comparator");
+		return 0;
+	}
 
-	options.comparator = c;
+	std::vector<std::string> points;
 
 	Py_BEGIN_ALLOW_THREADS
-	status = leveldb::RepairDB(_db_dir.c_str(), options);
+
+	// GetApproximateSizes() only consults table boundaries and index blocks,
+	// so bisecting the key space on it never reads data blocks
+	leveldb::Range r(start, end);
+	uint64_t total = 0;
+	self->_db->GetApproximateSizes(&r, 1, &total);
+
+	std::string lo = start;
+
+	uint64_t lo_size = 0;
+
+	for (int i = 1; i < n && total > 0 && start < end; i++) {
+		uint64_t target = total * i / n;
+		uint64_t tolerance = total / ((uint64_t)n * 16);
+		std::string l = lo;
+		std::string h = end;
+		uint64_t l_size = lo_size;
+		uint64_t h_size = total;
+
+		for (int j = 0; j < 64 && h_size - l_size > tolerance; j++) {
+			std::string m = pyleveldb_key_midpoint(l, h);
+
+			if (m <= l || m >= h)
+				break;
+
+			uint64_t size = 0;
+			leveldb::Range q(start, m);
+			self->_db->GetApproximateSizes(&q, 1, &size);
+
+			if (size < target) {
+				l = m;
+				l_size = size;
+			} else {
+				h = m;
+				h_size = size;
+			}
+		}
+
+		// any key in (l, h] will do, so take the shortest one
+		size_t p = 0;
+
+		while (p < l.size() && p < h.size() && l[p] == h[p])
+			p++;
+
+		h.resize(p + 1 < h.size() ? p + 1 : h.size());
+
+		// skip split points which coincide, i.e. the range was too small to split
+		if (h < end && h > lo) {
+			points.push_back(h);
+			lo = h;
+			lo_size = h_size;
+		}
+	}
+
 	Py_END_ALLOW_THREADS
 
-	if (!status.ok()) {
-		PyLevelDB_set_error(status);
+	PyObject* ret = PyList_New(points.size());
+
+	if (ret == 0)
 		return 0;
+
+	for (size_t i = 0; i < points.size(); i++) {
+		PyObject* key = PY_LEVELDB_STRING_OR_BYTEARRAY(points[i].c_str(), points[i].size());
+
+		if (key == 0) {
+			Py_DECREF(ret);
+			return 0;
+		}
+
+		PyList_SET_ITEM(ret, i, key);
 	}
 
-	Py_INCREF(Py_None);
-	return Py_None;
+	return ret;
 }
 
-static int PyLevelDB_init(PyLevelDB* self, PyObject* args, PyObject* kwds)
+// what TableProperties() reports of a table file
+typedef struct {
+	uint64_t number;
+	int level;
+	uint64_t file_size;
+	uint64_t index_size;
+	uint64_t index_entries;
+} PyLevelDBTableProperties;
+
+// read the index block size and entry count of a table, from its footer and index block (see table/format.h),
+// must be called without the GIL
+static leveldb::Status pyleveldb_read_table_properties(leveldb::Env* env, const std::string& fname, PyLevelDBTableProperties* t)
 {
-	// cleanup
-	if (self->_db || self->_cache || self->_comparator || self->_options) {
-		Py_BEGIN_ALLOW_THREADS
+	const size_t footer_size = pyleveldb_table_footer_size;
+	const size_t trailer_size = pyleveldb_table_trailer_size;
+
+	leveldb::RandomAccessFile* file = 0;
+	leveldb::Status status = env->NewRandomAccessFile(fname, &file);
+
+	if (!status.ok())
+		return status;
+
+	char footer[footer_size];
+	leveldb::Slice f;
+	uint64_t offset = 0;
+	uint64_t size = 0;
+
+	if (t->file_size < footer_size)
+		status = leveldb::Status::Corruption(fname, "file is too short to be a table");
+	else
+		status = file->Read(t->file_size - footer_size, footer_size, &f, footer);
+
+	if (status.ok()) {
+		const char* p = f.data();
+		const char* end = f.data() + f.size();
+
+		// skip the metaindex handle
+		if (f.size() != footer_size || pyleveldb_load_le64(end - 8) != pyleveldb_table_magic ||
+			!pyleveldb_decode_varint64(&p, end, &offset) || !pyleveldb_decode_varint64(&p, end, &size) ||
+			!pyleveldb_decode_varint64(&p, end, &offset) || !pyleveldb_decode_varint64(&p, end, &size) ||
+			offset + size + trailer_size > t->file_size)
+			status = leveldb::Status::Corruption(fname, "bad table footer");
+	}
 
-		delete self->_db;
-		delete self->_options;
-		delete self->_cache;
+	std::string block;
+	std::string uncompressed;
 
-		if (self->_comparator != leveldb::BytewiseComparator())
-			delete self->_comparator;
+	if (status.ok()) {
+		block.resize(size + trailer_size);
+		leveldb::Slice b;
+		status = file->Read(offset, size + trailer_size, &b, &block[0]);
 
-		Py_END_ALLOW_THREADS
+		if (status.ok() && b.size() != size + trailer_size)
+			status = leveldb::Status::Corruption(fname, "truncated index block");
 
-		self->_db = 0;
-		self->_options = 0;
-		self->_cache = 0;
-		self->_comparator = 0;
-	}
+		if (status.ok()) {
+			leveldb::Slice contents(b.data(), size);
+			size_t n = 0;
 
-	// get params
-	const char* db_dir = 0;
+			// no compression, or snappy
+			if (b[size] == 1) {
+				if (!snappy::GetUncompressedLength(contents.data(), contents.size(), &n))
+					status = leveldb::Status::Corruption(fname, "cannot uncompress index block");
 
-	PyObject* create_if_missing = Py_True;
-	PyObject* error_if_exists = Py_False;
-	PyObject* paranoid_checks = Py_False;
-	int block_cache_size = 8 * (2 << 20);
-	int write_buffer_size = 4<<20;
-	int block_size = 4096;
-	int max_open_files = 1000;
-	int block_restart_interval = 16;
-  int max_file_size = 2 << 20;
-	const char* kwargs[] = {"filename", "create_if_missing", "error_if_exists", "paranoid_checks", "write_buffer_size",
-    "block_size", "max_open_files", "block_restart_interval", "block_cache_size", "max_file_size", "comparator", 0};
+				if (status.ok()) {
+					uncompressed.resize(n);
 
-	PyObject* comparator = 0;
+					if (!snappy::RawUncompress(contents.data(), contents.size(), &uncompressed[0]))
+						status = leveldb::Status::Corruption(fname, "cannot uncompress index block");
+				}
 
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, (char*)"s|O!O!O!iiiiiiO", (char**)kwargs,
-		&db_dir,
-		&PyBool_Type, &create_if_missing,
-		&PyBool_Type, &error_if_exists,
-		&PyBool_Type, &paranoid_checks,
-		&write_buffer_size,
-		&block_size,
-		&max_open_files,
-		&block_restart_interval,
-		&block_cache_size,
-		&max_file_size,
-		&comparator))
-		return -1;
+				contents = uncompressed;
+			}
 
-	if (write_buffer_size < 0 || block_size < 0 || max_open_files < 0 || block_restart_interval < 0 || block_cache_size < 0) {
-		PyErr_SetString(PyExc_ValueError, "negative write_buffer_size/block_size/max_open_files/block_restart_interval/cache_size");
-		return -1;
+			// index blocks have a restart point per entry
+			if (status.ok() && contents.size() >= 4) {
+				t->index_size = contents.size();
+				t->index_entries = pyleveldb_load_le32(contents.data() + contents.size() - 4);
+			} else if (status.ok()) {
+				status = leveldb::Status::Corruption(fname, "bad index block");
+			}
+		}
 	}
 
-	// get comparator
-	const leveldb::Comparator* c = pyleveldb_get_comparator(comparator);
+	delete file;
+	return status;
+}
 
-	if (c == 0)
-		return -1;
+static PyObject* PyLevelDB_TableProperties(PyLevelDB* self)
+{
+	std::string sstables;
+	std::vector<PyLevelDBTableProperties> tables;
+	leveldb::Status status;
 
-	// open database
-	self->_options = new leveldb::Options();
-	self->_cache = leveldb::NewLRUCache(block_cache_size);
-	self->_comparator = c;
+	Py_BEGIN_ALLOW_THREADS
 
-	if (self->_options == 0 || self->_cache == 0 || self->_comparator == 0) {
-		Py_BEGIN_ALLOW_THREADS
-		delete self->_options;
-		delete self->_cache;
+	// the only public listing of the live tables, as written by Version::DebugString() (db/version_set.cc):
+	// lines of "--- level N ---", followed by " number:size[smallest .. largest]" for each table; other
+	// lines are an error, rather than tables silently going missing should that format change
+	self->_db->GetProperty("leveldb.sstables", &sstables);
+	int level = 0;
+	size_t i = 0;
 
-		if (self->_comparator != leveldb::BytewiseComparator())
-			delete self->_comparator;
-		Py_END_ALLOW_THREADS
+	while (i < sstables.size() && status.ok()) {
+		size_t j = sstables.find('\n', i);
 
-		self->_options = 0;
-		self->_cache = 0;
-		self->_comparator = 0;
+		if (j == std::string::npos)
+			j = sstables.size();
 
-		PyErr_NoMemory();
-		return -1;
-	}
+		std::string line(sstables, i, j - i);
+		i = j + 1;
 
-	self->_options->create_if_missing = (create_if_missing == Py_True) ? true : false;
-	self->_options->error_if_exists = (error_if_exists == Py_True) ? true : false;
-	self->_options->paranoid_checks = (paranoid_checks == Py_True) ? true : false;
-	self->_options->write_buffer_size = write_buffer_size;
-	self->_options->block_size = block_size;
-	self->_options->max_open_files = max_open_files;
-	self->_options->block_restart_interval = block_restart_interval;
-	self->_options->compression = leveldb::kSnappyCompression;
-	self->_options->block_cache = self->_cache;
-	self->_options->max_file_size = max_file_size;
-	self->_options->comparator = self->_comparator;
-	leveldb::Status status;
+		if (line.compare(0, 10, "--- level ") == 0) {
+			level = atoi(line.c_str() + 10);
+			continue;
+		}
 
-	// note: copy string parameter, since we might lose it when we release the GIL
-	std::string _db_dir(db_dir);
+		PyLevelDBTableProperties t;
+		char* number = 0;
+		char* size = 0;
+		t.number = strtoull(line.c_str(), &number, 10);
+		bool valid = line.compare(0, 1, " ") == 0 && number != line.c_str() + 1 && *number == ':';
 
-	int i = 0;
+		if (valid) {
+			t.file_size = strtoull(number + 1, &size, 10);
+			valid = size != number + 1 && *size == '[';
+		}
 
-	Py_BEGIN_ALLOW_THREADS
-	status = leveldb::DB::Open(*self->_options, _db_dir, &self->_db);
+		if (!valid) {
+			status = leveldb::Status::Corruption("unexpected leveldb.sstables line", line);
+			break;
+		}
 
-	if (!status.ok()) {
-		delete self->_db;
-		delete self->_options;
-		delete self->_cache;
+		t.level = level;
+		t.index_size = 0;
+		t.index_entries = 0;
 
-		//! move out of thread block
-		if (self->_comparator != leveldb::BytewiseComparator())
-			delete self->_comparator;
+		char name[32];
+		snprintf(name, sizeof(name), "/%06llu.ldb", (unsigned long long)t.number);
+		status = pyleveldb_read_table_properties(self->_env, *self->_dbname + name, &t);
 
-		self->_db = 0;
-		self->_options = 0;
-		self->_cache = 0;
-		self->_comparator = 0;
+		// tables written by older versions
+		if (status.IsIOError() || status.IsNotFound()) {
+			snprintf(name, sizeof(name), "/%06llu.sst", (unsigned long long)t.number);
+			status = pyleveldb_read_table_properties(self->_env, *self->_dbname + name, &t);
+		}
 
-		i = -1;
+		// removed by a compaction in the meantime
+		if (status.IsIOError() || status.IsNotFound()) {
+			status = leveldb::Status::OK();
+			continue;
+		}
+
+		tables.push_back(t);
 	}
 
 	Py_END_ALLOW_THREADS
 
-	if (i == -1)
+	if (!status.ok()) {
 		PyLevelDB_set_error(status);
+		return 0;
+	}
 
-	return i;
-}
+	PyObject* ret = PyList_New(tables.size());
 
-static int PyWriteBatch_init(PyWriteBatch* self, PyObject* args, PyObject* kwds)
-{
-	self->ops->clear();
-	static char* kwargs[] = {0};
+	if (ret == 0)
+		return 0;
 
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, (char*)"", kwargs))
-		return -1;
+	for (size_t k = 0; k < tables.size(); k++) {
+		const PyLevelDBTableProperties& t = tables[k];
+		PyObject* d = Py_BuildValue("{s:K,s:i,s:K,s:K,s:K}",
+			"file", (unsigned PY_LONG_LONG)t.number,
+			"level", t.level,
+			"file_size", (unsigned PY_LONG_LONG)t.file_size,
+			"index_size", (unsigned PY_LONG_LONG)t.index_size,
+			"index_entries", (unsigned PY_LONG_LONG)t.index_entries);
+
+		if (d == 0) {
+			Py_DECREF(ret);
+			return 0;
+		}
 
-	return 0;
+		PyList_SET_ITEM(ret, k, d);
+	}
+
+	return ret;
 }
 
-static int PyLevelDBSnapshot_init(PyLevelDBSnapshot* self, PyObject* args, PyObject* kwds)
+// shards of 0 selects the default of the policy
+static int pyleveldb_check_cache_policy(const char* policy, Py_ssize_t shards)
 {
-	if (self->db && self->snapshot) {
-		self->db->n_snapshots -= 1;
-		self->db->_db->ReleaseSnapshot(self->snapshot);
-		Py_DECREF(self->db);
+	int i = 0;
+
+	while (pyleveldb_cache_policies[i] && strcmp(policy, pyleveldb_cache_policies[i]) != 0)
+		i++;
+
+	if (pyleveldb_cache_policies[i] == 0) {
+		PyErr_SetString(PyExc_ValueError, "unknown cache policy");
+		return 0;
 	}
 
-	self->db = 0;
-	self->snapshot = 0;
-	PyLevelDB* db = 0;
-	const leveldb::Snapshot* snapshot;
-	const char* kwargs[] = {"db", 0};
+	if (shards != 0 && strcmp(policy, "lru") == 0) {
+		PyErr_SetString(PyExc_ValueError, "the number of shards of the 'lru' cache is fixed");
+		return 0;
+	}
 
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, (char*)"O!", (char**)kwargs, &PyLevelDB_Type, &db))
-		return -1;
+	if (shards < 0 || (size_t)shards > pyleveldb_cache_max_shards || (shards & (shards - 1)) != 0) {
+		PyErr_SetString(PyExc_ValueError, "the number of cache shards must be a power of two, up to 4096");
+		return 0;
+	}
 
-	snapshot = db->_db->GetSnapshot();
+	return 1;
+}
 
-	//! TBD: deal with GetSnapshot() failure
+static PyObject* pyleveldb_cache_stats_dict(leveldb::Cache* cache)
+{
+	PyLevelDBCacheStats stats;
+	memset(&stats, 0, sizeof(stats));
 
-	self->db = db;
-	self->snapshot = snapshot;
+	if (cache)
+		pyleveldb_cache_stats(cache, &stats);
 
-	Py_INCREF(self->db);
-	self->db->n_snapshots += 1;
+	PyObject* d = Py_BuildValue("{s:K,s:K,s:K,s:K,s:K}",
+		"capacity", (unsigned PY_LONG_LONG)stats.capacity,
+		"usage", (unsigned PY_LONG_LONG)stats.usage,
+		"hits", (unsigned PY_LONG_LONG)stats.hits,
+		"misses", (unsigned PY_LONG_LONG)stats.misses,
+		"shards", (unsigned PY_LONG_LONG)stats.shards);
 
-	return 0;
+	if (d == 0 || !stats.segmented)
+		return d;
+
+	PyObject* segments = Py_BuildValue("{s:{s:K,s:K},s:{s:K,s:K}}",
+		"probation", "usage", (unsigned PY_LONG_LONG)stats.probation_usage, "hits", (unsigned PY_LONG_LONG)stats.probation_hits,
+		"protected", "usage", (unsigned PY_LONG_LONG)stats.protected_usage, "hits", (unsigned PY_LONG_LONG)stats.protected_hits);
+
+	if (segments == 0 || PyDict_SetItemString(d, "segments", segments) != 0) {
+		Py_XDECREF(segments);
+		Py_DECREF(d);
+		return 0;
+	}
+
+	Py_DECREF(segments);
+	return d;
 }
 
-static int PyLevelDBSnapshot_traverse(PyLevelDBSnapshot* iter, visitproc visit, void* arg)
+static PyObject* PyLevelDB_CacheStats(PyLevelDB* self)
 {
-	Py_VISIT((PyObject*)iter->db);
-	return 0;
-}
+	PyObject* d = pyleveldb_cache_stats_dict(self->_cache);
+	leveldb::Cache* compressed = self->_env ? pyleveldb_env_compressed_cache(self->_env) : 0;
+	leveldb::Cache* metadata = self->_env ? pyleveldb_env_metadata_cache(self->_env) : 0;
+	PyLevelDBFileCache* file_cache = self->_env ? pyleveldb_env_file_cache(self->_env) : 0;
 
-PyDoc_STRVAR(PyLevelDB_doc,
-"LevelDB(filename, **kwargs) -> leveldb object\n"
-"\n"
-"Open a LevelDB database, from the given directory.\n"
-"\n"
-"Only the parameter filename is mandatory.\n"
-"\n"
-"filename                                    the database directory\n"
-"create_if_missing (default: True)           if True, creates a new database if none exists\n"
-"error_if_exists   (default: False)          if True, raises and error if the database already exists\n"
-"paranoid_checks   (default: False)          if True, raises an error as soon as an internal corruption is detected\n"
-"block_cache_size  (default: 8 * (2 << 20))  maximum allowed size for the block cache in bytes\n"
-"write_buffer_size (default  2 * (2 << 20))  \n"
-"block_size        (default: 4096)           unit of transfer for the block cache in bytes\n""max_open_files:   (default: 1000)\n"
-"block_restart_interval           \n"
-"\n"
-"Snappy compression is used, if available.\n"
-"\n"
-"Some methods support the following parameters, having these semantics:\n"
-"\n"
-" verify_checksum: iff True, the operation will check for checksum mismatches\n"
-" fill_cache:      iff True, the operation will fill the cache with the data read\n"
-" sync:            iff True, the operation will be guaranteed to sync the operation to disk\n"
-"\n"
-"Methods supported are:\n"
-"\n"
-" Get(key, verify_checksums = False, fill_cache = True): get value, raises KeyError if key not found\n"
-"\n"
-"    key: the query key\n"
-"\n"
-" Put(key, value, sync = False): put key/value pair\n"
-"\n"
-"    key: the key\n"
-"    value: the value\n"
-"\n"
-" Delete(key, sync = False): delete key/value pair, raises no error kf key not found\n"
-"\n"
-"    key: the key\n"
-"\n"
-" Write(write_batch, sync = False): apply multiple put/delete operations atomatically\n"
-"\n"
-"    write_batch: the WriteBatch object holding the operations\n"
-"\n"
-" RangeIter(key_from = None, key_to = None, include_value = True, verify_checksums = False, fill_cache = True): return iterator\n"
-"\n"
-"    key_from: if not None: defines lower bound (inclusive) for iterator\n"
-"    key_to:   if not None: defined upper bound (inclusive) for iterator\n"
-"    include_value: if True, iterator returns key/value 2-tuples, otherwise, just keys\n"
-"\n"
-" GetStats(): get a string of runtime information\n"
-);
+	if (d == 0)
+		return 0;
 
-PyDoc_STRVAR(PyWriteBatch_doc,
-"WriteBatch() -> write batch object\n"
-"\n"
-"Create an object, which can hold a list of database operations, which\n"
-"can be applied atomically.\n"
-"\n"
-"Methods supported are:\n"
-"\n"
-" Put(key, value): add put operation to batch\n"
-"\n"
-"    key: the key\n"
-"    value: the value\n"
-"\n"
-" Delete(key): add delete operation to batch\n"
-"\n"
-"    key: the key\n"
-);
+	// the block cache only holds data blocks, of every database sharing it, index and filter blocks are
+	// held by the open tables of this one, and counted by their size on disk, with the block trailer
+	uint64_t index = 0;
+	uint64_t filter = 0;
 
-PyDoc_STRVAR(PyLevelDBSnapshot_doc, "");
+	if (self->_env)
+		pyleveldb_env_table_usage(self->_env, &index, &filter);
 
-PyTypeObject PyLevelDB_Type = {
-	#if PY_MAJOR_VERSION >= 3
-	PyVarObject_HEAD_INIT(NULL, 0)
+	PyObject* u = PyDict_GetItemString(d, "usage");
+	PyObject* categories = Py_BuildValue("{s:O,s:K,s:K}",
+		"data", u,
+		"index", (unsigned PY_LONG_LONG)index,
+		"filter", (unsigned PY_LONG_LONG)filter);
+
+	if (categories == 0 || PyDict_SetItemString(d, "categories", categories) != 0) {
+		Py_XDECREF(categories);
+		Py_DECREF(d);
+		return 0;
+	}
+
+	Py_DECREF(categories);
+
+	if (metadata) {
+		PyObject* m = pyleveldb_cache_stats_dict(metadata);
+
+		if (m == 0 || PyDict_SetItemString(d, "metadata", m) != 0) {
+			Py_XDECREF(m);
+			Py_DECREF(d);
+			return 0;
+		}
+
+		Py_DECREF(m);
+	}
+
+	if (compressed) {
+		PyObject* c = pyleveldb_cache_stats_dict(compressed);
+
+		if (c == 0 || PyDict_SetItemString(d, "compressed", c) != 0) {
+			Py_XDECREF(c);
+			Py_DECREF(d);
+			return 0;
+		}
+
+		Py_DECREF(c);
+	}
+
+	if (file_cache) {
+		PyLevelDBFileCacheStats s;
+
+		Py_BEGIN_ALLOW_THREADS
+		pyleveldb_file_cache_stats(file_cache, &s);
+		Py_END_ALLOW_THREADS
+
+		PyObject* f = Py_BuildValue("{s:K,s:K,s:K,s:K,s:K,s:K,s:K}",
+			"capacity", (unsigned PY_LONG_LONG)s.capacity,
+			"usage", (unsigned PY_LONG_LONG)s.usage,
+			"hits", (unsigned PY_LONG_LONG)s.hits,
+			"misses", (unsigned PY_LONG_LONG)s.misses,
+			"inserts", (unsigned PY_LONG_LONG)s.inserts,
+			"rejected", (unsigned PY_LONG_LONG)s.rejected,
+			"recovered", (unsigned PY_LONG_LONG)s.recovered);
+
+		if (f == 0 || PyDict_SetItemString(d, "file", f) != 0) {
+			Py_XDECREF(f);
+			Py_DECREF(d);
+			return 0;
+		}
+
+		Py_DECREF(f);
+	}
+
+	if (self->_row_cache) {
+		PyLevelDBRowCacheStats s;
+		pyleveldb_row_cache_stats(self->_row_cache, &s);
+
+		PyObject* r = Py_BuildValue("{s:K,s:K,s:K,s:K,s:K,s:K}",
+			"capacity", (unsigned PY_LONG_LONG)s.capacity,
+			"usage", (unsigned PY_LONG_LONG)s.usage,
+			"hits", (unsigned PY_LONG_LONG)s.hits,
+			"misses", (unsigned PY_LONG_LONG)s.misses,
+			"inserts", (unsigned PY_LONG_LONG)s.inserts,
+			"invalidations", (unsigned PY_LONG_LONG)s.invalidations);
+
+		if (r == 0 || PyDict_SetItemString(d, "row", r) != 0) {
+			Py_XDECREF(r);
+			Py_DECREF(d);
+			return 0;
+		}
+
+		Py_DECREF(r);
+	}
+
+	return d;
+}
+
+static PyMethodDef PyLevelDB_methods[] = {
+	{(char*)"Put",            (PyCFunction)PyLevelDB_Put,       METH_VARARGS | METH_KEYWORDS, (char*)"add a key/value pair to database, with an optional synchronous disk write" },
+	{(char*)"Get",            (PyCFunction)PyLevelDB_Get,       METH_VARARGS | METH_KEYWORDS, (char*)"get a value from the database" },
+	{(char*)"Delete",         (PyCFunction)PyLevelDB_Delete,    METH_VARARGS | METH_KEYWORDS, (char*)"delete a value in the database" },
+	{(char*)"Write",          (PyCFunction)PyLevelDB_Write,     METH_VARARGS | METH_KEYWORDS, (char*)"apply a write-batch"},
+	{(char*)"RangeIter",      (PyCFunction)PyLevelDB_RangeIter, METH_VARARGS | METH_KEYWORDS, (char*)"key/value range scan"},
+	{(char*)"MultiRangeIter", (PyCFunction)PyLevelDB_MultiRangeIter, METH_VARARGS | METH_KEYWORDS, (char*)"key/value scan of multiple ranges"},
+	{(char*)"GetStats",       (PyCFunction)PyLevelDB_GetStatus, METH_NOARGS,   (char*)"get a mapping of all DB statistics"},
+	{(char*)"CreateSnapshot", (PyCFunction)PyLevelDB_CreateSnapshot, METH_NOARGS, (char*)"create a new snapshot from current DB state"},
+	{(char*)"CompactRange", (PyCFunction)PyLevelDB_CompactRange, METH_VARARGS | METH_KEYWORDS, (char*)"Compact keys in the range"},
+	{(char*)"ApproximateSizes", (PyCFunction)PyLevelDB_ApproximateSizes, METH_VARARGS | METH_KEYWORDS, (char*)"approximate on-disk sizes of a list of key ranges"},
+	{(char*)"TableProperties", (PyCFunction)PyLevelDB_TableProperties, METH_NOARGS, (char*)"file and index block sizes of the table files"},
+	{(char*)"CacheStats",     (PyCFunction)PyLevelDB_CacheStats, METH_NOARGS,   (char*)"block cache usage and hit counts"},
+	{(char*)"SplitPoints",    (PyCFunction)PyLevelDB_SplitPoints, METH_VARARGS | METH_KEYWORDS, (char*)"keys splitting a range into parts of roughly equal on-disk size"},
+	{(char*)"CountRange",     (PyCFunction)PyLevelDB_CountRange, METH_VARARGS | METH_KEYWORDS, (char*)"count the entries in a key range"},
+	{(char*)"RangeStats",     (PyCFunction)PyLevelDB_RangeStats, METH_VARARGS | METH_KEYWORDS, (char*)"entry count and key/value byte totals of a key range"},
+	{(char*)"ScanColumnar",   (PyCFunction)PyLevelDB_ScanColumnar, METH_VARARGS | METH_KEYWORDS, (char*)"range scan into arrow-style offset/data buffers"},
+	{NULL}
+};
+
+static PyMethodDef PyWriteBatch_methods[] = {
+	{(char*)"Put",    (PyCFunction)PyWriteBatch_Put,    METH_VARARGS, (char*)"add a put op to batch" },
+	{(char*)"Delete", (PyCFunction)PyWriteBatch_Delete, METH_VARARGS, (char*)"add a delete op to batch" },
+	{NULL}
+};
+
+static PyMethodDef PyLevelDBSnapshot_methods[] = {
+	{(char*)"Get",       (PyCFunction)PyLevelDBSnaphot_Get,        METH_VARARGS | METH_KEYWORDS, (char*)"get a value from the snapshot" },
+	{(char*)"RangeIter", (PyCFunction)PyLevelDBSnapshot_RangeIter, METH_VARARGS | METH_KEYWORDS, (char*)"key/value range scan"},
+	{(char*)"MultiRangeIter", (PyCFunction)PyLevelDBSnapshot_MultiRangeIter, METH_VARARGS | METH_KEYWORDS, (char*)"key/value scan of multiple ranges"},
+	{(char*)"CountRange", (PyCFunction)PyLevelDBSnapshot_CountRange, METH_VARARGS | METH_KEYWORDS, (char*)"count the entries in a key range"},
+	{(char*)"RangeStats", (PyCFunction)PyLevelDBSnapshot_RangeStats, METH_VARARGS | METH_KEYWORDS, (char*)"entry count and key/value byte totals of a key range"},
+	{(char*)"ScanColumnar", (PyCFunction)PyLevelDBSnapshot_ScanColumnar, METH_VARARGS | METH_KEYWORDS, (char*)"range scan into arrow-style offset/data buffers"},
+	{NULL}
+};
+
+static int pyleveldb_str_eq(PyObject* p, const char* s)
+{
+	// 8-bit string
+	#if PY_MAJOR_VERSION < 3
+	if (PyString_Check(p) && strcmp(PyString_AS_STRING(p), s) == 0)
+		return 1;
+	#endif
+
+	// unicode string
+	if (PyUnicode_Check(p)) {
+		size_t i = 0;
+		Py_UNICODE* c = PyUnicode_AS_UNICODE(p);
+
+		while (s[i] && c[i] && (int)s[i] == (int)c[i])
+			i++;
+
+		return ((int)s[i] == (int)c[i]);
+	}
+
+	return 0;
+}
+
+static const leveldb::Comparator* pyleveldb_get_comparator(PyObject* comparator)
+{
+	// default comparator
+	if (comparator == 0 || pyleveldb_str_eq(comparator, "bytewise"))
+		return leveldb::BytewiseComparator();
+
+	// comparator compiled from a key schema
+	if (PyObject_TypeCheck(comparator, &PyLevelDBKeySchema_Type)) {
+		PyLevelDBKeySchema* schema = (PyLevelDBKeySchema*)comparator;
+
+		if (schema->fields->empty()) {
+			PyErr_SetString(PyExc_ValueError, "key schema is not initialized");
+			return 0;
+		}
+
+		const leveldb::Comparator* c = pyleveldb_schema_comparator_new(*schema->fields, *schema->name);
+
+		if (c == 0)
+			PyErr_NoMemory();
+
+		return c;
+	}
+
+	// native comparators, by name
+	for (int i = 0; pyleveldb_native_comparators[i]; i++) {
+		if (pyleveldb_str_eq(comparator, pyleveldb_native_comparators[i])) {
+			const leveldb::Comparator* c = pyleveldb_native_comparator_new(pyleveldb_native_comparators[i]);
+
+			if (c == 0)
+				PyErr_NoMemory();
+
+			return c;
+		}
+	}
+
+	#if PY_MAJOR_VERSION < 3
+	if (PyString_Check(comparator) || PyUnicode_Check(comparator)) {
 	#else
-	PyObject_HEAD_INIT(NULL)
-	0,
+	if (PyUnicode_Check(comparator)) {
 	#endif
-	(char*)"leveldb.LevelDB",      /*tp_name*/
-	sizeof(PyLevelDB),             /*tp_basicsize*/
-	0,                             /*tp_itemsize*/
-	(destructor)PyLevelDB_dealloc, /*tp_dealloc*/
-	0,                             /*tp_print*/
-	0,                             /*tp_getattr*/
-	0,                             /*tp_setattr*/
-	0,                             /*tp_compare*/
-	0,                             /*tp_repr*/
-	0,                             /*tp_as_number*/
-	0,                             /*tp_as_sequence*/
-	0,                             /*tp_as_mapping*/
-	0,                             /*tp_hash */
-	0,                             /*tp_call*/
-	0,                             /*tp_str*/
-	0,                             /*tp_getattro*/
-	0,                             /*tp_setattro*/
-	0,                             /*tp_as_buffer*/
-	Py_TPFLAGS_DEFAULT,            /*tp_flags*/
-	(char*)PyLevelDB_doc,          /*tp_doc */
-	0,                             /*tp_traverse */
-	0,                             /*tp_clear */
-	0,                             /*tp_richcompare */
-	0,                             /*tp_weaklistoffset */
-	0,                             /*tp_iter */
-	0,                             /*tp_iternext */
-	PyLevelDB_methods,             /*tp_methods */
-	0,                             /*tp_members */
-	0,                             /*tp_getset */
-	0,                             /*tp_base */
-	0,                             /*tp_dict */
-	0,                             /*tp_descr_get */
-	0,                             /*tp_descr_set */
-	0,                             /*tp_dictoffset */
-	(initproc)PyLevelDB_init,      /*tp_init */
-	0,                             /*tp_alloc */
-	PyLevelDB_new,                 /*tp_new */
-};
+		PyErr_SetString(PyExc_ValueError, "unknown comparator name");
+		return 0;
+	}
+
+	// (name-ascii, python-callable [, 'bytewise' | separator, successor])
+	const char* cmp_name = 0;
+	PyObject* cmp = 0;
+	PyObject* separator = Py_None;
+	PyObject* successor = Py_None;
+	bool bytewise_shortening = false;
+
+	if (!PyTuple_Check(comparator) || !PyArg_ParseTuple(comparator, (char*)"sO|OO", &cmp_name, &cmp, &separator, &successor) || !PyCallable_Check(cmp)) {
+		PyErr_SetString(PyExc_TypeError, "comparator must be a string, a KeySchema, or a tuple (name, func[, 'bytewise' | separator, successor])");
+		return 0;
+	}
+
+	if (PyTuple_GET_SIZE(comparator) == 3) {
+		if (!pyleveldb_str_eq(separator, "bytewise")) {
+			PyErr_SetString(PyExc_ValueError, "the third comparator tuple item can only be 'bytewise'");
+			return 0;
+		}
+
+		bytewise_shortening = true;
+		separator = Py_None;
+	}
+
+	if ((separator != Py_None && !PyCallable_Check(separator)) || (successor != Py_None && !PyCallable_Check(successor))) {
+		PyErr_SetString(PyExc_TypeError, "separator and successor must be callable, or None");
+		return 0;
+	}
+
+	const leveldb::Comparator* c = new PythonComparatorWrapper(cmp_name, cmp,
+		(separator != Py_None) ? separator : 0,
+		(successor != Py_None) ? successor : 0,
+		bytewise_shortening);
+
+	if (c == 0) {
+		PyErr_NoMemory();
+		return 0;
+	}
+
+	return c;
+}
+
+const char pyleveldb_repair_db_doc[] =
+"leveldb.RepairDB(db_dir)\n\nAttempts to recover as much data as possible from a corrupt database."
+;
+PyObject* pyleveldb_repair_db(PyLevelDB* self, PyObject* args, PyObject* kwds)
+{
+	const char* db_dir = 0;
+
+	const char* kwargs[] = {"filename", "comparator", 0};
+	PyObject* comparator = 0;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, (char*)"s|O", (char**)kwargs,
+									 &db_dir,
+									 &comparator))
+		return 0;
+
+	// get comparator
+	const leveldb::Comparator* c = pyleveldb_get_comparator(comparator);
+	if (c == 0) {
+		PyErr_SetString(leveldb_exception, "error loading comparator");
+		return NULL;
+	}
+
+	std::string _db_dir(db_dir);
+	leveldb::Status status;
+	leveldb::Options options;
+
+	options.comparator = c;
+
+	Py_BEGIN_ALLOW_THREADS
+	status = leveldb::RepairDB(_db_dir.c_str(), options);
+	Py_END_ALLOW_THREADS
+
+	if (!status.ok()) {
+		PyLevelDB_set_error(status);
+		return 0;
+	}
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static int PyLevelDB_init(PyLevelDB* self, PyObject* args, PyObject* kwds)
+{
+	// cleanup
+	if (self->_db || self->_cache || self->_comparator || self->_options || self->_env || self->_row_cache || self->_filter_policy) {
+		Py_BEGIN_ALLOW_THREADS
+
+		delete self->_db;
+		delete self->_options;
+		pyleveldb_cache_unref(self->_cache);
+		delete self->_env;
+		pyleveldb_row_cache_delete(self->_row_cache);
+		delete self->_dbname;
+
+		if (self->_comparator != leveldb::BytewiseComparator())
+			delete self->_comparator;
+
+		delete self->_filter_policy;
+
+		Py_END_ALLOW_THREADS
+
+		self->_dbname = 0;
+
+		self->_db = 0;
+		self->_options = 0;
+		self->_cache = 0;
+		self->_comparator = 0;
+		self->_filter_policy = 0;
+		self->_env = 0;
+		self->_row_cache = 0;
+	}
+
+	// get params
+	const char* db_dir = 0;
+
+	PyObject* create_if_missing = Py_True;
+	PyObject* error_if_exists = Py_False;
+	PyObject* paranoid_checks = Py_False;
+	int block_cache_size = 8 * (2 << 20);
+	int write_buffer_size = 4<<20;
+	int block_size = 4096;
+	int max_open_files = 1000;
+	int block_restart_interval = 16;
+  int max_file_size = 2 << 20;
+	int compaction_readahead_size = 0;
+	int compressed_cache_size = 0;
+	const char* kwargs[] = {"filename", "create_if_missing", "error_if_exists", "paranoid_checks", "write_buffer_size",
+    "block_size", "max_open_files", "block_restart_interval", "block_cache_size", "max_file_size", "comparator", "compaction_readahead_size", "block_cache", "cache_policy", "cache_shards", "compressed_cache_size", "file_cache_path", "file_cache_size", "row_cache_size", "metadata_cache_size", "bloom_filter_bits", 0};
+
+	PyObject* comparator = 0;
+	PyObject* block_cache = 0;
+	const char* cache_policy = 0;
+	PyObject* _cache_shards = 0;
+	Py_ssize_t cache_shards = 0;
+	const char* file_cache_path = 0;
+	Py_ssize_t file_cache_size = 0;
+	Py_ssize_t row_cache_size = 0;
+	Py_ssize_t metadata_cache_size = 0;
+	int bloom_filter_bits = 0;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, (char*)"s|O!O!O!iiiiiiOiO!sOiznnni", (char**)kwargs,
+		&db_dir,
+		&PyBool_Type, &create_if_missing,
+		&PyBool_Type, &error_if_exists,
+		&PyBool_Type, &paranoid_checks,
+		&write_buffer_size,
+		&block_size,
+		&max_open_files,
+		&block_restart_interval,
+		&block_cache_size,
+		&max_file_size,
+		&comparator,
+		&compaction_readahead_size,
+		&PyLevelDBBlockCache_Type, &block_cache,
+		&cache_policy,
+		&_cache_shards,
+		&compressed_cache_size,
+		&file_cache_path,
+		&file_cache_size,
+		&row_cache_size,
+		&metadata_cache_size,
+		&bloom_filter_bits))
+		return -1;
+
+	if (write_buffer_size < 0 || block_size < 0 || max_open_files < 0 || block_restart_interval < 0 || block_cache_size < 0 || compaction_readahead_size < 0 || compressed_cache_size < 0) {
+		PyErr_SetString(PyExc_ValueError, "negative write_buffer_size/block_size/max_open_files/block_restart_interval/cache_size/compaction_readahead_size/compressed_cache_size");
+		return -1;
+	}
+
+	if (block_cache && ((PyLevelDBBlockCache*)block_cache)->cache == 0) {
+		PyErr_SetString(PyExc_ValueError, "uninitialized block cache");
+		return -1;
+	}
+
+	// a shared cache has its policy and shards already
+	if (block_cache && (cache_policy || _cache_shards)) {
+		PyErr_SetString(PyExc_ValueError, "cache_policy and cache_shards can not be given with block_cache, pass them to BlockCache instead");
+		return -1;
+	}
+
+	if (_cache_shards) {
+		cache_shards = PyNumber_AsSsize_t(_cache_shards, PyExc_OverflowError);
+
+		if (cache_shards == -1 && PyErr_Occurred())
+			return -1;
+	}
+
+	if (cache_policy == 0)
+		cache_policy = "lru";
+
+	if (!pyleveldb_check_cache_policy(cache_policy, cache_shards))
+		return -1;
+
+	if (file_cache_size < 0 || (file_cache_path != 0 && file_cache_size == 0)) {
+		PyErr_SetString(PyExc_ValueError, "file_cache_size must be positive when file_cache_path is given");
+		return -1;
+	}
+
+	if (row_cache_size < 0 || metadata_cache_size < 0 || bloom_filter_bits < 0) {
+		PyErr_SetString(PyExc_ValueError, "negative row_cache_size/metadata_cache_size/bloom_filter_bits");
+		return -1;
+	}
+
+	// get comparator
+	const leveldb::Comparator* c = pyleveldb_get_comparator(comparator);
+
+	if (c == 0)
+		return -1;
+
+	// filters hash the bytes of keys, a Python comparator may consider different ones equal, the
+	// native comparators never do (ties between keys with equal components are broken bytewise)
+	if (bloom_filter_bits > 0 && dynamic_cast<const PythonComparatorWrapper*>(c) != 0) {
+		delete c;
+		PyErr_SetString(PyExc_ValueError, "bloom_filter_bits can not be used with a Python comparator");
+		return -1;
+	}
+
+	// open the persistent block cache, owned by the environment from here on
+	PyLevelDBFileCache* file_cache = 0;
+
+	if (file_cache_path) {
+		std::string error;
+
+		Py_BEGIN_ALLOW_THREADS
+		file_cache = pyleveldb_file_cache_open(file_cache_path, (uint64_t)file_cache_size, &error);
+		Py_END_ALLOW_THREADS
+
+		if (file_cache == 0) {
+			if (c != leveldb::BytewiseComparator())
+				delete c;
+
+			PyErr_SetString(leveldb_exception, error.c_str());
+			return -1;
+		}
+	}
+
+	// open database, with its own block cache unless a shared one is given
+	self->_options = new leveldb::Options();
+	self->_cache = block_cache ? pyleveldb_cache_ref(((PyLevelDBBlockCache*)block_cache)->cache) : pyleveldb_cache_new(block_cache_size, cache_policy, (size_t)cache_shards);
+	self->_comparator = c;
+	self->_filter_policy = (bloom_filter_bits > 0) ? leveldb::NewBloomFilterPolicy(bloom_filter_bits) : 0;
+	self->_env = pyleveldb_env_new((size_t)compaction_readahead_size, (size_t)compressed_cache_size, (size_t)metadata_cache_size, file_cache);
+
+	if (self->_options == 0 || self->_cache == 0 || self->_comparator == 0 || self->_env == 0) {
+		Py_BEGIN_ALLOW_THREADS
+		delete self->_options;
+		pyleveldb_cache_unref(self->_cache);
+		delete self->_env;
+
+		if (self->_comparator != leveldb::BytewiseComparator())
+			delete self->_comparator;
+
+		delete self->_filter_policy;
+
+		Py_END_ALLOW_THREADS
+
+		self->_options = 0;
+		self->_cache = 0;
+		self->_comparator = 0;
+		self->_filter_policy = 0;
+		self->_env = 0;
+
+		PyErr_NoMemory();
+		return -1;
+	}
+
+	self->_options->create_if_missing = (create_if_missing == Py_True) ? true : false;
+	self->_options->error_if_exists = (error_if_exists == Py_True) ? true : false;
+	self->_options->paranoid_checks = (paranoid_checks == Py_True) ? true : false;
+	self->_options->write_buffer_size = write_buffer_size;
+	self->_options->block_size = block_size;
+	self->_options->max_open_files = max_open_files;
+	self->_options->block_restart_interval = block_restart_interval;
+	self->_options->compression = leveldb::kSnappyCompression;
+	self->_options->block_cache = self->_cache;
+	self->_options->max_file_size = max_file_size;
+	self->_options->comparator = self->_comparator;
+	self->_options->filter_policy = self->_filter_policy;
+	self->_options->env = self->_env;
+	leveldb::Status status;
+
+	// note: copy string parameter, since we might lose it when we release the GIL
+	std::string _db_dir(db_dir);
+
+	int i = 0;
+
+	Py_BEGIN_ALLOW_THREADS
+
+	// tables of a database created now, or first opened with a file cache, are only cached once
+	// it has an id, the id file of a database that no longer exists is stale
+	uint64_t database_id = 0;
+
+	if (file_cache && self->_env->FileExists(_db_dir + "/CURRENT"))
+		database_id = pyleveldb_file_cache_database_id(_db_dir);
+
+	pyleveldb_env_set_database_id(self->_env, database_id);
+	status = leveldb::DB::Open(*self->_options, _db_dir, &self->_db);
+
+	if (status.ok() && file_cache && database_id == 0)
+		pyleveldb_env_set_database_id(self->_env, pyleveldb_file_cache_new_database_id(_db_dir));
+
+	if (!status.ok()) {
+		delete self->_db;
+		delete self->_options;
+		pyleveldb_cache_unref(self->_cache);
+		delete self->_env;
+
+		//! move out of thread block
+		if (self->_comparator != leveldb::BytewiseComparator())
+			delete self->_comparator;
+
+		delete self->_filter_policy;
+
+		self->_db = 0;
+		self->_options = 0;
+		self->_cache = 0;
+		self->_comparator = 0;
+		self->_filter_policy = 0;
+		self->_env = 0;
+
+		i = -1;
+	}
+
+	Py_END_ALLOW_THREADS
+
+	if (i == -1) {
+		PyLevelDB_set_error(status);
+	} else {
+		self->_dbname = new std::string(_db_dir);
+
+		// a Python comparator may consider different keys equal, the native comparators keep them
+		// distinct (the tuple and KeySchema comparators break ties bytewise)
+		if (row_cache_size > 0)
+			self->_row_cache = pyleveldb_row_cache_new((size_t)row_cache_size, dynamic_cast<const PythonComparatorWrapper*>(self->_comparator) == 0);
+	}
+
+	return i;
+}
+
+static int PyWriteBatch_init(PyWriteBatch* self, PyObject* args, PyObject* kwds)
+{
+	self->ops->clear();
+	static char* kwargs[] = {0};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, (char*)"", kwargs))
+		return -1;
+
+	return 0;
+}
+
+static int PyLevelDBSnapshot_init(PyLevelDBSnapshot* self, PyObject* args, PyObject* kwds)
+{
+	if (self->db && self->snapshot) {
+		self->db->n_snapshots -= 1;
+		self->db->_db->ReleaseSnapshot(self->snapshot);
+		Py_DECREF(self->db);
+	}
+
+	self->db = 0;
+	self->snapshot = 0;
+	self->row_generation = 0;
+	PyLevelDB* db = 0;
+	const leveldb::Snapshot* snapshot;
+	const char* kwargs[] = {"db", 0};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, (char*)"O!", (char**)kwargs, &PyLevelDB_Type, &db))
+		return -1;
+
+	snapshot = pyleveldb_get_snapshot(db, &self->row_generation);
+
+	//! TBD: deal with GetSnapshot() failure
+
+	self->db = db;
+	self->snapshot = snapshot;
+
+	Py_INCREF(self->db);
+	self->db->n_snapshots += 1;
+
+	return 0;
+}
+
+static int PyLevelDBSnapshot_traverse(PyLevelDBSnapshot* iter, visitproc visit, void* arg)
+{
+	Py_VISIT((PyObject*)iter->db);
+	return 0;
+}
+
+PyDoc_STRVAR(PyLevelDB_doc,
+"LevelDB(filename, **kwargs) -> leveldb object\n"
+"\n"
+"Open a LevelDB database, from the given directory.\n"
+"\n"
+"Only the parameter filename is mandatory.\n"
+"\n"
+"filename                                    the database directory\n"
+"create_if_missing (default: True)           if True, creates a new database if none exists\n"
+"error_if_exists   (default: False)          if True, raises and error if the database already exists\n"
+"paranoid_checks   (default: False)          if True, raises an error as soon as an internal corruption is detected\n"
+"block_cache_size  (default: 8 * (2 << 20))  maximum allowed size for the block cache in bytes\n"
+"block_cache       (default: None)           a BlockCache to use instead, which may be shared with other databases\n"
+"cache_policy      (default: 'lru')          eviction policy of the block cache, see BlockCache, not with block_cache\n"
+"cache_shards      (default: 0)              independently locked parts of the block cache, see BlockCache, not with\n"
+"                                            block_cache\n"
+"write_buffer_size (default  2 * (2 << 20))  \n"
+"block_size        (default: 4096)           unit of transfer for the block cache in bytes\n""max_open_files:   (default: 1000)\n"
+"block_restart_interval           \n"
+"compaction_readahead_size (default: 0)     if non-zero, compaction reads its input tables this many bytes\n"
+"                                            ahead, and drops them from the page cache once read, unless\n"
+"                                            foreground reads have used them\n"
+"compressed_cache_size (default: 0)         if non-zero, blocks missing the block cache are looked up in a second\n"
+"                                            cache of this many bytes, holding them as stored, i.e. compressed,\n"
+"                                            before they are read from disk\n"
+"file_cache_path   (default: None)           if given, blocks missing the block caches are looked up in a file at this\n"
+"                                            path, typically on a local SSD, before they are read from disk. Blocks\n"
+"                                            are written to it on their second miss, and it is kept across restarts.\n"
+"                                            Only one database can use the file at a time, and the database keeps\n"
+"                                            an id in its directory, so blocks of another database are never used\n"
+"file_cache_size   (default: 0)              the size of that file in bytes, required with file_cache_path\n"
+"metadata_cache_size (default: 0)           if non-zero, the index, filter and other metadata blocks of tables are kept\n"
+"                                            in a cache of this many bytes of their own, which data blocks do not\n"
+"                                            evict, so a table opened again (see max_open_files) reads no metadata\n"
+"                                            from disk\n"
+"bloom_filter_bits (default: 0)              if non-zero, tables are written with bloom filters of this many bits per key\n"
+"                                            (10 gives about 1% false positives), so Get() of a missing key reads no\n"
+"                                            data blocks of most tables. Not allowed with a Python comparator, which\n"
+"                                            may treat different byte strings as equal\n"
+"row_cache_size    (default: 0)              if non-zero, values read by Get() are cached, up to this many bytes, and\n"
+"                                            returned for repeated reads of the same key, until it is written\n"
+"comparator        (default: 'bytewise')     key order, the name of a native comparator, a KeySchema or a tuple (name, func)\n"
+"                                            where func(a, b) returns a negative, zero or positive integer. Native\n"
+"                                            comparators never call into Python, and are:\n"
+"\n"
+"  'bytewise'          lexicographic byte order\n"
+"  'reverse-bytewise'  lexicographic byte order, reversed\n"
+"  'uint64'            keys starting with a big-endian uint64 (the same order as bytewise)\n"
+"  'int64'             keys starting with a big-endian signed int64, the rest bytewise, shorter keys first\n"
+"  'tuple'             tuples of varint32 length-prefixed components, compared component by component,\n"
+"                      ties broken bytewise\n"
+"  'ascii-nocase'      bytewise, ignoring the case of ASCII letters, ties broken bytewise\n"
+"\n"
+"  Index blocks hold a key per data block, which a Python comparator cannot shorten by default.\n"
+"  (name, func, 'bytewise') shortens them natively as the bytewise comparator does, and\n"
+"  (name, func, separator, successor) calls separator(start, limit), returning a short key k with\n"
+"  start <= k < limit, and successor(key), returning a short key k >= key, either may be None.\n"
+"  Keys violating these bounds are not used.\n"
+"\n"
+"Snappy compression is used, if available.\n"
+"\n"
+"Some methods support the following parameters, having these semantics:\n"
+"\n"
+" verify_checksum: iff True, the operation will check for checksum mismatches\n"
+" fill_cache:      iff True, the operation will fill the cache with the data read\n"
+" sync:            iff True, the operation will be guaranteed to sync the operation to disk\n"
+"\n"
+"Methods supported are:\n"
+"\n"
+" Get(key, verify_checksums = False, fill_cache = True): get value, raises KeyError if key not found\n"
+"\n"
+"    key: the query key\n"
+"\n"
+" Put(key, value, sync = False): put key/value pair\n"
+"\n"
+"    key: the key\n"
+"    value: the value\n"
+"\n"
+" Delete(key, sync = False): delete key/value pair, raises no error kf key not found\n"
+"\n"
+"    key: the key\n"
+"\n"
+" Write(write_batch, sync = False): apply multiple put/delete operations atomatically\n"
+"\n"
+"    write_batch: the WriteBatch object holding the operations\n"
+"\n"
+" RangeIter(key_from = None, key_to = None, include_value = True, verify_checksums = False, fill_cache = True): return iterator\n"
+"\n"
+"    key_from: if not None: defines lower bound (inclusive) for iterator\n"
+"    key_to:   if not None: defined upper bound (inclusive) for iterator\n"
+"    include_value: if True, iterator returns key/value 2-tuples, otherwise, just keys\n"
+"\n"
+"    Entries can be filtered natively, without creating Python objects for skipped entries:\n"
+"\n"
+"    key_regex:      POSIX extended regular expression, searched for in the key\n"
+"    value_prefix:   value must start with these bytes\n"
+"    value_contains: value must contain these bytes\n"
+"    min_value_size, max_value_size: inclusive bounds on the value size\n"
+"    value_field:    (offset, bytes) 2-tuple, the value must hold these bytes at the offset\n"
+"\n"
+"    value_view: if True, values are read-only memoryviews into the current block instead of copies.\n"
+"    A view is released when the iterator advances, raising BufferError if it is still exported, e.g. by a slice.\n"
+"\n"
+"    The iterator pins the memtables and table files current at its creation. Long-lived iterators\n"
+"    can call refresh() to continue at the same position on the current state (or on the same snapshot),\n"
+"    releasing them. pinned() returns a dict with the number of pinned table files, the memtable bytes\n"
+"    and the age in seconds of the pinned state.\n"
+"    readahead_size: once table blocks are read back to back, have the OS fetch this many bytes ahead\n"
+"    of the scan, e.g. 2 MB on rotating disks. Default 0 (off).\n"
+"\n"
+" MultiRangeIter(ranges, include_value = True, verify_checksums = False, fill_cache = True): return iterator\n"
+"\n"
+"    ranges: a list of (start, end) 2-tuples, start inclusive, end exclusive, start may not be after end\n"
+"\n"
+"    The ranges are visited in key order, with a single underlying iterator, yielding (i, key, value)\n"
+"    3-tuples, or (i, key) if include_value is False, where i is the position of the range in the list.\n"
+"\n"
+" GetStats(): get a string of runtime information\n"
+"\n"
+" ApproximateSizes(ranges): return a list of approximate on-disk sizes in bytes\n"
+"\n"
+"    ranges: a list of (start, end) 2-tuples, start inclusive, end exclusive\n"
+"\n"
+" TableProperties(): return a list of dicts, one per table file, with keys file (number), level, file_size,\n"
+"    index_size (uncompressed bytes of the index block) and index_entries (data blocks)\n"
+"\n"
+" CacheStats(): return a dict with the capacity, usage, hits, misses and shards of the block cache, which may be\n"
+"    shared with other databases, and per-segment usage and hits for the 'slru' policy. Other stats are under:\n"
+"\n"
+"  'categories'  usage by kind of block: 'data', the usage of the block cache, which only holds data blocks,\n"
+"                of all the databases sharing it if it is a BlockCache, and 'index' and 'filter', the bytes of\n"
+"                those blocks held by the open tables of this database, as stored on disk, i.e. including their\n"
+"                5-byte block trailer and compressed if they are\n"
+"  'compressed'  the compressed block cache, if any, with the same stats as the block cache\n"
+"  'metadata'    the metadata cache, if any, with the same stats as the block cache\n"
+"  'file'        the file cache, if any, with the capacity, usage, hits, misses, inserts, rejected (misses\n"
+"                not yet admitted) and recovered (blocks found in the file when opened)\n"
+"  'row'         the row cache, if any, with the capacity, usage, hits, misses, inserts and invalidations\n"
+"                (by writes)\n"
+"\n"
+" SplitPoints(start, end, n = 2): return up to n - 1 keys, splitting the range into\n"
+"    parts of roughly equal on-disk size. Only table boundaries and index blocks are\n"
+"    consulted, so data in the memtable is not accounted for. Requires the bytewise comparator.\n"
+"\n"
+" CountRange(start = None, end = None, approximate = False): return the number of entries in the range\n"
+"\n"
+"    start: if not None: defines lower bound (inclusive)\n"
+"    end:   if not None: defines upper bound (exclusive)\n"
+"    approximate: if True, extrapolate from the first entries and the on-disk size of the range,\n"
+"                 taking more entries while those are only in the memtable\n"
+"\n"
+" RangeStats(start = None, end = None, approximate = False): return a dict with the entry count,\n"
+"    total key bytes, total value bytes and min/max value size of the range, computed without\n"
+"    creating Python objects per entry. In approximate mode, min/max are taken from the sample.\n"
+"\n"
+" ScanColumnar(start = None, end = None, limit = None, verify_checksums = False, fill_cache = True):\n"
+"    scan up to limit entries of [start, end) and return ((key_offsets, key_data), (value_offsets, value_data)),\n"
+"    following the arrow binary layout: offsets holds n + 1 int32 entries, entry i is data[offsets[i]:offsets[i + 1]].\n"
+"    The buffers are read-only and support the buffer protocol, e.g. numpy.frombuffer(key_offsets, numpy.int32)\n"
+);
+
+PyDoc_STRVAR(PyWriteBatch_doc,
+"WriteBatch() -> write batch object\n"
+"\n"
+"Create an object, which can hold a list of database operations, which\n"
+"can be applied atomically.\n"
+"\n"
+"Methods supported are:\n"
+"\n"
+" Put(key, value): add put operation to batch\n"
+"\n"
+"    key: the key\n"
+"    value: the value\n"
+"\n"
+" Delete(key): add delete operation to batch\n"
+"\n"
+"    key: the key\n"
+);
+
+PyDoc_STRVAR(PyLevelDBSnapshot_doc, "");
+
+PyTypeObject PyLevelDB_Type = {
+	#if PY_MAJOR_VERSION >= 3
+	PyVarObject_HEAD_INIT(NULL, 0)
+	#else
+	PyObject_HEAD_INIT(NULL)
+	0,
+	#endif
+	(char*)"leveldb.LevelDB",      /*tp_name*/
+	sizeof(PyLevelDB),             /*tp_basicsize*/
+	0,                             /*tp_itemsize*/
+	(destructor)PyLevelDB_dealloc, /*tp_dealloc*/
+	0,                             /*tp_print*/
+	0,                             /*tp_getattr*/
+	0,                             /*tp_setattr*/
+	0,                             /*tp_compare*/
+	0,                             /*tp_repr*/
+	0,                             /*tp_as_number*/
+	0,                             /*tp_as_sequence*/
+	0,                             /*tp_as_mapping*/
+	0,                             /*tp_hash */
+	0,                             /*tp_call*/
+	0,                             /*tp_str*/
+	0,                             /*tp_getattro*/
+	0,                             /*tp_setattro*/
+	0,                             /*tp_as_buffer*/
+	Py_TPFLAGS_DEFAULT,            /*tp_flags*/
+	(char*)PyLevelDB_doc,          /*tp_doc */
+	0,                             /*tp_traverse */
+	0,                             /*tp_clear */
+	0,                             /*tp_richcompare */
+	0,                             /*tp_weaklistoffset */
+	0,                             /*tp_iter */
+	0,                             /*tp_iternext */
+	PyLevelDB_methods,             /*tp_methods */
+	0,                             /*tp_members */
+	0,                             /*tp_getset */
+	0,                             /*tp_base */
+	0,                             /*tp_dict */
+	0,                             /*tp_descr_get */
+	0,                             /*tp_descr_set */
+	0,                             /*tp_dictoffset */
+	(initproc)PyLevelDB_init,      /*tp_init */
+	0,                             /*tp_alloc */
+	PyLevelDB_new,                 /*tp_new */
+};
+
+
+PyTypeObject PyWriteBatch_Type = {
+	#if PY_MAJOR_VERSION >= 3
+	PyVarObject_HEAD_INIT(NULL, 0)
+	#else
+	PyObject_HEAD_INIT(NULL)
+	0,
+	#endif
+	(char*)"leveldb.WriteBatch",      /*tp_name*/
+	sizeof(PyWriteBatch),             /*tp_basicsize*/
+	0,                                /*tp_itemsize*/
+	(destructor)PyWriteBatch_dealloc, /*tp_dealloc*/
+	0,                                /*tp_print*/
+	0,                                /*tp_getattr*/
+	0,                                /*tp_setattr*/
+	0,                                /*tp_compare*/
+	0,                                /*tp_repr*/
+	0,                                /*tp_as_number*/
+	0,                                /*tp_as_sequence*/
+	0,                                /*tp_as_mapping*/
+	0,                                /*tp_hash */
+	0,                                /*tp_call*/
+	0,                                /*tp_str*/
+	0,                                /*tp_getattro*/
+	0,                                /*tp_setattro*/
+	0,                                /*tp_as_buffer*/
+	Py_TPFLAGS_DEFAULT,               /*tp_flags*/
+	(char*)PyWriteBatch_doc,          /*tp_doc */
+	0,                                /*tp_traverse */
+	0,                                /*tp_clear */
+	0,                                /*tp_richcompare */
+	0,                                /*tp_weaklistoffset */
+	0,                                /*tp_iter */
+	0,                                /*tp_iternext */
+	PyWriteBatch_methods,             /*tp_methods */
+	0,                                /*tp_members */
+	0,                                /*tp_getset */
+	0,                                /*tp_base */
+	0,                                /*tp_dict */
+	0,                                /*tp_descr_get */
+	0,                                /*tp_descr_set */
+	0,                                /*tp_dictoffset */
+	(initproc)PyWriteBatch_init,      /*tp_init */
+	0,                                /*tp_alloc */
+	PyWriteBatch_new,                 /*tp_new */
+};
+
+PyTypeObject PyLevelDBSnapshot_Type = {
+	#if PY_MAJOR_VERSION >= 3
+	PyVarObject_HEAD_INIT(NULL, 0)
+	#else
+	PyObject_HEAD_INIT(NULL)
+	0,
+	#endif
+	(char*)"leveldb.Snapshot",      /*tp_name*/
+	sizeof(PyLevelDBSnapshot),             /*tp_basicsize*/
+	0,                                /*tp_itemsize*/
+	(destructor)PyLevelDBSnapshot_dealloc, /*tp_dealloc*/
+	0,                                /*tp_print*/
+	0,                                /*tp_getattr*/
+	0,                                /*tp_setattr*/
+	0,                                /*tp_compare*/
+	0,                                /*tp_repr*/
+	0,                                /*tp_as_number*/
+	0,                                /*tp_as_sequence*/
+	0,                                /*tp_as_mapping*/
+	0,                                /*tp_hash */
+	0,                                /*tp_call*/
+	0,                                /*tp_str*/
+	PyObject_GenericGetAttr,         /* tp_getattro */
+	0,                               /* tp_setattro */
+	0,                               /* tp_as_buffer */
+	Py_TPFLAGS_DEFAULT  | Py_TPFLAGS_HAVE_GC, /* tp_flags */
+	(char*)PyLevelDBSnapshot_doc,          /*tp_doc */
+	(traverseproc)PyLevelDBSnapshot_traverse,  /* tp_traverse */
+	0,                                /*tp_clear */
+	0,                                /*tp_richcompare */
+	0,                                /*tp_weaklistoffset */
+	0,                                /*tp_iter */
+	0,                                /*tp_iternext */
+	PyLevelDBSnapshot_methods,             /*tp_methods */
+	0,                                /*tp_members */
+	0,                                /*tp_getset */
+	0,                                /*tp_base */
+	0,                                /*tp_dict */
+	0,                                /*tp_descr_get */
+	0,                                /*tp_descr_set */
+	0,                                /*tp_dictoffset */
+	(initproc)PyLevelDBSnapshot_init,      /*tp_init */
+	0,                                /*tp_alloc */
+	PyLevelDBSnapshot_new,                 /*tp_new */
+};
+
+static void PyLevelDBIter_clean(PyLevelDBIter* iter)
+{
+	if (iter->db)
+		iter->db->n_iterators -= 1;
+
+	// a value view outlives the iterator, hand over the block it points into
+	if (iter->pinned && iter->pinned->exports > 0 && iter->iterator) {
+		iter->pinned->orphan = iter->iterator;
+		iter->pinned->ref = iter->ref;
+		iter->iterator = 0;
+		iter->ref = 0;
+	}
+
+	Py_CLEAR(iter->view);
+	Py_CLEAR(iter->pinned);
+
+	Py_BEGIN_ALLOW_THREADS
+
+	delete iter->iterator;
+	delete iter->bound;
+	delete iter->cache;
+	delete iter->read_options;
+	pyleveldb_filter_delete(iter->filter);
+
+	Py_END_ALLOW_THREADS
+
+	Py_XDECREF(iter->ref);
+
+	iter->ref = 0;
+	iter->db = 0;
+	iter->iterator = 0;
+	iter->bound = 0;
+	iter->include_value = 0;
+	iter->filter = 0;
+	iter->cache = 0;
+	iter->read_options = 0;
+}
+
+static void PyLevelDBIter_dealloc(PyLevelDBIter* iter)
+{
+	PyLevelDBIter_clean(iter);
+	PyObject_GC_Del(iter);
+}
+
+static int PyLevelDBIter_traverse(PyLevelDBIter* iter, visitproc visit, void* arg)
+{
+	Py_VISIT((PyObject*)iter->ref);
+	Py_VISIT(iter->view);
+	return 0;
+}
+
+// invalidate the last value view, and advance past its entry
+static int PyLevelDBIter_unpin(PyLevelDBIter* iter)
+{
+	if (iter->view) {
+		PyObject* r = PyObject_CallMethod(iter->view, (char*)"release", 0);
+
+		if (r == 0)
+			return 0;
+
+		Py_DECREF(r);
+		Py_CLEAR(iter->view);
+	}
+
+	// e.g. slices of the view, or arrays wrapping it
+	if (iter->pinned->exports > 0) {
+		PyErr_SetString(PyExc_BufferError, "the previous value is still exported, release it before advancing the iterator");
+		return 0;
+	}
+
+	Py_CLEAR(iter->pinned);
+
+	if (iter->is_reverse) {
+		iter->iterator->Prev();
+	} else {
+		iter->iterator->Next();
+	}
+
+	return 1;
+}
+
+// if we have an upper/lower bound, check whether we have run past it
+static int PyLevelDBIter_past_bound(PyLevelDBIter* iter)
+{
+	if (iter->bound == 0)
+		return 0;
+
+	leveldb::Slice a = leveldb::Slice(iter->bound->c_str(), iter->bound->size());
+	leveldb::Slice b = iter->iterator->key();
+	int c = pyleveldb_compare(iter->db->_options->comparator, a, b);
+
+	return (!iter->is_reverse && !(0 <= c)) || (iter->is_reverse && !(0 >= c));
+}
+
+// bounds on the number of entries and bytes decoded per refill of the reverse iterator cache
+static const size_t pyleveldb_iter_cache_min_batch = 16;
+static const size_t pyleveldb_iter_cache_max_batch = 1024;
+static const size_t pyleveldb_iter_cache_max_bytes = 1 << 20;
+
+// decode the next batch of entries into the cache, must be called without the GIL
+//
+// Each step still goes through leveldb's Prev(), which re-scans the block from the previous restart point,
+// so this only saves the per-entry GIL round trip and Python call overhead, not that scan.
+static void PyLevelDBIter_fill(PyLevelDBIter* iter)
+{
+	PyLevelDBIterCache* cache = iter->cache;
+	leveldb::Iterator* it = iter->iterator;
+	size_t bytes = 0;
+
+	cache->n = 0;
+	cache->pos = 0;
+
+	while (cache->n < cache->batch && bytes < pyleveldb_iter_cache_max_bytes && it->Valid() && !PyLevelDBIter_past_bound(iter)) {
+		leveldb::Slice key = it->key();
+		leveldb::Slice value = it->value();
+
+		if (iter->filter == 0 || pyleveldb_filter_match(iter->filter, key, value)) {
+			if (cache->n == cache->keys.size()) {
+				cache->keys.resize(cache->n + 1);
+				cache->values.resize(cache->n + 1);
+			}
+
+			// assign() reuses the capacity of earlier batches
+			cache->keys[cache->n].assign(key.data(), key.size());
+
+			if (iter->include_value)
+				cache->values[cache->n].assign(value.data(), value.size());
+
+			bytes += key.size() + value.size();
+			cache->n += 1;
+		}
+
+		it->Prev();
+	}
+
+	// a consumer which only wants the last few entries should not pay for a large batch
+	if (cache->batch < pyleveldb_iter_cache_max_batch)
+		cache->batch *= 2;
+}
+
+static PyObject* PyLevelDBIter_next_cached(PyLevelDBIter* iter)
+{
+	PyLevelDBIterCache* cache = iter->cache;
+
+	if (cache->pos == cache->n) {
+		Py_BEGIN_ALLOW_THREADS
+		PyLevelDBIter_fill(iter);
+		Py_END_ALLOW_THREADS
+	}
+
+	if (cache->pos == cache->n) {
+		PyLevelDBIter_clean(iter);
+		return 0;
+	}
+
+	const std::string& k = cache->keys[cache->pos];
+	const std::string& v = cache->values[cache->pos];
+	cache->pos += 1;
+
+	PyObject* key = PY_LEVELDB_STRING_OR_BYTEARRAY(k.data(), k.size());
+
+	if (key == 0 || !iter->include_value)
+		return key;
+
+	PyObject* value = PY_LEVELDB_STRING_OR_BYTEARRAY(v.data(), v.size());
+
+	if (value == 0) {
+		Py_DECREF(key);
+		return 0;
+	}
+
+	return Py_BuildValue("(NN)", key, value);
+}
+
+// claim the iterator for a call which advances it, so another thread may not step it while the GIL is released
+static int PyLevelDBIter_enter(PyLevelDBIter* iter)
+{
+	if (iter->busy) {
+		PyErr_SetString(PyExc_RuntimeError, "iterator is already in use by another thread");
+		return 0;
+	}
+
+	iter->busy = 1;
+	return 1;
+}
+
+static PyObject* PyLevelDBIter_next_(PyLevelDBIter* iter)
+{
+	PyLevelDBReadahead readahead(iter->readahead);
+
+	// the entry of the last value view has not been stepped over yet
+	if (iter->pinned && !PyLevelDBIter_unpin(iter))
+		return 0;
+
+	// empty, do cleanup (idempotent)
+	if (iter->ref == 0 || (iter->cache == 0 && !iter->iterator->Valid())) {
+		PyLevelDBIter_clean(iter);
+		return 0;
+	}
+
+	if (iter->cache)
+		return PyLevelDBIter_next_cached(iter);
+
+	// skip entries rejected by the native filter, releasing the GIL once the first one is rejected
+	if (iter->filter && !PyLevelDBIter_past_bound(iter) && !pyleveldb_filter_match(iter->filter, iter->iterator->key(), iter->iterator->value())) {
+		Py_BEGIN_ALLOW_THREADS
+
+		do {
+			if (iter->is_reverse)
+				iter->iterator->Prev();
+			else
+				iter->iterator->Next();
+		} while (iter->iterator->Valid() && !PyLevelDBIter_past_bound(iter) && !pyleveldb_filter_match(iter->filter, iter->iterator->key(), iter->iterator->value()));
+
+		Py_END_ALLOW_THREADS
+	}
+
+	// if we have run out of entries, or past the bound, clean up and return
+	if (!iter->iterator->Valid() || PyLevelDBIter_past_bound(iter)) {
+		PyLevelDBIter_clean(iter);
+		return 0;
+	}
+
+	// get key and (optional) value
+	PyObject* key = PY_LEVELDB_STRING_OR_BYTEARRAY(iter->iterator->key().data(), iter->iterator->key().size());
+
+	PyObject* value = 0;
+	PyObject* ret = key;
+
+	if (key == 0)
+		return 0;
+
+	if (iter->value_view) {
+		#if PY_MAJOR_VERSION >= 3
+		PyLevelDBPinnedValue* pinned = PyObject_New(PyLevelDBPinnedValue, &PyLevelDBPinnedValue_Type);
+
+		if (pinned == 0) {
+			Py_DECREF(key);
+			return 0;
+		}
+
+		pinned->data = iter->iterator->value().data();
+		pinned->size = (Py_ssize_t)iter->iterator->value().size();
+		pinned->exports = 0;
+		pinned->orphan = 0;
+		pinned->ref = 0;
+
+		value = PyMemoryView_FromObject((PyObject*)pinned);
+
+		if (value == 0) {
+			Py_DECREF(pinned);
+			Py_DECREF(key);
+			return 0;
+		}
+
+		// keep our own reference, to release the view before advancing
+		Py_INCREF(value);
+		iter->view = value;
+		iter->pinned = pinned;
+		#endif
+	} else if (iter->include_value) {
+		value = PY_LEVELDB_STRING_OR_BYTEARRAY(iter->iterator->value().data(), iter->iterator->value().size());
+
+		if (value == 0) {
+			Py_XDECREF(key);
+			return 0;
+		}
+	}
+
+	// key/value pairs are returned as 2-tuples
+	if (value) {
+		ret = PyTuple_New(2);
+
+		if (ret == 0) {
+			Py_DECREF(key);
+			Py_XDECREF(value);
+			return 0;
+		}
+
+		PyTuple_SET_ITEM(ret, 0, key);
+		PyTuple_SET_ITEM(ret, 1, value);
+	}
+
+	// get next/prev value, unless the value points into the current block
+	if (iter->pinned == 0) {
+		if (iter->is_reverse) {
+			iter->iterator->Prev();
+		} else {
+			iter->iterator->Next();
+		}
+	}
+	// return k/v pair or single key
+	return ret;
+}
+
+static PyObject* PyLevelDBIter_next(PyLevelDBIter* iter)
+{
+	if (!PyLevelDBIter_enter(iter))
+		return 0;
+
+	PyObject* ret = PyLevelDBIter_next_(iter);
+	iter->busy = 0;
+	return ret;
+}
+
+// record the table files and memtable memory the current version holds, i.e. what a new iterator pins
+static void PyLevelDBIter_record_pins(PyLevelDBIter* iter)
+{
+	leveldb::DB* db = iter->db->_db;
+	std::string value;
+	uint64_t files = 0;
+
+	for (int level = 0; level < 7; level++) {
+		char property[64];
+		snprintf(property, sizeof(property), "leveldb.num-files-at-level%d", level);
+
+		if (db->GetProperty(property, &value))
+			files += strtoull(value.c_str(), 0, 10);
+	}
+
+	// memory usage includes the block cache, which is not pinned
+	uint64_t memory = 0;
+	uint64_t cache = iter->db->_cache ? iter->db->_cache->TotalCharge() : 0;
+
+	if (db->GetProperty("leveldb.approximate-memory-usage", &value))
+		memory = strtoull(value.c_str(), 0, 10);
+
+	iter->pinned_files = files;
+	iter->pinned_memtable_bytes = (memory > cache) ? memory - cache : 0;
+	iter->pinned_micros = leveldb::Env::Default()->NowMicros();
+}
+
+static PyObject* PyLevelDBIter_refresh_(PyLevelDBIter* iter)
+{
+	// exhausted, nothing left to pin
+	if (iter->ref == 0)
+		Py_RETURN_FALSE;
+
+	// step over the entry of a value view, as in next()
+	if (iter->pinned && !PyLevelDBIter_unpin(iter))
+		return 0;
+
+	const leveldb::Comparator* comparator = iter->db->_options->comparator;
+	leveldb::Iterator* it = iter->iterator;
+	PyLevelDBReadahead readahead(iter->readahead);
+
+	// the entry to resume at, and whether it has been returned already
+	std::string key;
+	bool has_key = true;
+	bool exclusive = false;
+
+	Py_BEGIN_ALLOW_THREADS
+
+	if (iter->cache && iter->cache->pos < iter->cache->n) {
+		key = iter->cache->keys[iter->cache->pos];
+	} else if (it->Valid()) {
+		key = it->key().ToString();
+	} else {
+		// everything visible to the old iterator has been returned, resume past its last entry
+		if (iter->is_reverse)
+			it->SeekToFirst();
+		else
+			it->SeekToLast();
+
+		has_key = it->Valid();
+		exclusive = true;
+
+		if (has_key)
+			key = it->key().ToString();
+	}
+
+	// the old iterator releases its memtables and version
+	delete it;
+	it = iter->db->_db->NewIterator(*iter->read_options);
+
+	if (!has_key) {
+		if (iter->is_reverse)
+			it->SeekToLast();
+		else
+			it->SeekToFirst();
+	} else if (!iter->is_reverse) {
+		it->Seek(key);
+
+		if (exclusive && it->Valid() && pyleveldb_compare(comparator, it->key(), key) == 0)
+			it->Next();
+	} else {
+		it->Seek(key);
+
+		if (!it->Valid()) {
+			it->SeekToLast();
+		} else {
+			int c = pyleveldb_compare(comparator, it->key(), key);
+
+			if (c > 0 || (exclusive && c == 0))
+				it->Prev();
+		}
+	}
+
+	if (iter->cache) {
+		iter->cache->n = 0;
+		iter->cache->pos = 0;
+	}
+
+	iter->iterator = it;
+	PyLevelDBIter_record_pins(iter);
+
+	Py_END_ALLOW_THREADS
+
+	Py_RETURN_TRUE;
+}
+
+static PyObject* PyLevelDBIter_refresh(PyLevelDBIter* iter)
+{
+	if (!PyLevelDBIter_enter(iter))
+		return 0;
 
+	PyObject* ret = PyLevelDBIter_refresh_(iter);
+	iter->busy = 0;
+	return ret;
+}
 
-PyTypeObject PyWriteBatch_Type = {
+static PyObject* PyLevelDBIter_pins(PyLevelDBIter* iter)
+{
+	// refresh() records them without the GIL
+	if (!PyLevelDBIter_enter(iter))
+		return 0;
+
+	iter->busy = 0;
+
+	if (iter->ref == 0)
+		return Py_BuildValue("{s:i,s:i,s:d}", "files", 0, "memtable_bytes", 0, "age", 0.0);
+
+	uint64_t now = leveldb::Env::Default()->NowMicros();
+	double age = (now > iter->pinned_micros) ? (now - iter->pinned_micros) / 1e6 : 0.0;
+
+	return Py_BuildValue("{s:K,s:K,s:d}",
+		"files", iter->pinned_files,
+		"memtable_bytes", iter->pinned_memtable_bytes,
+		"age", age);
+}
+
+static PyMethodDef PyLevelDBIter_methods[] = {
+	{(char*)"refresh", (PyCFunction)PyLevelDBIter_refresh, METH_NOARGS, (char*)"re-create the iterator on the current database state, at the current position"},
+	{(char*)"pinned",  (PyCFunction)PyLevelDBIter_pins,    METH_NOARGS, (char*)"table files and memtable bytes held by the iterator, and their age in seconds"},
+	{NULL}
+};
+
+PyTypeObject PyLevelDBIter_Type = {
 	#if PY_MAJOR_VERSION >= 3
 	PyVarObject_HEAD_INIT(NULL, 0)
 	#else
 	PyObject_HEAD_INIT(NULL)
 	0,
 	#endif
-	(char*)"leveldb.WriteBatch",      /*tp_name*/
-	sizeof(PyWriteBatch),             /*tp_basicsize*/
-	0,                                /*tp_itemsize*/
-	(destructor)PyWriteBatch_dealloc, /*tp_dealloc*/
-	0,                                /*tp_print*/
-	0,                                /*tp_getattr*/
-	0,                                /*tp_setattr*/
-	0,                                /*tp_compare*/
-	0,                                /*tp_repr*/
-	0,                                /*tp_as_number*/
-	0,                                /*tp_as_sequence*/
-	0,                                /*tp_as_mapping*/
-	0,                                /*tp_hash */
-	0,                                /*tp_call*/
-	0,                                /*tp_str*/
-	0,                                /*tp_getattro*/
-	0,                                /*tp_setattro*/
-	0,                                /*tp_as_buffer*/
-	Py_TPFLAGS_DEFAULT,               /*tp_flags*/
-	(char*)PyWriteBatch_doc,          /*tp_doc */
-	0,                                /*tp_traverse */
-	0,                                /*tp_clear */
-	0,                                /*tp_richcompare */
-	0,                                /*tp_weaklistoffset */
-	0,                                /*tp_iter */
-	0,                                /*tp_iternext */
-	PyWriteBatch_methods,             /*tp_methods */
-	0,                                /*tp_members */
-	0,                                /*tp_getset */
-	0,                                /*tp_base */
-	0,                                /*tp_dict */
-	0,                                /*tp_descr_get */
-	0,                                /*tp_descr_set */
-	0,                                /*tp_dictoffset */
-	(initproc)PyWriteBatch_init,      /*tp_init */
-	0,                                /*tp_alloc */
-	PyWriteBatch_new,                 /*tp_new */
+	(char*)"leveldb-iterator",       /* tp_name */
+	sizeof(PyLevelDBIter),             /* tp_basicsize */
+	0,                               /* tp_itemsize */
+	(destructor)PyLevelDBIter_dealloc, /* tp_dealloc */
+	0,                               /* tp_print */
+	0,                               /* tp_getattr */
+	0,                               /* tp_setattr */
+	0,                               /* tp_compare */
+	0,                               /* tp_repr */
+	0,                               /* tp_as_number */
+	0,                               /* tp_as_sequence */
+	0,                               /* tp_as_mapping */
+	0,                               /* tp_hash */
+	0,                               /* tp_call */
+	0,                               /* tp_str */
+	PyObject_GenericGetAttr,         /* tp_getattro */
+	0,                               /* tp_setattro */
+	0,                               /* tp_as_buffer */
+	Py_TPFLAGS_DEFAULT  | Py_TPFLAGS_HAVE_GC, /* tp_flags */
+	0,                               /* tp_doc */
+	(traverseproc)PyLevelDBIter_traverse,  /* tp_traverse */
+	0,                               /* tp_clear */
+	0,                               /* tp_richcompare */
+	0,                               /* tp_weaklistoffset */
+	PyObject_SelfIter,               /* tp_iter */
+	(iternextfunc)PyLevelDBIter_next,  /* tp_iternext */
+	PyLevelDBIter_methods,           /* tp_methods */
+	0,
 };
 
-PyTypeObject PyLevelDBSnapshot_Type = {
+static PyObject* PyLevelDBIter_New(PyObject* ref, PyLevelDB* db, leveldb::Iterator* iterator, const leveldb::ReadOptions& read_options, std::string* bound, int include_value, int is_reverse, PyLevelDBIterFilter* filter, int value_view, size_t readahead)
+{
+	PyLevelDBIter* iter = PyObject_GC_New(PyLevelDBIter, &PyLevelDBIter_Type);
+
+	if (iter == 0) {
+		Py_BEGIN_ALLOW_THREADS
+		delete iterator;
+		delete bound;
+		pyleveldb_filter_delete(filter);
+		Py_END_ALLOW_THREADS
+		return 0;
+	}
+
+	Py_XINCREF(ref);
+	iter->ref = ref;
+	iter->db = db;
+	iter->iterator = iterator;
+	iter->is_reverse = is_reverse;
+	iter->bound = bound;
+	iter->include_value = include_value;
+	iter->filter = filter;
+	iter->value_view = value_view;
+	iter->view = 0;
+	iter->pinned = 0;
+	iter->cache = 0;
+	iter->read_options = iterator ? new leveldb::ReadOptions(read_options) : 0;
+	iter->pinned_files = 0;
+	iter->pinned_memtable_bytes = 0;
+	iter->pinned_micros = 0;
+	iter->readahead = readahead;
+	iter->busy = 0;
+
+	if (iterator)
+		PyLevelDBIter_record_pins(iter);
+
+	// value views point into the current block, so they can not be decoded ahead
+	if (iterator && is_reverse && !value_view) {
+		iter->cache = new PyLevelDBIterCache;
+		iter->cache->n = 0;
+		iter->cache->pos = 0;
+		iter->cache->batch = pyleveldb_iter_cache_min_batch;
+	}
+
+	if (iter->db)
+		iter->db->n_iterators += 1;
+
+	PyObject_GC_Track(iter);
+	return (PyObject*)iter;
+}
+
+static void PyLevelDBMultiIter_clean(PyLevelDBMultiIter* iter)
+{
+	if (iter->db)
+		iter->db->n_iterators -= 1;
+
+	Py_BEGIN_ALLOW_THREADS
+
+	delete iter->iterator;
+	delete iter->ranges;
+
+	Py_END_ALLOW_THREADS
+
+	Py_XDECREF(iter->ref);
+
+	iter->ref = 0;
+	iter->db = 0;
+	iter->iterator = 0;
+	iter->ranges = 0;
+}
+
+static void PyLevelDBMultiIter_dealloc(PyLevelDBMultiIter* iter)
+{
+	PyLevelDBMultiIter_clean(iter);
+	PyObject_GC_Del(iter);
+}
+
+static int PyLevelDBMultiIter_traverse(PyLevelDBMultiIter* iter, visitproc visit, void* arg)
+{
+	Py_VISIT((PyObject*)iter->ref);
+	return 0;
+}
+
+// number of Next() steps tried, before seeking to the start of a range
+static const int pyleveldb_multi_iter_max_steps = 8;
+
+// move the iterator forward to the start of the current range, must be called without the GIL
+static void PyLevelDBMultiIter_position(PyLevelDBMultiIter* iter)
+{
+	const leveldb::Comparator* comparator = iter->db->_options->comparator;
+	leveldb::Iterator* it = iter->iterator;
+	const PyLevelDBRange& r = (*iter->ranges)[iter->range];
+
+	// first range
+	if (iter->range == 0) {
+		it->Seek(r.start);
+		return;
+	}
+
+	// the iterator is at the end of the previous range (ranges are not inverted), unless this one overlaps it,
+	// so entries before the iterator position may be part of this range as well
+	const PyLevelDBRange& p = (*iter->ranges)[iter->range - 1];
+
+	if (pyleveldb_compare(comparator, r.start, p.end) < 0) {
+		it->Seek(r.start);
+		return;
+	}
+
+	// nearby ranges are cheaper to reach by stepping than by seeking
+	for (int i = 0; it->Valid() && i < pyleveldb_multi_iter_max_steps; i++) {
+		if (pyleveldb_compare(comparator, it->key(), r.start) >= 0)
+			return;
+
+		it->Next();
+	}
+
+	if (it->Valid() && pyleveldb_compare(comparator, it->key(), r.start) < 0)
+		it->Seek(r.start);
+}
+
+static PyObject* PyLevelDBMultiIter_next_(PyLevelDBMultiIter* iter)
+{
+	if (iter->ref == 0)
+		return 0;
+
+	const leveldb::Comparator* comparator = iter->db->_options->comparator;
+
+	while (iter->range < iter->ranges->size()) {
+		if (!iter->positioned) {
+			Py_BEGIN_ALLOW_THREADS
+			PyLevelDBMultiIter_position(iter);
+			Py_END_ALLOW_THREADS
+
+			iter->positioned = 1;
+		}
+
+		const PyLevelDBRange& r = (*iter->ranges)[iter->range];
+
+		if (iter->iterator->Valid() && pyleveldb_compare(comparator, iter->iterator->key(), r.end) < 0)
+			break;
+
+		iter->range += 1;
+		iter->positioned = 0;
+	}
+
+	// all ranges done, do cleanup (idempotent)
+	if (iter->range >= iter->ranges->size()) {
+		leveldb::Status status = iter->iterator->status();
+		PyLevelDBMultiIter_clean(iter);
+
+		if (!status.ok())
+			PyLevelDB_set_error(status);
+
+		return 0;
+	}
+
+	leveldb::Slice key = iter->iterator->key();
+	leveldb::Slice value = iter->iterator->value();
+	PyObject* k = PY_LEVELDB_STRING_OR_BYTEARRAY(key.data(), key.size());
+	PyObject* v = iter->include_value ? PY_LEVELDB_STRING_OR_BYTEARRAY(value.data(), value.size()) : 0;
+	PyObject* ret = 0;
+
+	if (k == 0 || (iter->include_value && v == 0)) {
+		Py_XDECREF(k);
+		Py_XDECREF(v);
+		return 0;
+	}
+
+	if (iter->include_value)
+		ret = Py_BuildValue("(nNN)", (*iter->ranges)[iter->range].index, k, v);
+	else
+		ret = Py_BuildValue("(nN)", (*iter->ranges)[iter->range].index, k);
+
+	if (ret == 0)
+		return 0;
+
+	iter->iterator->Next();
+	return ret;
+}
+
+static PyObject* PyLevelDBMultiIter_next(PyLevelDBMultiIter* iter)
+{
+	// positioning releases the GIL, another thread may not step the iterator meanwhile
+	if (iter->busy) {
+		PyErr_SetString(PyExc_RuntimeError, "iterator is already in use by another thread");
+		return 0;
+	}
+
+	iter->busy = 1;
+	PyObject* ret = PyLevelDBMultiIter_next_(iter);
+	iter->busy = 0;
+	return ret;
+}
+
+PyTypeObject PyLevelDBMultiIter_Type = {
 	#if PY_MAJOR_VERSION >= 3
 	PyVarObject_HEAD_INIT(NULL, 0)
 	#else
 	PyObject_HEAD_INIT(NULL)
 	0,
 	#endif
-	(char*)"leveldb.Snapshot",      /*tp_name*/
-	sizeof(PyLevelDBSnapshot),             /*tp_basicsize*/
-	0,                                /*tp_itemsize*/
-	(destructor)PyLevelDBSnapshot_dealloc, /*tp_dealloc*/
-	0,                                /*tp_print*/
-	0,                                /*tp_getattr*/
-	0,                                /*tp_setattr*/
-	0,                                /*tp_compare*/
-	0,                                /*tp_repr*/
-	0,                                /*tp_as_number*/
-	0,                                /*tp_as_sequence*/
-	0,                                /*tp_as_mapping*/
-	0,                                /*tp_hash */
-	0,                                /*tp_call*/
-	0,                                /*tp_str*/
-	PyObject_GenericGetAttr,         /* tp_getattro */
-	0,                               /* tp_setattro */
-	0,                               /* tp_as_buffer */
+	(char*)"leveldb-multi-iterator",     /* tp_name */
+	sizeof(PyLevelDBMultiIter),          /* tp_basicsize */
+	0,                                   /* tp_itemsize */
+	(destructor)PyLevelDBMultiIter_dealloc, /* tp_dealloc */
+	0,                                   /* tp_print */
+	0,                                   /* tp_getattr */
+	0,                                   /* tp_setattr */
+	0,                                   /* tp_compare */
+	0,                                   /* tp_repr */
+	0,                                   /* tp_as_number */
+	0,                                   /* tp_as_sequence */
+	0,                                   /* tp_as_mapping */
+	0,                                   /* tp_hash */
+	0,                                   /* tp_call */
+	0,                                   /* tp_str */
+	PyObject_GenericGetAttr,             /* tp_getattro */
+	0,                                   /* tp_setattro */
+	0,                                   /* tp_as_buffer */
 	Py_TPFLAGS_DEFAULT  | Py_TPFLAGS_HAVE_GC, /* tp_flags */
-	(char*)PyLevelDBSnapshot_doc,          /*tp_doc */
-	(traverseproc)PyLevelDBSnapshot_traverse,  /* tp_traverse */
-	0,                                /*tp_clear */
-	0,                                /*tp_richcompare */
-	0,                                /*tp_weaklistoffset */
-	0,                                /*tp_iter */
-	0,                                /*tp_iternext */
-	PyLevelDBSnapshot_methods,             /*tp_methods */
-	0,                                /*tp_members */
-	0,                                /*tp_getset */
-	0,                                /*tp_base */
-	0,                                /*tp_dict */
-	0,                                /*tp_descr_get */
-	0,                                /*tp_descr_set */
-	0,                                /*tp_dictoffset */
-	(initproc)PyLevelDBSnapshot_init,      /*tp_init */
-	0,                                /*tp_alloc */
-	PyLevelDBSnapshot_new,                 /*tp_new */
+	0,                                   /* tp_doc */
+	(traverseproc)PyLevelDBMultiIter_traverse, /* tp_traverse */
+	0,                                   /* tp_clear */
+	0,                                   /* tp_richcompare */
+	0,                                   /* tp_weaklistoffset */
+	PyObject_SelfIter,                   /* tp_iter */
+	(iternextfunc)PyLevelDBMultiIter_next, /* tp_iternext */
+	0,                                   /* tp_methods */
+	0,
 };
 
-static void PyLevelDBIter_clean(PyLevelDBIter* iter)
+static PyObject* PyLevelDBMultiIter_New(PyObject* ref, PyLevelDB* db, leveldb::Iterator* iterator, std::vector<PyLevelDBRange>* ranges, int include_value)
+{
+	PyLevelDBMultiIter* iter = PyObject_GC_New(PyLevelDBMultiIter, &PyLevelDBMultiIter_Type);
+
+	if (iter == 0) {
+		Py_BEGIN_ALLOW_THREADS
+		delete iterator;
+		delete ranges;
+		Py_END_ALLOW_THREADS
+		return 0;
+	}
+
+	Py_XINCREF(ref);
+	iter->ref = ref;
+	iter->db = db;
+	iter->iterator = iterator;
+	iter->ranges = ranges;
+	iter->range = 0;
+	iter->positioned = 0;
+	iter->include_value = include_value;
+	iter->busy = 0;
+
+	if (iter->db)
+		iter->db->n_iterators += 1;
+
+	PyObject_GC_Track(iter);
+	return (PyObject*)iter;
+}
+
+static PyObject* PyLevelDBSnapshot_New(PyLevelDB* db, const leveldb::Snapshot* snapshot, uint64_t row_generation)
+{
+	PyLevelDBSnapshot* s = PyObject_GC_New(PyLevelDBSnapshot, &PyLevelDBSnapshot_Type);
+
+	if (s == 0) {
+		db->_db->ReleaseSnapshot(snapshot);
+		return 0;
+	}
+
+	Py_INCREF(db);
+	s->db = db;
+	s->snapshot = snapshot;
+	s->row_generation = row_generation;
+	s->db->n_snapshots += 1;
+	PyObject_GC_Track(s);
+	return (PyObject*)s;
+}
+
+static void PyLevelDBBuffer_dealloc(PyLevelDBBuffer* self)
+{
+	delete self->data;
+	self->data = 0;
+
+	#if PY_MAJOR_VERSION >= 3
+	Py_TYPE(self)->tp_free((PyObject*)self);
+	#else
+	((PyObject*)self)->ob_type->tp_free((PyObject*)self);
+	#endif
+}
+
+static int PyLevelDBBuffer_getbuffer(PyLevelDBBuffer* self, Py_buffer* view, int flags)
 {
-	if (iter->db)
-		iter->db->n_iterators -= 1;
+	if ((flags & PyBUF_WRITABLE) == PyBUF_WRITABLE) {
+		PyErr_SetString(PyExc_BufferError, "leveldb buffers are read-only");
+		view->obj = 0;
+		return -1;
+	}
 
-	Py_BEGIN_ALLOW_THREADS
+	Py_INCREF(self);
+	view->obj = (PyObject*)self;
+	view->buf = (void*)self->data->data();
+	view->len = (Py_ssize_t)self->data->size();
+	view->readonly = 1;
+	view->itemsize = self->itemsize;
+	view->format = ((flags & PyBUF_FORMAT) == PyBUF_FORMAT) ? (char*)self->format : 0;
+	view->ndim = 1;
+	view->shape = ((flags & PyBUF_ND) == PyBUF_ND) ? &self->shape : 0;
+	view->strides = ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) ? &self->itemsize : 0;
+	view->suboffsets = 0;
+	view->internal = 0;
+	return 0;
+}
 
-	delete iter->iterator;
-	delete iter->bound;
+static Py_ssize_t PyLevelDBBuffer_length(PyLevelDBBuffer* self)
+{
+	return self->shape;
+}
 
-	Py_END_ALLOW_THREADS
+static PySequenceMethods PyLevelDBBuffer_as_sequence = {
+	(lenfunc)PyLevelDBBuffer_length, /* sq_length */
+};
 
-	Py_XDECREF(iter->ref);
+static PyBufferProcs PyLevelDBBuffer_as_buffer = {
+	#if PY_MAJOR_VERSION < 3
+	0, 0, 0, 0,
+	#endif
+	(getbufferproc)PyLevelDBBuffer_getbuffer, /* bf_getbuffer */
+	0,                                        /* bf_releasebuffer */
+};
 
-	iter->ref = 0;
-	iter->db = 0;
-	iter->iterator = 0;
-	iter->bound = 0;
-	iter->include_value = 0;
+PyTypeObject PyLevelDBBuffer_Type = {
+	#if PY_MAJOR_VERSION >= 3
+	PyVarObject_HEAD_INIT(NULL, 0)
+	#else
+	PyObject_HEAD_INIT(NULL)
+	0,
+	#endif
+	(char*)"leveldb-buffer",             /* tp_name */
+	sizeof(PyLevelDBBuffer),             /* tp_basicsize */
+	0,                                   /* tp_itemsize */
+	(destructor)PyLevelDBBuffer_dealloc, /* tp_dealloc */
+	0,                                   /* tp_print */
+	0,                                   /* tp_getattr */
+	0,                                   /* tp_setattr */
+	0,                                   /* tp_compare */
+	0,                                   /* tp_repr */
+	0,                                   /* tp_as_number */
+	&PyLevelDBBuffer_as_sequence,        /* tp_as_sequence */
+	0,                                   /* tp_as_mapping */
+	0,                                   /* tp_hash */
+	0,                                   /* tp_call */
+	0,                                   /* tp_str */
+	0,                                   /* tp_getattro */
+	0,                                   /* tp_setattro */
+	&PyLevelDBBuffer_as_buffer,          /* tp_as_buffer */
+	#if PY_MAJOR_VERSION >= 3
+	Py_TPFLAGS_DEFAULT,                  /* tp_flags */
+	#else
+	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER, /* tp_flags */
+	#endif
+	0,                                   /* tp_doc */
+};
+
+static PyObject* PyLevelDBBuffer_New(std::string* data, const char* format, Py_ssize_t itemsize)
+{
+	PyLevelDBBuffer* buffer = PyObject_New(PyLevelDBBuffer, &PyLevelDBBuffer_Type);
+
+	if (buffer == 0) {
+		delete data;
+		return 0;
+	}
+
+	buffer->data = data;
+	buffer->format = format;
+	buffer->itemsize = itemsize;
+	buffer->shape = (Py_ssize_t)data->size() / itemsize;
+	return (PyObject*)buffer;
 }
 
-static void PyLevelDBIter_dealloc(PyLevelDBIter* iter)
+static void PyLevelDBPinnedValue_dealloc(PyLevelDBPinnedValue* self)
 {
-	PyLevelDBIter_clean(iter);
-	PyObject_GC_Del(iter);
+	if (self->orphan) {
+		Py_BEGIN_ALLOW_THREADS
+		delete self->orphan;
+		Py_END_ALLOW_THREADS
+	}
+
+	Py_XDECREF(self->ref);
+
+	#if PY_MAJOR_VERSION >= 3
+	Py_TYPE(self)->tp_free((PyObject*)self);
+	#else
+	((PyObject*)self)->ob_type->tp_free((PyObject*)self);
+	#endif
 }
 
-static int PyLevelDBIter_traverse(PyLevelDBIter* iter, visitproc visit, void* arg)
+static int PyLevelDBPinnedValue_getbuffer(PyLevelDBPinnedValue* self, Py_buffer* view, int flags)
 {
-	Py_VISIT((PyObject*)iter->ref);
+	if (PyBuffer_FillInfo(view, (PyObject*)self, (void*)self->data, self->size, 1, flags) != 0)
+		return -1;
+
+	self->exports += 1;
 	return 0;
 }
 
-static PyObject* PyLevelDBIter_next(PyLevelDBIter* iter)
+static void PyLevelDBPinnedValue_releasebuffer(PyLevelDBPinnedValue* self, Py_buffer* view)
 {
-	// empty, do cleanup (idempotent)
-	if (iter->ref == 0 || !iter->iterator->Valid()) {
-		PyLevelDBIter_clean(iter);
-		return 0;
+	self->exports -= 1;
+
+	// last view on a block of an iterator which is gone
+	if (self->exports == 0 && self->orphan) {
+		Py_BEGIN_ALLOW_THREADS
+		delete self->orphan;
+		Py_END_ALLOW_THREADS
+
+		self->orphan = 0;
+		Py_CLEAR(self->ref);
 	}
+}
 
-	// if we have an upper/lower bound, and we have run past it, clean up and return
-	if (iter->bound) {
-		leveldb::Slice a = leveldb::Slice(iter->bound->c_str(), iter->bound->size());
-		leveldb::Slice b = iter->iterator->key();
-		int c = iter->db->_options->comparator->Compare(a, b);
+static PyBufferProcs PyLevelDBPinnedValue_as_buffer = {
+	#if PY_MAJOR_VERSION < 3
+	0, 0, 0, 0,
+	#endif
+	(getbufferproc)PyLevelDBPinnedValue_getbuffer,         /* bf_getbuffer */
+	(releasebufferproc)PyLevelDBPinnedValue_releasebuffer, /* bf_releasebuffer */
+};
 
-		if (!iter->is_reverse && !(0 <= c)) {
-			PyLevelDBIter_clean(iter);
-			return 0;
-		} else if (iter->is_reverse && !(0 >= c)) {
-			PyLevelDBIter_clean(iter);
-			return 0;
-		}
+PyTypeObject PyLevelDBPinnedValue_Type = {
+	#if PY_MAJOR_VERSION >= 3
+	PyVarObject_HEAD_INIT(NULL, 0)
+	#else
+	PyObject_HEAD_INIT(NULL)
+	0,
+	#endif
+	(char*)"leveldb-pinned-value",            /* tp_name */
+	sizeof(PyLevelDBPinnedValue),             /* tp_basicsize */
+	0,                                        /* tp_itemsize */
+	(destructor)PyLevelDBPinnedValue_dealloc, /* tp_dealloc */
+	0,                                        /* tp_print */
+	0,                                        /* tp_getattr */
+	0,                                        /* tp_setattr */
+	0,                                        /* tp_compare */
+	0,                                        /* tp_repr */
+	0,                                        /* tp_as_number */
+	0,                                        /* tp_as_sequence */
+	0,                                        /* tp_as_mapping */
+	0,                                        /* tp_hash */
+	0,                                        /* tp_call */
+	0,                                        /* tp_str */
+	0,                                        /* tp_getattro */
+	0,                                        /* tp_setattro */
+	&PyLevelDBPinnedValue_as_buffer,          /* tp_as_buffer */
+	#if PY_MAJOR_VERSION >= 3
+	Py_TPFLAGS_DEFAULT,                       /* tp_flags */
+	#else
+	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER, /* tp_flags */
+	#endif
+	0,                                        /* tp_doc */
+};
+
+// field types of a KeySchema
+static const struct {
+	const char* name;
+	int width;
+	int is_signed;
+} pyleveldb_key_field_types[] = {
+	{"u8",    1, 0},
+	{"u16",   2, 0},
+	{"u32",   4, 0},
+	{"u64",   8, 0},
+	{"i8",    1, 1},
+	{"i16",   2, 1},
+	{"i32",   4, 1},
+	{"i64",   8, 1},
+	{"bytes", 0, 0},
+	{0,       0, 0}
+};
+
+static PyObject* PyLevelDBKeySchema_new(PyTypeObject* type, PyObject* args, PyObject* kwds)
+{
+	PyLevelDBKeySchema* self = (PyLevelDBKeySchema*)type->tp_alloc(type, 0);
+
+	if (self) {
+		self->fields = new std::vector<PyLevelDBKeyField>;
+		self->name = new std::string;
 	}
 
-	// get key and (optional) value
-	PyObject* key = PY_LEVELDB_STRING_OR_BYTEARRAY(iter->iterator->key().data(), iter->iterator->key().size());
+	return (PyObject*)self;
+}
 
-	PyObject* value = 0;
-	PyObject* ret = key;
+static void PyLevelDBKeySchema_dealloc(PyLevelDBKeySchema* self)
+{
+	delete self->fields;
+	delete self->name;
+	self->fields = 0;
+	self->name = 0;
 
-	if (key == 0)
-		return 0;
+	#if PY_MAJOR_VERSION >= 3
+	Py_TYPE(self)->tp_free((PyObject*)self);
+	#else
+	((PyObject*)self)->ob_type->tp_free((PyObject*)self);
+	#endif
+}
 
-	if (iter->include_value) {
-		value = PY_LEVELDB_STRING_OR_BYTEARRAY(iter->iterator->value().data(), iter->iterator->value().size());
+static int PyLevelDBKeySchema_init(PyLevelDBKeySchema* self, PyObject* args, PyObject* kwds)
+{
+	const char* kwargs[] = {"fields", 0};
+	PyObject* fields = 0;
 
-		if (value == 0) {
-			Py_XDECREF(key);
-			return 0;
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, (char*)"O", (char**)kwargs, &fields))
+		return -1;
+
+	PyObject* seq = PySequence_Fast(fields, "fields must be a sequence");
+
+	if (seq == 0)
+		return -1;
+
+	std::vector<PyLevelDBKeyField> v;
+	std::string name("py-leveldb.KeySchema(");
+
+	for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(seq); i++) {
+		// 'type', or ('type', 'asc' | 'desc')
+		PyObject* item = PySequence_Fast_GET_ITEM(seq, i);
+		PyObject* type = item;
+		PyObject* order = 0;
+		int j = 0;
+
+		if (PyTuple_Check(item) && !PyArg_ParseTuple(item, (char*)"OO", &type, &order)) {
+			Py_DECREF(seq);
+			return -1;
 		}
-	}
 
-	// key/value pairs are returned as 2-tuples
-	if (value) {
-		ret = PyTuple_New(2);
+		while (pyleveldb_key_field_types[j].name && !pyleveldb_str_eq(type, pyleveldb_key_field_types[j].name))
+			j++;
 
-		if (ret == 0) {
-			Py_DECREF(key);
-			Py_XDECREF(value);
-			return 0;
+		if (pyleveldb_key_field_types[j].name == 0 || (order && !pyleveldb_str_eq(order, "asc") && !pyleveldb_str_eq(order, "desc"))) {
+			PyErr_SetString(PyExc_ValueError, "fields must be types, or (type, 'asc' | 'desc') tuples, types being u8, u16, u32, u64, i8, i16, i32, i64 or bytes");
+			Py_DECREF(seq);
+			return -1;
 		}
 
-		PyTuple_SET_ITEM(ret, 0, key);
-		PyTuple_SET_ITEM(ret, 1, value);
+		PyLevelDBKeyField f;
+		f.width = pyleveldb_key_field_types[j].width;
+		f.is_signed = pyleveldb_key_field_types[j].is_signed;
+		f.descending = (order && pyleveldb_str_eq(order, "desc")) ? 1 : 0;
+		v.push_back(f);
+
+		if (i)
+			name += ",";
+
+		name += pyleveldb_key_field_types[j].name;
+
+		if (f.descending)
+			name += " desc";
 	}
 
-	// get next/prev value
-	if (iter->is_reverse) {
-		iter->iterator->Prev();
-	} else {
-		iter->iterator->Next();
+	Py_DECREF(seq);
+
+	if (v.empty()) {
+		PyErr_SetString(PyExc_ValueError, "a key schema needs at least one field");
+		return -1;
 	}
-	// return k/v pair or single key
-	return ret;
+
+	*self->fields = v;
+	*self->name = name + ")";
+	return 0;
 }
 
-PyTypeObject PyLevelDBIter_Type = {
+static PyObject* PyLevelDBKeySchema_repr(PyLevelDBKeySchema* self)
+{
+	#if PY_MAJOR_VERSION >= 3
+	return PyUnicode_FromString(self->name->c_str());
+	#else
+	return PyString_FromString(self->name->c_str());
+	#endif
+}
+
+PyDoc_STRVAR(PyLevelDBKeySchema_doc,
+"KeySchema(fields) -> key schema object\n"
+"\n"
+"Describes composite keys, to be passed as the comparator of a LevelDB object, which then\n"
+"orders keys natively, field by field, without calling into Python.\n"
+"\n"
+"fields is a sequence of types, or (type, order) tuples, order being 'asc' (the default) or 'desc'.\n"
+"Types are u8, u16, u32, u64, i8, i16, i32 and i64 for fixed-width big-endian integers, and bytes for\n"
+"byte strings, which are varint32 length-prefixed, except for a trailing one, which takes the rest of\n"
+"the key (an empty trailing byte string is a missing field). Keys having fewer fields come first.\n"
+"\n"
+"The schema is recorded in the database, which can only be re-opened with the same schema.\n"
+"\n"
+"   KeySchema(['u32', ('i64', 'desc'), 'bytes'])\n"
+);
+
+PyTypeObject PyLevelDBKeySchema_Type = {
 	#if PY_MAJOR_VERSION >= 3
 	PyVarObject_HEAD_INIT(NULL, 0)
 	#else
 	PyObject_HEAD_INIT(NULL)
 	0,
 	#endif
-	(char*)"leveldb-iterator",       /* tp_name */
-	sizeof(PyLevelDBIter),             /* tp_basicsize */
-	0,                               /* tp_itemsize */
-	(destructor)PyLevelDBIter_dealloc, /* tp_dealloc */
-	0,                               /* tp_print */
-	0,                               /* tp_getattr */
-	0,                               /* tp_setattr */
-	0,                               /* tp_compare */
-	0,                               /* tp_repr */
-	0,                               /* tp_as_number */
-	0,                               /* tp_as_sequence */
-	0,                               /* tp_as_mapping */
-	0,                               /* tp_hash */
-	0,                               /* tp_call */
-	0,                               /* tp_str */
-	PyObject_GenericGetAttr,         /* tp_getattro */
-	0,                               /* tp_setattro */
-	0,                               /* tp_as_buffer */
-	Py_TPFLAGS_DEFAULT  | Py_TPFLAGS_HAVE_GC, /* tp_flags */
-	0,                               /* tp_doc */
-	(traverseproc)PyLevelDBIter_traverse,  /* tp_traverse */
-	0,                               /* tp_clear */
-	0,                               /* tp_richcompare */
-	0,                               /* tp_weaklistoffset */
-	PyObject_SelfIter,               /* tp_iter */
-	(iternextfunc)PyLevelDBIter_next,  /* tp_iternext */
-	0,                               /* tp_methods */
-	0,
+	(char*)"leveldb.KeySchema",             /* tp_name */
+	sizeof(PyLevelDBKeySchema),             /* tp_basicsize */
+	0,                                      /* tp_itemsize */
+	(destructor)PyLevelDBKeySchema_dealloc, /* tp_dealloc */
+	0,                                      /* tp_print */
+	0,                                      /* tp_getattr */
+	0,                                      /* tp_setattr */
+	0,                                      /* tp_compare */
+	(reprfunc)PyLevelDBKeySchema_repr,      /* tp_repr */
+	0,                                      /* tp_as_number */
+	0,                                      /* tp_as_sequence */
+	0,                                      /* tp_as_mapping */
+	0,                                      /* tp_hash */
+	0,                                      /* tp_call */
+	0,                                      /* tp_str */
+	0,                                      /* tp_getattro */
+	0,                                      /* tp_setattro */
+	0,                                      /* tp_as_buffer */
+	Py_TPFLAGS_DEFAULT,                     /* tp_flags */
+	(char*)PyLevelDBKeySchema_doc,          /* tp_doc */
+	0,                                      /* tp_traverse */
+	0,                                      /* tp_clear */
+	0,                                      /* tp_richcompare */
+	0,                                      /* tp_weaklistoffset */
+	0,                                      /* tp_iter */
+	0,                                      /* tp_iternext */
+	0,                                      /* tp_methods */
+	0,                                      /* tp_members */
+	0,                                      /* tp_getset */
+	0,                                      /* tp_base */
+	0,                                      /* tp_dict */
+	0,                                      /* tp_descr_get */
+	0,                                      /* tp_descr_set */
+	0,                                      /* tp_dictoffset */
+	(initproc)PyLevelDBKeySchema_init,      /* tp_init */
+	0,                                      /* tp_alloc */
+	PyLevelDBKeySchema_new,                 /* tp_new */
 };
 
-static PyObject* PyLevelDBIter_New(PyObject* ref, PyLevelDB* db, leveldb::Iterator* iterator, std::string* bound, int include_value, int is_reverse)
+static PyObject* PyLevelDBBlockCache_new(PyTypeObject* type, PyObject* args, PyObject* kwds)
 {
-	PyLevelDBIter* iter = PyObject_GC_New(PyLevelDBIter, &PyLevelDBIter_Type);
+	PyLevelDBBlockCache* self = (PyLevelDBBlockCache*)type->tp_alloc(type, 0);
 
-	if (iter == 0) {
-		Py_BEGIN_ALLOW_THREADS
-		delete iterator;
-		Py_END_ALLOW_THREADS
-		return 0;
-	}
+	if (self)
+		self->cache = 0;
 
-	Py_XINCREF(ref);
-	iter->ref = ref;
-	iter->db = db;
-	iter->iterator = iterator;
-	iter->is_reverse = is_reverse;
-	iter->bound = bound;
-	iter->include_value = include_value;
+	return (PyObject*)self;
+}
 
-	if (iter->db)
-		iter->db->n_iterators += 1;
+static void PyLevelDBBlockCache_dealloc(PyLevelDBBlockCache* self)
+{
+	// databases using the cache hold their own references
+	Py_BEGIN_ALLOW_THREADS
+	pyleveldb_cache_unref(self->cache);
+	Py_END_ALLOW_THREADS
 
-	PyObject_GC_Track(iter);
-	return (PyObject*)iter;
+	self->cache = 0;
+
+	#if PY_MAJOR_VERSION >= 3
+	Py_TYPE(self)->tp_free((PyObject*)self);
+	#else
+	((PyObject*)self)->ob_type->tp_free((PyObject*)self);
+	#endif
 }
 
-static PyObject* PyLevelDBSnapshot_New(PyLevelDB* db, const leveldb::Snapshot* snapshot)
+static int PyLevelDBBlockCache_init(PyLevelDBBlockCache* self, PyObject* args, PyObject* kwds)
 {
-	PyLevelDBSnapshot* s = PyObject_GC_New(PyLevelDBSnapshot, &PyLevelDBSnapshot_Type);
+	const char* kwargs[] = {"capacity", "policy", "shards", 0};
+	Py_ssize_t capacity = 0;
+	const char* policy = "lru";
+	Py_ssize_t shards = 0;
 
-	if (s == 0) {
-		db->_db->ReleaseSnapshot(snapshot);
-		return 0;
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, (char*)"n|sn", (char**)kwargs, &capacity, &policy, &shards))
+		return -1;
+
+	if (capacity < 0) {
+		PyErr_SetString(PyExc_ValueError, "negative capacity");
+		return -1;
 	}
 
-	Py_INCREF(db);
-	s->db = db;
-	s->snapshot = snapshot;
-	s->db->n_snapshots += 1;
-	PyObject_GC_Track(s);
-	return (PyObject*)s;
+	if (!pyleveldb_check_cache_policy(policy, shards))
+		return -1;
+
+	leveldb::Cache* cache = pyleveldb_cache_new((size_t)capacity, policy, (size_t)shards);
+
+	if (cache == 0) {
+		PyErr_NoMemory();
+		return -1;
+	}
+
+	pyleveldb_cache_unref(self->cache);
+	self->cache = cache;
+	return 0;
+}
+
+static PyObject* PyLevelDBBlockCache_stats(PyLevelDBBlockCache* self)
+{
+	return pyleveldb_cache_stats_dict(self->cache);
 }
+
+static PyMethodDef PyLevelDBBlockCache_methods[] = {
+	{(char*)"stats", (PyCFunction)PyLevelDBBlockCache_stats, METH_NOARGS, (char*)"capacity and usage in bytes, the number of lookups that hit and missed the cache, and per-segment usage and hits"},
+	{NULL}
+};
+
+PyDoc_STRVAR(PyLevelDBBlockCache_doc,
+"BlockCache(capacity, policy = 'lru', shards = 0) -> block cache object\n"
+"\n"
+"A block cache of capacity bytes, to be passed as the block_cache of LevelDB objects, which then\n"
+"share it instead of each having a block cache of their own. The cache lives as long as this object\n"
+"or any database using it.\n"
+"\n"
+"policy is one of:\n"
+"\n"
+"  'lru'   least recently used blocks are evicted first\n"
+"  'slru'  segmented LRU: blocks enter a probationary segment, and move to a protected segment holding\n"
+"          up to 80% of the capacity once they are hit again. Blocks read only once, as by scans, are\n"
+"          evicted before any block that has been hit. stats() reports usage and hits per segment.\n"
+"  'clock' CLOCK: a hit only marks the block as referenced, so lookups share the lock of their shard\n"
+"          and releasing a block takes no lock, for many threads reading cached blocks at once.\n"
+"\n"
+"The cache is split into shards, each with its own lock: 16 by default, or shards, a power of two up\n"
+"to 4096, which only the 'slru' and 'clock' policies support.\n"
+"\n"
+"   cache = BlockCache(256 << 20)\n"
+"   shards = [LevelDB('shard-%i' % i, block_cache = cache) for i in range(40)]\n"
+);
+
+PyTypeObject PyLevelDBBlockCache_Type = {
+	#if PY_MAJOR_VERSION >= 3
+	PyVarObject_HEAD_INIT(NULL, 0)
+	#else
+	PyObject_HEAD_INIT(NULL)
+	0,
+	#endif
+	(char*)"leveldb.BlockCache",             /* tp_name */
+	sizeof(PyLevelDBBlockCache),             /* tp_basicsize */
+	0,                                       /* tp_itemsize */
+	(destructor)PyLevelDBBlockCache_dealloc, /* tp_dealloc */
+	0,                                       /* tp_print */
+	0,                                       /* tp_getattr */
+	0,                                       /* tp_setattr */
+	0,                                       /* tp_compare */
+	0,                                       /* tp_repr */
+	0,                                       /* tp_as_number */
+	0,                                       /* tp_as_sequence */
+	0,                                       /* tp_as_mapping */
+	0,                                       /* tp_hash */
+	0,                                       /* tp_call */
+	0,                                       /* tp_str */
+	0,                                       /* tp_getattro */
+	0,                                       /* tp_setattro */
+	0,                                       /* tp_as_buffer */
+	Py_TPFLAGS_DEFAULT,                      /* tp_flags */
+	(char*)PyLevelDBBlockCache_doc,          /* tp_doc */
+	0,                                       /* tp_traverse */
+	0,                                       /* tp_clear */
+	0,                                       /* tp_richcompare */
+	0,                                       /* tp_weaklistoffset */
+	0,                                       /* tp_iter */
+	0,                                       /* tp_iternext */
+	PyLevelDBBlockCache_methods,             /* tp_methods */
+	0,                                       /* tp_members */
+	0,                                       /* tp_getset */
+	0,                                       /* tp_base */
+	0,                                       /* tp_dict */
+	0,                                       /* tp_descr_get */
+	0,                                       /* tp_descr_set */
+	0,                                       /* tp_dictoffset */
+	(initproc)PyLevelDBBlockCache_init,      /* tp_init */
+	0,                                       /* tp_alloc */
+	PyLevelDBBlockCache_new,                 /* tp_new */
+};
@@ -0,0 +1,202 @@
+// Copyright (c) Arni Mar Jonsson.
+// See LICENSE for details.
+
+// Cache of values read by LevelDB.Get(), in front of the database, so a hot key is returned
+// without searching the memtables, the index and its block.
+//
+// Every write bumps a generation number, and erases the keys it writes. A value is only cached
+// if it was read without any write starting or finishing meanwhile, and is stamped with the
+// generation it was read at: it is then the value of its key from that generation until it is
+// erased. So it is also the value seen by snapshots taken at a later generation, while no write
+// was in flight (see pyleveldb_row_cache_generation()).
+//
+// Keys are compared as bytes. With a Python comparator, which may consider different keys equal,
+// every write invalidates the whole cache instead.
+
+#include "leveldb_ext.h"
+
+#include <pthread.h>
+
+struct PyLevelDBRowCacheEntry {
+	uint64_t generation;
+	std::string value;
+};
+
+class PyLevelDBRowCache
+{
+public:
+	PyLevelDBRowCache(size_t capacity, bool byte_keys) :
+		cache(pyleveldb_cache_new(capacity, "lru", 0)),
+		byte_keys(byte_keys),
+		generation(1),
+		valid_from(1),
+		writers(0)
+	{
+		pthread_mutex_init(&mutex, 0);
+		memset(&stats, 0, sizeof(stats));
+		stats.capacity = capacity;
+	}
+
+	~PyLevelDBRowCache()
+	{
+		pyleveldb_cache_unref(cache);
+		pthread_mutex_destroy(&mutex);
+	}
+
+	uint64_t Generation()
+	{
+		pthread_mutex_lock(&mutex);
+		uint64_t g = writers ? 0 : generation;
+		pthread_mutex_unlock(&mutex);
+		return g;
+	}
+
+	leveldb::Cache::Handle* Lookup(const leveldb::Slice& key, uint64_t snapshot)
+	{
+		pthread_mutex_lock(&mutex);
+		leveldb::Cache::Handle* handle = cache->Lookup(key);
+
+		if (handle) {
+			PyLevelDBRowCacheEntry* e = (PyLevelDBRowCacheEntry*)cache->Value(handle);
+
+			if (e->generation < valid_from || e->generation > snapshot) {
+				cache->Release(handle);
+				handle = 0;
+			}
+		}
+
+		if (handle)
+			stats.hits++;
+		else
+			stats.misses++;
+
+		pthread_mutex_unlock(&mutex);
+		return handle;
+	}
+
+	const std::string& Value(leveldb::Cache::Handle* handle)
+	{
+		return ((PyLevelDBRowCacheEntry*)cache->Value(handle))->value;
+	}
+
+	void Release(leveldb::Cache::Handle* handle)
+	{
+		cache->Release(handle);
+	}
+
+	void Insert(const leveldb::Slice& key, const std::string& value, uint64_t g)
+	{
+		pthread_mutex_lock(&mutex);
+
+		if (g != 0 && writers == 0 && generation == g) {
+			PyLevelDBRowCacheEntry* e = new PyLevelDBRowCacheEntry;
+			e->generation = g;
+			e->value = value;
+			cache->Release(cache->Insert(key, e, sizeof(*e) + key.size() + value.size(), &PyLevelDBRowCache::Delete));
+			stats.inserts++;
+		}
+
+		pthread_mutex_unlock(&mutex);
+	}
+
+	void BeginWrite()
+	{
+		pthread_mutex_lock(&mutex);
+		writers++;
+		pthread_mutex_unlock(&mutex);
+	}
+
+	void EndWrite(const leveldb::Slice* keys, size_t n)
+	{
+		pthread_mutex_lock(&mutex);
+		writers--;
+		generation++;
+
+		if (byte_keys) {
+			for (size_t i = 0; i < n; i++)
+				cache->Erase(keys[i]);
+		} else {
+			valid_from = generation;
+		}
+
+		stats.invalidations += byte_keys ? n : 1;
+		pthread_mutex_unlock(&mutex);
+	}
+
+	void Stats(PyLevelDBRowCacheStats* s)
+	{
+		pthread_mutex_lock(&mutex);
+		*s = stats;
+		s->usage = cache->TotalCharge();
+		pthread_mutex_unlock(&mutex);
+	}
+
+private:
+	static void Delete(const leveldb::Slice& key, void* value)
+	{
+		delete (PyLevelDBRowCacheEntry*)value;
+	}
+
+	pthread_mutex_t mutex;
+	leveldb::Cache* cache;
+	bool byte_keys;
+
+	// generation of the database, and the first one whose entries are valid
+	uint64_t generation;
+	uint64_t valid_from;
+
+	// writes in flight
+	int writers;
+
+	PyLevelDBRowCacheStats stats;
+};
+
+PyLevelDBRowCache* pyleveldb_row_cache_new(size_t capacity, bool byte_keys)
+{
+	return new PyLevelDBRowCache(capacity, byte_keys);
+}
+
+void pyleveldb_row_cache_delete(PyLevelDBRowCache* cache)
+{
+	delete cache;
+}
+
+uint64_t pyleveldb_row_cache_generation(PyLevelDBRowCache* cache)
+{
+	return cache->Generation();
+}
+
+leveldb::Cache::Handle* pyleveldb_row_cache_lookup(PyLevelDBRowCache* cache, const leveldb::Slice& key, uint64_t snapshot)
+{
+	return cache->Lookup(key, snapshot);
+}
+
+const std::string& pyleveldb_row_cache_value(PyLevelDBRowCache* cache, leveldb::Cache::Handle* handle)
+{
+	return cache->Value(handle);
+}
+
+void pyleveldb_row_cache_release(PyLevelDBRowCache* cache, leveldb::Cache::Handle* handle)
+{
+	cache->Release(handle);
+}
+
+void pyleveldb_row_cache_insert(PyLevelDBRowCache* cache, const leveldb::Slice& key, const std::string& value, uint64_t generation)
+{
+	cache->Insert(key, value, generation);
+}
+
+void pyleveldb_row_cache_begin_write(PyLevelDBRowCache* cache)
+{
+	cache->BeginWrite();
+}
+
+void pyleveldb_row_cache_end_write(PyLevelDBRowCache* cache, const leveldb::Slice* keys, size_t n)
+{
+	cache->EndWrite(keys, n);
+}
+
+void pyleveldb_row_cache_stats(PyLevelDBRowCache* cache, PyLevelDBRowCacheStats* stats)
+{
+	cache->Stats(stats);
+}
@@ -18,7 +18,6 @@ common_flags = [
     '-I./leveldb',
     '-I./snappy',
     '-I.',
-    '-fno-builtin-memcmp',
     '-O2',
     '-fPIC',
     '-DNDEBUG',
@@ -123,6 +122,11 @@ setup(
                 # python stuff
                 'leveldb_ext.cc',
                 'leveldb_object.cc',
+                'leveldb_env.cc',
+                'leveldb_comparator.cc',
+                'leveldb_cache.cc',
+                'leveldb_file_cache.cc',
+                'leveldb_row_cache.cc',
             ],
             libraries = ['stdc++'],
             extra_compile_args = extra_compile_args,
@@ -0,0 +1,371 @@
+#!/usr/bin/python
+
+# Copyright (c) Arni Mar Jonsson.
+# See LICENSE for details.
+
+# Rough throughput numbers for the python bindings, run from a build directory:
+#
+#   python bench.py [benchmark ...]
+
+import sys, os, time, shutil, tempfile
+
+import leveldb
+
+N = 200000
+VALUE = b'x' * 100
+
+def _key(i):
+	return ('%012i' % i).encode('latin1')
+
+def _open(path, **kwargs):
+	return leveldb.LevelDB(path, **kwargs)
+
+def _fill(db, n = N):
+	b = leveldb.WriteBatch()
+
+	for i in range(n):
+		b.Put(_key(i), VALUE)
+
+		if i % 10000 == 9999:
+			db.Write(b)
+			b = leveldb.WriteBatch()
+
+	db.Write(b)
+	db.CompactRange()
+
+def _report(name, n, nbytes, seconds):
+	print('%-28s %10.0f entries/s %8.1f MB/s' % (name, n / seconds, nbytes / seconds / 1048576.0))
+
+def bench_scan(path):
+	db = _open(path)
+	_fill(db)
+	nbytes = N * (len(_key(0)) + len(VALUE))
+
+	for reverse in (False, True):
+		t = time.time()
+		n = sum(1 for kv in db.RangeIter(reverse = reverse))
+		_report('scan %s' % ('reverse' if reverse else 'forward'), n, nbytes, time.time() - t)
+
+def bench_readahead(path):
+	db = _open(path)
+	_fill(db)
+	nbytes = N * (len(_key(0)) + len(VALUE))
+
+	# with a warm page cache this measures the overhead, drop caches in between for the I/O gain
+	for readahead in (0, 2 << 20):
+		t = time.time()
+		n = sum(1 for kv in db.RangeIter(fill_cache = False, readahead_size = readahead))
+		_report('scan readahead %i' % readahead, n, nbytes, time.time() - t)
+
+def bench_compaction(path):
+	# fill without compacting, then time a full manual compaction
+	for readahead in (0, 2 << 20):
+		db = _open(path, compaction_readahead_size = readahead, write_buffer_size = 1 << 20)
+		b = leveldb.WriteBatch()
+
+		for i in range(N):
+			b.Put(_key((i * 7919) % N), VALUE)
+
+			if i % 10000 == 9999:
+				db.Write(b)
+				b = leveldb.WriteBatch()
+
+		db.Write(b)
+		nbytes = N * (len(_key(0)) + len(VALUE))
+
+		t = time.time()
+		db.CompactRange()
+		_report('compaction readahead %i' % readahead, N, nbytes, time.time() - t)
+
+		del db
+		leveldb.DestroyDB(path)
+
+def bench_index(path):
+	def cmp(a, b):
+		return (a > b) - (a < b)
+
+	# long keys sharing long prefixes, as composite keys do
+	value = VALUE * 10
+	key = lambda i: ('%064i' % i).encode('latin1')
+
+	for name, comparator in [('bytewise', 'bytewise'), ('python', ('bytewise', cmp)), ('python shortened', ('bytewise', cmp, 'bytewise'))]:
+		db = _open(path, comparator = comparator)
+		b = leveldb.WriteBatch()
+
+		for i in range(N // 10):
+			b.Put(key(i), value)
+
+		db.Write(b)
+		db.CompactRange()
+
+		tables = db.TableProperties()
+		print('%-28s %10i index bytes %8i data blocks' % ('index ' + name, sum(t['index_size'] for t in tables), sum(t['index_entries'] for t in tables)))
+
+		del db
+		leveldb.DestroyDB(path)
+
+def _cpu_time():
+	# time.clock() before Python 3.3
+	if hasattr(time, 'process_time'):
+		return time.process_time()
+
+	return time.clock()
+
+def bench_seek(path):
+	db = _open(path)
+	_fill(db)
+	n = N // 10
+
+	# bounded iterators check the bound on every step, in C, with the comparator
+	t = _cpu_time()
+
+	for i in range(n):
+		j = (i * 7919) % N
+		for kv in db.RangeIter(_key(j), _key(j + 8)):
+			pass
+
+	_report('seek bounded cpu', n, 0, _cpu_time() - t)
+
+	t = _cpu_time()
+
+	for i in range(n):
+		db.Get(_key((i * 7919) % N))
+
+	_report('get cpu', n, n * len(VALUE), _cpu_time() - t)
+
+def bench_l0(path):
+	# each flush covers the whole key range, so a scan merges every level-0 table at every step
+	n = N // 4
+	nbytes = n * (len(_key(0)) + len(VALUE))
+
+	for files in (1, 2, 4, 8):
+		db = _open(path, write_buffer_size = n * (len(_key(0)) + len(VALUE)) // files)
+
+		for f in range(files):
+			b = leveldb.WriteBatch()
+
+			for i in range(f, n, files):
+				b.Put(_key(i), VALUE)
+
+			db.Write(b)
+
+		# level-0 compactions start at 4 tables, report how many are actually there
+		l0 = len([t for t in db.TableProperties() if t['level'] == 0])
+
+		t = time.time()
+		m = sum(1 for kv in db.RangeIter())
+		_report('scan %i level-0 tables' % l0, m, nbytes, time.time() - t)
+
+		del db
+		leveldb.DestroyDB(path)
+
+def _zipf(n, s = 1.1, seed = 1):
+	# cumulative weights of ranks 1..n, sampled by bisection
+	import bisect, random
+
+	cdf = []
+	total = 0.0
+
+	for i in range(1, n + 1):
+		total += 1.0 / i ** s
+		cdf.append(total)
+
+	r = random.Random(seed)
+	return lambda: bisect.bisect_left(cdf, r.random() * total)
+
+def bench_cache(path):
+	# Zipfian point reads, interrupted by full scans that do not bother with fill_cache = False
+	reads = N // 2
+
+	for policy in ('lru', 'slru'):
+		cache = leveldb.BlockCache(4 << 20, policy = policy)
+		db = _open(path, block_cache = cache)
+		_fill(db)
+		zipf = _zipf(N)
+
+		t = time.time()
+
+		for i in range(reads):
+			db.Get(_key((zipf() * 7919) % N))
+
+			if i % (reads // 4) == 0:
+				for kv in db.RangeIter():
+					pass
+
+		seconds = time.time() - t
+		stats = cache.stats()
+		lookups = stats['hits'] + stats['misses']
+		print('%-28s %10.0f reads/s %8.1f%% hits' % ('cache ' + policy, reads / seconds, 100.0 * stats['hits'] / max(lookups, 1)))
+
+		del db
+		leveldb.DestroyDB(path)
+
+def bench_cache_threads(path):
+	# cached Gets from several threads, Get releases the GIL while it reads, so they hit the cache at once
+	import threading
+
+	reads = N // 4
+	db = None
+
+	for (policy, shards) in (('lru', 0), ('slru', 16), ('clock', 16), ('clock', 64)):
+		for threads in (1, 4, 16):
+			cache = leveldb.BlockCache(64 << 20, policy = policy, shards = shards)
+			db = _open(path, block_cache = cache)
+
+			if threads == 1:
+				_fill(db, N // 10)
+
+			def run(seed):
+				for i in range(reads // threads):
+					db.Get(_key(((i + seed) * 7919) % (N // 10)))
+
+			workers = [threading.Thread(target = run, args = (j,)) for j in range(threads)]
+			t = time.time()
+
+			for w in workers:
+				w.start()
+
+			for w in workers:
+				w.join()
+
+			_report('cache %s/%i %i threads' % (policy, shards or 16, threads), reads, reads * len(VALUE), time.time() - t)
+			del db
+
+		leveldb.DestroyDB(path)
+
+def bench_compressed_cache(path):
+	# a working set several times the block cache, but compressible to fit a compressed cache of the same size
+	value = b'compressible ' * 32
+	nbytes = N * (len(_key(0)) + len(value))
+	reads = N // 2
+
+	for compressed in (0, 8 << 20):
+		db = _open(path, block_cache_size = 8 << 20, compressed_cache_size = compressed)
+		b = leveldb.WriteBatch()
+
+		for i in range(N):
+			b.Put(_key(i), value)
+
+		db.Write(b)
+		db.CompactRange()
+
+		zipf = _zipf(N)
+		t = time.time()
+
+		for i in range(reads):
+			db.Get(_key((zipf() * 7919) % N))
+
+		_report('get compressed cache %i' % compressed, reads, reads * len(value), time.time() - t)
+
+		del db
+		leveldb.DestroyDB(path)
+
+def bench_file_cache(path):
+	# reads after a restart, when the block cache is cold, with and without a persistent file cache
+	db_path = os.path.join(path, 'db')
+	reads = N // 2
+
+	for size in (0, 64 << 20):
+		kwargs = dict(block_cache_size = 1 << 20)
+
+		if size:
+			kwargs.update(file_cache_path = os.path.join(path, 'blocks'), file_cache_size = size)
+
+		_fill(_open(db_path, **kwargs))
+
+		# the first two passes admit blocks to the file cache, on their second miss
+		for n in range(3):
+			db = _open(db_path, **kwargs)
+			t = time.time()
+
+			for i in range(reads):
+				db.Get(_key((i * 7919) % N))
+
+			seconds = time.time() - t
+			del db
+
+		_report('get file cache %i' % size, reads, reads * len(VALUE), seconds)
+		leveldb.DestroyDB(db_path)
+
+def bench_metadata_cache(path):
+	# random reads over more tables than stay open, so tables are opened again and again
+	reads = N // 2
+
+	for size in (0, 8 << 20):
+		db = _open(path, max_open_files = 20, write_buffer_size = 1 << 20, metadata_cache_size = size)
+		_fill(db)
+
+		t = time.time()
+
+		for i in range(reads):
+			db.Get(_key((i * 7919) % N))
+
+		_report('get metadata cache %i' % size, reads, reads * len(VALUE), time.time() - t)
+
+		del db
+		leveldb.DestroyDB(path)
+
+def bench_bloom(path):
+	# point lookups of missing keys, over several levels of tables, with and without bloom filters
+	reads = N // 2
+
+	for bits in (0, 10):
+		db = _open(path, write_buffer_size = 1 << 20, bloom_filter_bits = bits)
+		_fill(db)
+
+		t = time.time()
+
+		for i in range(reads):
+			db.Get(_key(i) + b'-', default = None)
+
+		_report('get missing bloom %i' % bits, reads, 0, time.time() - t)
+
+		del db
+		leveldb.DestroyDB(path)
+
+def bench_row_cache(path):
+	# zipfian point lookups, with the blocks cached, with and without a row cache
+	reads = N * 2
+
+	for size in (0, 8 << 20):
+		db = _open(path, row_cache_size = size)
+		_fill(db)
+
+		zipf = _zipf(N)
+		keys = [_key((zipf() * 7919) % N) for i in range(reads)]
+		t = time.time()
+
+		for k in keys:
+			db.Get(k)
+
+		_report('get row cache %i' % size, reads, reads * len(VALUE), time.time() - t)
+
+		del db
+		leveldb.DestroyDB(path)
+
+BENCHMARKS = {
+	'scan': bench_scan,
+	'readahead': bench_readahead,
+	'compaction': bench_compaction,
+	'index': bench_index,
+	'seek': bench_seek,
+	'l0': bench_l0,
+	'cache': bench_cache,
+	'cache-threads': bench_cache_threads,
+	'compressed-cache': bench_compressed_cache,
+	'file-cache': bench_file_cache,
+	'metadata-cache': bench_metadata_cache,
+	'row-cache': bench_row_cache,
+	'bloom': bench_bloom,
+}
+
+if __name__ == '__main__':
+	names = sys.argv[1:] or sorted(BENCHMARKS)
+
+	for name in names:
+		path = tempfile.mkdtemp(prefix = 'leveldb-bench-')
+
+		try:
+			BENCHMARKS[name](path)
+		finally:
+			shutil.rmtree(path, ignore_errors = True)
@@ -3,7 +3,7 @@
 # Copyright (c) Arni Mar Jonsson.
 # See LICENSE for details.
 
-import sys, string, unittest, itertools
+import sys, os, string, unittest, itertools, tempfile, shutil, threading
 
 class TestLevelDB(unittest.TestCase):
 	def setUp(self):
@@ -275,6 +275,976 @@ class TestLevelDB(unittest.TestCase):
 		db.CompactRange(start = None, end = self._s('1000'))
 		db.CompactRange()
 
+	def testApproximateSizes(self):
+		options = self._open_options()
+		options['comparator'] = 'bytewise'
+		db = self.leveldb.LevelDB(self.name, **options)
+		s = self._s('foo' * 100)
+
+		for i in range(10000):
+			db.Put(self._s('%05i' % i), s)
+
+		db.CompactRange()
+
+		sizes = db.ApproximateSizes([(self._s('00000'), self._s('10000')), (self._s('a'), self._s('b'))])
+		self.assertEqual(len(sizes), 2)
+		self.assertTrue(sizes[0] > 0)
+		self.assertEqual(sizes[1], 0)
+		self.assertEqual(db.ApproximateSizes([]), [])
+		self.assertRaises(TypeError, db.ApproximateSizes, [self._s('a')])
+		self.assertRaises(TypeError, db.ApproximateSizes, [(self._s('a'), 1)])
+
+		points = db.SplitPoints(self._s('00000'), self._s('10000'), 4)
+		self.assertTrue(0 < len(points) <= 3)
+		self.assertEqual(points, sorted(points))
+
+		for p in points:
+			self.assertTrue(self._s('00000') < p < self._s('10000'))
+
+		self.assertEqual(db.SplitPoints(self._s('a'), self._s('b'), 4), [])
+		self.assertRaises(ValueError, db.SplitPoints, self._s('a'), self._s('b'), 0)
+
+	def testRangeStats(self):
+		db = self._open()
+		self._insert_lowercase(db)
+		db.Put(self._s('x'), self._s('hello world'))
+		s = db.CreateSnapshot()
+		db.Put(self._s('A'), self._s(''))
+
+		self.assertEqual(db.CountRange(), 27)
+		self.assertEqual(db.CountRange(self._s('j'), self._s('m')), 3)
+		self.assertEqual(db.CountRange(start = self._s('x')), 3)
+		self.assertEqual(db.CountRange(end = self._s('b')), 2)
+		self.assertEqual(s.CountRange(), 26)
+
+		stats = db.RangeStats(self._s('w'))
+		self.assertEqual(stats['count'], 4)
+		self.assertEqual(stats['key_bytes'], 4)
+		self.assertEqual(stats['value_bytes'], 3 * 5 + 11)
+		self.assertEqual(stats['min_value_size'], 5)
+		self.assertEqual(stats['max_value_size'], 11)
+		self.assertFalse(stats['approximate'])
+
+		stats = s.RangeStats(self._s('0'), self._s('1'))
+		self.assertEqual(stats['count'], 0)
+		self.assertEqual(stats['min_value_size'], None)
+
+		self.assertEqual(db.CountRange(approximate = True), 27)
+
+	def testRangeStatsApproximate(self):
+		options = self._open_options()
+		options['max_file_size'] = 1 << 20
+		db = self.leveldb.LevelDB(self.name, **options)
+
+		for i in range(30000):
+			db.Put(self._s('%08i' % i), self._s('x' * 100))
+
+		# on several tables, so the count is extrapolated from their sizes
+		db.CompactRange()
+		self.assertTrue(len(db.TableProperties()) > 1)
+
+		count = db.CountRange(approximate = True)
+		self.assertTrue(25000 < count < 35000)
+
+		stats = db.RangeStats(self._s('00005000'), self._s('00025000'), approximate = True)
+		self.assertTrue(stats['approximate'])
+		self.assertTrue(16000 < stats['count'] < 24000)
+		self.assertTrue(16000 * 100 < stats['value_bytes'] < 24000 * 100)
+
+		self.assertEqual(db.CountRange(self._s('00005000'), self._s('00025000')), 20000)
+		self.assertFalse(db.RangeStats(self._s('00029000'), approximate = True)['approximate'])
+
+		# recent writes at the start of a range take more than one sample to get past, rather than
+		# the whole range being counted
+		for i in range(3000):
+			db.Put(self._s('00004999a%04i' % i), self._s('x' * 100))
+
+		stats = db.RangeStats(self._s('00004999a'), self._s('00025000'), approximate = True)
+		self.assertTrue(stats['approximate'])
+		self.assertTrue(stats['count'] > 20000)
+
+	def testScanColumnar(self):
+		db = self._open()
+		self._insert_lowercase(db)
+		db.Put(self._s('k'), self._s('world!'))
+
+		(ko, kd), (vo, vd) = db.ScanColumnar(self._s('j'), self._s('m'))
+		ko = memoryview(ko)
+		self.assertEqual(ko.format, 'i')
+		self.assertEqual(ko.tolist(), [0, 1, 2, 3])
+		self.assertEqual(memoryview(kd).tobytes(), b'jkl')
+		self.assertEqual(memoryview(vo).tolist(), [0, 5, 11, 16])
+		self.assertEqual(memoryview(vd).tobytes(), b'helloworld!hello')
+		self.assertTrue(memoryview(vd).readonly)
+
+		(ko, kd), (vo, vd) = db.CreateSnapshot().ScanColumnar(limit = 2)
+		self.assertEqual(len(ko), 3)
+		self.assertEqual(memoryview(kd).tobytes(), b'ab')
+
+		(ko, kd), (vo, vd) = db.ScanColumnar(limit = 0)
+		self.assertEqual(memoryview(ko).tolist(), [0])
+		self.assertEqual(len(kd), 0)
+
+	def testIteratorFilter(self):
+		db = self._open()
+
+		for i in range(100):
+			db.Put(self._s('key%02i' % i), self._s('%s:%i' % ('even' if i % 2 == 0 else 'odd', i)))
+
+		keys = lambda **kw: [k for k in db.RangeIter(include_value = False, **kw)]
+
+		self.assertEqual(keys(key_regex = '^key(1|2)5$'), [self._s('key15'), self._s('key25')])
+		self.assertEqual(len(keys(value_prefix = self._s('odd:'))), 50)
+		self.assertEqual(keys(value_contains = self._s(':9'), reverse = True), [self._s('key99'), self._s('key98'), self._s('key97'), self._s('key96'), self._s('key95'), self._s('key94'), self._s('key93'), self._s('key92'), self._s('key91'), self._s('key90'), self._s('key09')])
+		self.assertEqual(len(keys(min_value_size = 7, max_value_size = 7)), 45)
+		self.assertEqual(keys(value_field = (5, self._s('42')), key_from = self._s('key30'), key_to = self._s('key50')), [self._s('key42')])
+		self.assertEqual(keys(value_prefix = self._s('even'), value_field = (4, self._s(':1'))), [self._s('key%02i' % i) for i in (10, 12, 14, 16, 18)])
+		self.assertEqual(keys(value_prefix = self._s('none')), [])
+		self.assertEqual(list(db.RangeIter(key_regex = '5$', value_prefix = self._s('odd'), key_to = self._s('key20'))), [(self._s('key05'), self._s('odd:5')), (self._s('key15'), self._s('odd:15'))])
+
+		self.assertRaises(ValueError, db.RangeIter, key_regex = '(')
+		self.assertRaises(TypeError, db.RangeIter, value_field = 3)
+
+	def testIteratorThreads(self):
+		db = self._open()
+
+		for i in range(5000):
+			db.Put(self._s('%05i' % i), self._s('even' if i % 2 == 0 else 'odd'))
+
+		# filtered and reverse iterators advance without the GIL, other threads must not step them meanwhile
+		for kw in [{'value_prefix': self._s('even')}, {'reverse': True}]:
+			i = db.RangeIter(include_value = False, **kw)
+			seen = []
+
+			def consume():
+				while True:
+					try:
+						seen.append(next(i))
+					except RuntimeError:
+						continue
+					except StopIteration:
+						return
+
+			threads = [threading.Thread(target = consume) for j in range(4)]
+
+			for t in threads:
+				t.start()
+
+			for t in threads:
+				t.join()
+
+			if 'reverse' in kw:
+				self.assertEqual(sorted(seen), [self._s('%05i' % j) for j in range(5000)])
+			else:
+				self.assertEqual(sorted(seen), [self._s('%05i' % j) for j in range(0, 5000, 2)])
+
+	def testIteratorValueView(self):
+		if sys.version_info[0] < 3:
+			return
+
+		db = self._open()
+		self._insert_lowercase(db)
+
+		values = []
+
+		for k, v in db.RangeIter(self._s('a'), self._s('c'), value_view = True):
+			self.assertTrue(isinstance(v, memoryview))
+			self.assertTrue(v.readonly)
+			values.append(v)
+			self.assertEqual(v.tobytes(), b'hello')
+
+		self.assertEqual(len(values), 3)
+
+		# views are invalidated once the iterator moves on
+		self.assertRaises(ValueError, values[0].tobytes)
+
+		# derived buffers must be released before advancing
+		i = db.RangeIter(value_view = True, reverse = True)
+		k, v = next(i)
+		w = v[1:3]
+		self.assertRaises(BufferError, next, i)
+		self.assertEqual(w.tobytes(), b'el')
+		w.release()
+		self.assertEqual(next(i)[0], self._s('y'))
+
+		# views may outlive their iterator
+		i = db.RangeIter(value_view = True)
+		k, v = next(i)
+		del i
+		self.assertEqual(v.tobytes(), b'hello')
+
+	def testMultiRangeIter(self):
+		db = self._open()
+
+		for i in range(100):
+			db.Put(self._s('%02i' % i), self._s('v%i' % i))
+
+		s = db.CreateSnapshot()
+		db.Delete(self._s('41'))
+
+		ranges = [(self._s('40'), self._s('43')), (self._s('10'), self._s('12')), (self._s('a'), self._s('b')), (self._s('11'), self._s('13')), (self._s('98'), self._s('z')), (self._s('20'), self._s('20'))]
+		keys = [(i, k) for i, k in db.MultiRangeIter(ranges, include_value = False)]
+		self.assertEqual(keys, [(1, self._s('10')), (1, self._s('11')), (3, self._s('11')), (3, self._s('12')), (0, self._s('40')), (0, self._s('42')), (4, self._s('98')), (4, self._s('99'))])
+
+		kv = list(s.MultiRangeIter([(self._s('41'), self._s('42')), (self._s('00'), self._s('01'))]))
+		self.assertEqual(kv, [(1, self._s('00'), self._s('v0')), (0, self._s('41'), self._s('v41'))])
+
+		self.assertEqual(list(db.MultiRangeIter([])), [])
+		self.assertRaises(TypeError, db.MultiRangeIter, [self._s('a')])
+		self.assertRaises(ValueError, db.MultiRangeIter, [(self._s('10'), self._s('12')), (self._s('30'), self._s('20'))])
+
+	def testIteratorReverseLong(self):
+		db = self._open()
+		b = self.leveldb.WriteBatch()
+
+		for i in range(5000):
+			b.Put(self._s('%04i' % i), self._s('%i' % i))
+
+		db.Write(b)
+
+		kv = list(db.RangeIter(self._s('0100'), self._s('4899'), reverse = True))
+		self.assertEqual(kv, [(self._s('%04i' % i), self._s('%i' % i)) for i in range(4899, 99, -1)])
+
+		k = list(db.RangeIter(include_value = False, reverse = True, value_prefix = self._s('7')))
+		self.assertEqual(k, [self._s('%04i' % i) for i in range(4999, -1, -1) if str(i).startswith('7')])
+
+		i = db.RangeIter(reverse = True)
+		self.assertEqual(next(i), (self._s('4999'), self._s('4999')))
+
+	def testIteratorReadahead(self):
+		options = self._open_options()
+		options['block_size'] = 1024
+		db = self.leveldb.LevelDB(self.name, **options)
+
+		for i in range(2000):
+			db.Put(self._s('%04i' % i), self._s('a') * 100)
+
+		# read-ahead only applies to table files, not the memtable
+		db.CompactRange()
+
+		kv = list(db.RangeIter(fill_cache = False, readahead_size = 2 << 20))
+		self.assertEqual(len(kv), 2000)
+		self.assertEqual(kv, list(db.RangeIter()))
+		self.assertEqual(list(db.RangeIter(self._s('0500'), self._s('1499'), readahead_size = 64 << 10)), kv[500:1500])
+		self.assertEqual(list(db.RangeIter(reverse = True, readahead_size = 64 << 10)), kv[::-1])
+		self.assertRaises(ValueError, db.RangeIter, readahead_size = -1)
+
+	def testCompactionReadahead(self):
+		options = self._open_options()
+		options['compaction_readahead_size'] = 2 << 20
+		db = self.leveldb.LevelDB(self.name, **options)
+
+		for i in range(100):
+			db.Put(self._s('%02i' % i), self._s('a') * 100)
+
+		db.CompactRange()
+		self.assertEqual(len(list(db.RangeIter())), 100)
+		del db
+
+		options['compaction_readahead_size'] = -1
+		self.assertRaises(ValueError, self.leveldb.LevelDB, self.name, **options)
+
+	def testNativeComparators(self):
+		import struct
+
+		def tuple_key(t):
+			return self._join(self._s(chr(len(c)) + c) for c in t)
+
+		cases = [
+			('reverse-bytewise', [self._s(c) for c in 'cba']),
+			('uint64', [bytearray(struct.pack('>Q', i)) for i in (0, 1, 255, 256, 1 << 40)]),
+			('int64', [self._s('a')] + [bytearray(struct.pack('>q', i)) for i in (-1 << 40, -2, -1, 0, 1)] + [bytearray(struct.pack('>q', 1)) + self._s('a')]),
+			('tuple', [tuple_key(t) for t in [('a',), ('a', 'a'), ('a', 'b'), ('ab',), ('b', '')]]),
+			('ascii-nocase', [self._s(c) for c in ['A', 'a', 'ab', 'B', 'b', 'c']]),
+		]
+
+		for name, keys in cases:
+			self.leveldb.DestroyDB(self.name)
+			db = self.leveldb.LevelDB(self.name, comparator = name)
+
+			for k in reversed(keys):
+				db.Put(k, k)
+
+			self.assertEqual(list(db.RangeIter(include_value = False)), keys)
+			self.assertEqual(list(db.RangeIter(include_value = False, reverse = True)), keys[::-1])
+			del db
+
+		# tuples with the same components, but different bytes, are different keys: a length
+		# encoded in two bytes, and a malformed tail holding a well-formed component
+		for a, b in [('\x81\x00x', '\x01x'), ('\x05ab', '\x03\x05ab')]:
+			self.leveldb.DestroyDB(self.name)
+			db = self.leveldb.LevelDB(self.name, comparator = 'tuple')
+			db.Put(self._s(a), self._s('a'))
+			db.Put(self._s(b), self._s('b'))
+			self.assertEqual(db.Get(self._s(a)), self._s('a'))
+			self.assertEqual(db.Get(self._s(b)), self._s('b'))
+			self.assertEqual(len(list(db.RangeIter(include_value = False))), 2)
+			del db
+
+		# many keys, in order, over many small blocks, so the index holds the comparators' separators
+		cases = [
+			('reverse-bytewise', [self._s('%05i' % i) for i in range(2000, 0, -1)]),
+			('uint64', [bytearray(struct.pack('>Q', i * 7919)) for i in range(2000)]),
+			('int64', [bytearray(struct.pack('>q', i * 7919)) for i in range(-1000, 1000)]),
+			('tuple', [tuple_key(('%03i' % (i // 40), 'x' * (i % 40))) for i in range(2000)]),
+			('ascii-nocase', [self._s(('K%04i' if i % 2 else 'k%04i') % i) for i in range(2000)]),
+		]
+
+		for name, keys in cases:
+			self.leveldb.DestroyDB(self.name)
+			db = self.leveldb.LevelDB(self.name, comparator = name, block_size = 1024)
+
+			for k in keys:
+				db.Put(k, k + self._s('v' * 200))
+
+			db.CompactRange()
+			self._check_blocks(db, keys)
+			del db
+
+		self.leveldb.DestroyDB(self.name)
+		self.assertRaises(ValueError, self.leveldb.LevelDB, self.name, comparator = 'no-such-comparator')
+
+	# keys, in the order of the comparator, were put with their values prefixed by the key
+	def _check_blocks(self, db, keys):
+		self.assertTrue(db.TableProperties()[0]['index_entries'] > 100)
+
+		for k in keys:
+			self.assertEqual(db.Get(k)[:len(k)], k)
+
+		self.assertEqual(list(db.RangeIter(include_value = False)), keys)
+		self.assertEqual(list(db.RangeIter(include_value = False, reverse = True)), keys[::-1])
+
+		for i in range(0, len(keys), 97):
+			self.assertEqual(list(itertools.islice(db.RangeIter(keys[i], include_value = False), 3)), keys[i:i + 3])
+			self.assertEqual(list(itertools.islice(db.RangeIter(key_to = keys[i], include_value = False, reverse = True), 3)), keys[max(i - 2, 0):i + 1][::-1])
+
+	def testKeySchema(self):
+		import struct
+
+		schema = self.leveldb.KeySchema(['u32', ('i64', 'desc'), 'bytes'])
+		self.assertEqual(repr(schema), 'py-leveldb.KeySchema(u32,i64 desc,bytes)')
+
+		rows = [(t, ts, i) for t in (0, 1, 300) for ts in (-5, 0, 7) for i in ('', 'a', 'b')]
+		keys = dict(((t, ts, i), bytearray(struct.pack('>Iq', t, ts)) + self._s(i)) for t, ts, i in rows)
+
+		db = self.leveldb.LevelDB(self.name, comparator = schema)
+
+		for k in keys.values():
+			db.Put(k, self._s(''))
+
+		expected = [keys[r] for r in sorted(rows, key = lambda r: (r[0], -r[1], r[2]))]
+		self.assertEqual(list(db.RangeIter(include_value = False)), expected)
+		self.assertEqual(list(db.RangeIter(keys[(1, 7, '')], keys[(1, -5, '')], include_value = False)), expected[9:16])
+		del db
+
+		# over many small blocks, so the index holds the schema's separators
+		rows = [(t, ts, i) for t in (0, 1, 70000) for ts in range(-300, 300, 3) for i in ('', 'a', 'b')]
+		keys = dict(((t, ts, i), bytearray(struct.pack('>Iq', t, ts)) + self._s(i)) for t, ts, i in rows)
+
+		self.leveldb.DestroyDB(self.name)
+		db = self.leveldb.LevelDB(self.name, comparator = schema, block_size = 1024)
+
+		for k in keys.values():
+			db.Put(k, k + self._s('v' * 200))
+
+		db.CompactRange()
+		self._check_blocks(db, [keys[r] for r in sorted(rows, key = lambda r: (r[0], -r[1], r[2]))])
+		del db
+
+		# a non-trailing byte string whose length is encoded in two bytes is a different key
+		self.leveldb.DestroyDB(self.name)
+		db = self.leveldb.LevelDB(self.name, comparator = self.leveldb.KeySchema(['bytes', 'u32']))
+		a = self._s('\x81\x00x\x00\x00\x00\x01')
+		b = self._s('\x01x\x00\x00\x00\x01')
+		db.Put(a, self._s('a'))
+		db.Put(b, self._s('b'))
+		self.assertEqual(db.Get(a), self._s('a'))
+		self.assertEqual(db.Get(b), self._s('b'))
+		self.assertEqual(len(list(db.RangeIter(include_value = False))), 2)
+		del db
+
+		self.assertRaises(ValueError, self.leveldb.KeySchema, ['u128'])
+		self.assertRaises(ValueError, self.leveldb.KeySchema, [('u32', 'up')])
+		self.assertRaises(ValueError, self.leveldb.KeySchema, [])
+
+	def testComparatorShortening(self):
+		def cmp(a, b):
+			return (a > b) - (a < b)
+
+		def separator(start, limit):
+			return start[:1]
+
+		for comparator in [('bytewise', cmp, 'bytewise'), ('bytewise', cmp, separator, None), ('bytewise', cmp, None, lambda k: k)]:
+			self.leveldb.DestroyDB(self.name)
+			db = self.leveldb.LevelDB(self.name, comparator = comparator)
+
+			for i in range(100):
+				db.Put(self._s('%03i' % i), self._s('a') * 100)
+
+			db.CompactRange()
+			self.assertEqual(len(list(db.RangeIter())), 100)
+
+			for t in db.TableProperties():
+				self.assertEqual(sorted(t.keys()), ['file', 'file_size', 'index_entries', 'index_size', 'level'])
+				self.assertTrue(t['index_entries'] > 0)
+
+			del db
+
+		# keys with a long common suffix, whose neighbours differ by at least two in some byte, so the
+		# bytewise separator of two of them is a short prefix
+		def key(i):
+			return self._s(''.join('acegi'[(i // 5 ** j) % 5] for j in range(4, -1, -1)) + 'x' * 60)
+
+		def short_separator(start, limit):
+			a, b = bytearray(start), bytearray(limit)
+			i = 0
+
+			while i < min(len(a), len(b)) and a[i] == b[i]:
+				i += 1
+
+			if i < min(len(a), len(b)) and a[i] + 1 < b[i]:
+				return bytes(a[:i] + bytearray([a[i] + 1]))
+
+			return start
+
+		keys = [key(i) for i in range(2000)]
+		index = {}
+
+		for name, comparator in [('none', ('bytewise', cmp)), ('native', ('bytewise', cmp, 'bytewise')), ('python', ('bytewise', cmp, short_separator, None))]:
+			self.leveldb.DestroyDB(self.name)
+			db = self.leveldb.LevelDB(self.name, comparator = comparator, block_size = 1024)
+
+			for k in keys:
+				db.Put(k, k + self._s('v' * 200))
+
+			db.CompactRange()
+			self._check_blocks(db, keys)
+			index[name] = db.TableProperties()
+			del db
+
+		entries = lambda name: sum(t['index_entries'] for t in index[name])
+		size = lambda name: sum(t['index_size'] for t in index[name])
+
+		self.assertEqual(entries('python'), entries('none'))
+		self.assertTrue(size('native') < size('none') // 2)
+		self.assertTrue(size('python') < size('none') // 2)
+
+		self.assertRaises(ValueError, self.leveldb.LevelDB, self.name, comparator = ('bytewise', cmp, 'other'))
+		self.assertRaises(TypeError, self.leveldb.LevelDB, self.name, comparator = ('bytewise', cmp, 1, None))
+
+	def testIteratorRefresh(self):
+		db = self._open()
+
+		for i in range(10):
+			db.Put(self._s('%02i' % i), self._s('a'))
+
+		for reverse in (False, True):
+			i = db.RangeIter(reverse = reverse)
+			p = i.pinned()
+			self.assertEqual(sorted(p.keys()), ['age', 'files', 'memtable_bytes'])
+			self.assertTrue(p['age'] >= 0.0)
+
+			self.assertEqual(next(i)[0], self._s('09' if reverse else '00'))
+			db.Put(self._s('05'), self._s('b'))
+			self.assertTrue(i.refresh())
+			kv = list(i)
+			self.assertEqual(len(kv), 9)
+			self.assertTrue((self._s('05'), self._s('b')) in kv)
+			db.Put(self._s('05'), self._s('a'))
+
+			# an exhausted iterator has nothing left to pin
+			self.assertFalse(i.refresh())
+
+		i = db.RangeIter()
+		list(i)
+		self.assertFalse(i.refresh())
+
+		# snapshot iterators stay on the snapshot
+		s = db.CreateSnapshot()
+		db.Put(self._s('10'), self._s('a'))
+		i = s.RangeIter(include_value = False)
+		next(i)
+		del s
+		i.refresh()
+		self.assertEqual(len(list(i)), 9)
+
+	def testIteratorBoundsBytewise(self):
+		# keys sharing long prefixes, differing in high bytes and length around word boundaries
+		self.comparator = 'bytewise'
+		db = self._open()
+		keys = []
+
+		for p in range(0, 18):
+			for c in ('\x00', '\x7f', '\x80', '\xff'):
+				keys.append(self._s('k' * p + c))
+				keys.append(self._s('k' * p))
+
+		keys = sorted(set([bytes(k) for k in keys]))
+
+		for k in keys:
+			db.Put(k, self._s(''))
+
+		for (i, lo) in enumerate(keys):
+			hi = keys[min(i + 5, len(keys) - 1)]
+			self.assertEqual([bytes(k) for k in db.RangeIter(lo, hi, include_value = False)], keys[i:i + 6])
+			self.assertEqual([bytes(k) for k in db.RangeIter(lo, hi, include_value = False, reverse = True)], keys[i:i + 6][::-1])
+
+	def testBlockCache(self):
+		cache = self.leveldb.BlockCache(1 << 20)
+		self.assertEqual(cache.stats(), {'capacity': 1 << 20, 'usage': 0, 'hits': 0, 'misses': 0, 'shards': 16})
+		self.assertRaises(ValueError, self.leveldb.BlockCache, -1)
+
+		for (policy, shards) in (('lru', 32), ('clock', 3), ('clock', -1), ('slru', 8192)):
+			self.assertRaises(ValueError, self.leveldb.BlockCache, 1, policy = policy, shards = shards)
+
+		options = self._open_options()
+		options['block_cache'] = 1
+		self.assertRaises(TypeError, self.leveldb.LevelDB, self.name, **options)
+
+		# a shared cache has its own policy and shards
+		options['block_cache'] = cache
+
+		for kw in ({'cache_policy': 'lru'}, {'cache_shards': 0}, {'cache_policy': 'slru', 'cache_shards': 4}):
+			self.assertRaises(ValueError, self.leveldb.LevelDB, self.name, **dict(options, **kw))
+
+		# databases sharing a cache
+		names = [self.name, 'db_b']
+		dbs = []
+
+		for (i, name) in enumerate(names):
+			self.leveldb.DestroyDB(name)
+			dbs.append(self.leveldb.LevelDB(name, **options))
+			dbs[i].Put(self._s('key'), self._s('value %i' % i))
+			dbs[i].CompactRange()
+
+		before = cache.stats()
+
+		for i in range(3):
+			for (j, db) in enumerate(dbs):
+				self.assertEqual(db.Get(self._s('key')), self._s('value %i' % j))
+
+		after = cache.stats()
+		self.assertEqual(after['hits'] + after['misses'] - before['hits'] - before['misses'], 6)
+		self.assertTrue(after['hits'] - before['hits'] >= 4)
+		self.assertTrue(after['usage'] > 0)
+
+		# data is the usage of the whole shared cache, index and filter that of each database's tables
+		stats = [db.CacheStats()['categories'] for db in dbs]
+		self.assertEqual([c['data'] for c in stats], [after['usage']] * 2)
+		self.assertTrue(all(c['index'] > 0 for c in stats))
+
+		# the cache outlives the object while databases use it
+		del cache
+		self.assertEqual(dbs[0].Get(self._s('key')), self._s('value 0'))
+		del dbs
+
+		for name in names:
+			self.leveldb.DestroyDB(name)
+
+	def testBlockCacheSLRU(self):
+		# blocks hit again move to the protected segment of a segmented LRU cache
+		slru = self.leveldb.BlockCache(1 << 20, policy = 'slru')
+		self.assertEqual(slru.stats()['segments'], {'probation': {'usage': 0, 'hits': 0}, 'protected': {'usage': 0, 'hits': 0}})
+		self.assertRaises(ValueError, self.leveldb.BlockCache, 1, policy = 'fifo')
+
+		options = self._open_options()
+		options['block_cache'] = slru
+		db = self.leveldb.LevelDB(self.name, **options)
+		db.Put(self._s('key'), self._s('value'))
+		db.CompactRange()
+		db.Get(self._s('key'))
+		db.Get(self._s('key'))
+		stats = db.CacheStats()
+		self.assertEqual(stats.pop('categories')['data'], stats['usage'])
+		self.assertEqual(stats, slru.stats())
+		self.assertTrue(stats['segments']['protected']['usage'] > 0)
+		self.assertEqual(stats['segments']['probation']['usage'] + stats['segments']['protected']['usage'], stats['usage'])
+		del db, options['block_cache']
+		self.leveldb.DestroyDB(self.name)
+
+		options['cache_policy'] = 'slru'
+		self.assertTrue('segments' in self.leveldb.LevelDB(self.name, **options).CacheStats())
+		options['cache_policy'] = 'fifo'
+		self.assertRaises(ValueError, self.leveldb.LevelDB, self.name, **options)
+
+	def testBlockCacheScanResistance(self):
+		options = self._open_options()
+		options['block_size'] = 1024
+		hot = [self._s('%05i' % i) for i in range(50)]
+		hits = {}
+
+		# a scan of about 200 blocks through a cache of 64, after a few blocks have been hit twice
+		for policy in ('lru', 'slru'):
+			self.leveldb.DestroyDB(self.name)
+			options['block_cache'] = self.leveldb.BlockCache(64 << 10, policy = policy, shards = 0 if policy == 'lru' else 1)
+			db = self.leveldb.LevelDB(self.name, **options)
+
+			for i in range(2000):
+				db.Put(self._s('%05i' % i), self._s('v' * 100))
+
+			db.CompactRange()
+
+			for k in hot + hot:
+				db.Get(k)
+
+			self.assertEqual(len(list(db.RangeIter())), 2000)
+			before = options['block_cache'].stats()
+
+			for k in hot:
+				db.Get(k)
+
+			after = options['block_cache'].stats()
+			hits[policy] = (after['hits'] - before['hits'], after['misses'] - before['misses'])
+			del db
+
+		# the scan evicts the hot blocks from the LRU cache, but not from the protected segment
+		self.assertTrue(hits['lru'][1] > 0)
+		self.assertEqual(hits['slru'], (len(hot), 0))
+
+	def testBlockCacheClock(self):
+		options = self._open_options()
+
+		# CLOCK caches, with a configurable number of shards
+		for shards in (1, 64):
+			self.leveldb.DestroyDB(self.name)
+			clock = self.leveldb.BlockCache(1 << 20, policy = 'clock', shards = shards)
+			options['block_cache'] = clock
+			db = self.leveldb.LevelDB(self.name, **options)
+			db.Put(self._s('key'), self._s('value'))
+			db.CompactRange()
+
+			for i in range(3):
+				self.assertEqual(db.Get(self._s('key')), self._s('value'))
+
+			stats = clock.stats()
+			self.assertEqual(stats['shards'], shards)
+			self.assertTrue(stats['hits'] >= 2)
+			self.assertTrue(stats['usage'] > 0)
+			del db, clock, options['block_cache']
+
+		# a hot block survives a stream of cold ones through a cache a fraction of their size
+		self.leveldb.DestroyDB(self.name)
+		clock = self.leveldb.BlockCache(16 * 1024, policy = 'clock', shards = 1)
+		options.update(block_cache = clock, block_size = 1024)
+		db = self.leveldb.LevelDB(self.name, **options)
+
+		for i in range(2000):
+			db.Put(self._s('%08i' % i), self._s('%i' % i) * 20)
+
+		db.CompactRange()
+		hot = self._s('%08i' % 0)
+		cold = [self._s('%08i' % i) for i in range(100, 2000, 30)]
+
+		for key in cold:
+			db.Get(key)
+			db.Get(hot)
+
+		stats = clock.stats()
+		self.assertTrue(stats['usage'] <= 16 * 1024)
+		self.assertTrue(stats['misses'] > len(cold))
+		db.Get(hot)
+		self.assertEqual(clock.stats()['hits'], stats['hits'] + 1)
+		db.Get(cold[0])
+		self.assertEqual(clock.stats()['misses'], stats['misses'] + 1)
+
+	def testCompressedCache(self):
+		self.assertFalse('compressed' in self._open().CacheStats())
+
+		options = self._open_options()
+		options['compressed_cache_size'] = -1
+		self.assertRaises(ValueError, self.leveldb.LevelDB, self.name, **options)
+
+		options.update(compressed_cache_size = 1 << 20, block_cache_size = 4096, block_size = 1024)
+		db = self.leveldb.LevelDB(self.name, **options)
+
+		for i in range(1000):
+			db.Put(self._s('%06i' % i), self._s('value %i' % i) * 10)
+
+		db.CompactRange()
+
+		# compactions read the tables they merge without admitting their blocks
+		db.Put(self._s('%06i' % 1000), self._s('value'))
+		db.CompactRange()
+		self.assertEqual(db.CacheStats()['compressed']['usage'], 0)
+
+		# blocks evicted from the tiny block cache come back from the compressed cache
+		for n in range(2):
+			for i in range(0, 1000, 7):
+				self.assertEqual(db.Get(self._s('%06i' % i)), self._s('value %i' % i) * 10)
+
+		stats = db.CacheStats()['compressed']
+		self.assertEqual(stats['capacity'], 1 << 20)
+		self.assertTrue(stats['usage'] > 0)
+		self.assertTrue(stats['usage'] <= 1 << 20)
+		self.assertTrue(stats['hits'] > 0)
+
+	def testFileCache(self):
+		self.assertFalse('file' in self._open().CacheStats())
+
+		path = tempfile.mkdtemp(prefix = 'leveldb-file-cache-')
+		cache = os.path.join(path, 'blocks')
+
+		try:
+			options = self._open_options()
+			options['file_cache_path'] = cache
+			self.assertRaises(ValueError, self.leveldb.LevelDB, self.name, **options)
+			options['file_cache_size'] = -1
+			self.assertRaises(ValueError, self.leveldb.LevelDB, self.name, **options)
+			options['file_cache_path'] = os.path.join(path, 'missing', 'blocks')
+			options['file_cache_size'] = 1 << 20
+			self.assertRaises(self.leveldb.LevelDBError, self.leveldb.LevelDB, self.name, **options)
+
+			options.update(file_cache_path = cache, block_cache_size = 4096, block_size = 1024)
+
+			def read(db):
+				for i in range(0, 1000, 7):
+					self.assertEqual(db.Get(self._s('%06i' % i)), self._s('value %i' % i) * 10)
+
+				return db.CacheStats()['file']
+
+			db = self.leveldb.LevelDB(self.name, **options)
+
+			for i in range(1000):
+				db.Put(self._s('%06i' % i), self._s('value %i' % i) * 10)
+
+			db.CompactRange()
+
+			# blocks are written on their second miss, and hit from then on
+			stats = read(db)
+			self.assertEqual(stats['inserts'], 0)
+			self.assertTrue(stats['rejected'] > 0)
+			stats = read(db)
+			self.assertTrue(stats['inserts'] > 0)
+			self.assertEqual(stats['hits'], 0)
+			stats = read(db)
+			self.assertTrue(stats['hits'] > 0)
+			self.assertEqual(stats['capacity'], 1 << 20)
+			self.assertTrue(0 < stats['usage'] <= 1 << 20)
+			self.assertEqual(set(stats), set(['capacity', 'usage', 'hits', 'misses', 'inserts', 'rejected', 'recovered']))
+
+			# only one database at a time
+			self.leveldb.DestroyDB('db_b')
+			self.assertRaises(self.leveldb.LevelDBError, self.leveldb.LevelDB, 'db_b', **options)
+			inserts = stats['inserts']
+			del db
+
+			# the blocks are found again after a restart
+			db = self.leveldb.LevelDB(self.name, **options)
+			self.assertEqual(db.CacheStats()['file']['recovered'], inserts)
+			stats = read(db)
+			self.assertTrue(stats['hits'] > 0)
+			self.assertEqual(stats['inserts'], 0)
+			del db
+
+			# but not by a new database at the same path, with the same table files
+			self.leveldb.DestroyDB(self.name)
+			self.assertFalse(os.path.exists(self.name))
+			db = self.leveldb.LevelDB(self.name, **options)
+
+			for i in range(1000):
+				db.Put(self._s('%06i' % i), self._s('value %i' % i) * 10)
+
+			db.CompactRange()
+			self.assertEqual(read(db)['hits'], 0)
+			del db
+
+			self.assertTrue(os.path.exists(cache))
+		finally:
+			shutil.rmtree(path, ignore_errors = True)
+
+	def testMetadataCache(self):
+		stats = self._open().CacheStats()
+		self.assertEqual(set(stats['categories']), set(['data', 'index', 'filter']))
+		self.assertEqual(stats['categories']['data'], stats['usage'])
+		self.assertFalse('metadata' in stats)
+
+		options = self._open_options()
+		options['metadata_cache_size'] = -1
+		self.assertRaises(ValueError, self.leveldb.LevelDB, self.name, **options)
+
+		# few open tables, so they are opened again, and a native comparator, for a filter policy below
+		options.update(metadata_cache_size = 1 << 20, max_open_files = 20, block_size = 1024, comparator = 'bytewise')
+		self.leveldb.DestroyDB(self.name)
+		db = self.leveldb.LevelDB(self.name, **options)
+
+		for i in range(1000):
+			db.Put(self._s('%06i' % i), self._s('value %i' % i) * 10)
+
+		db.CompactRange()
+
+		for n in range(2):
+			for i in range(0, 1000, 7):
+				self.assertEqual(db.Get(self._s('%06i' % i)), self._s('value %i' % i) * 10)
+
+		stats = db.CacheStats()
+		self.assertEqual(stats['metadata']['capacity'], 1 << 20)
+		self.assertTrue(0 < stats['metadata']['usage'] <= 1 << 20)
+		self.assertTrue(stats['categories']['index'] > 0)
+		self.assertEqual(stats['categories']['filter'], 0)
+
+		# opening the tables again finds their footer and index in the metadata cache
+		tables = db.TableProperties()
+		self.assertTrue(len(tables) > 0)
+		self.assertTrue(db.CacheStats()['metadata']['hits'] >= stats['metadata']['hits'] + 2 * len(tables))
+		del db
+
+		# tables without a filter, opened with a filter policy: the block after the metaindex is data
+		options.update(bloom_filter_bits = 10)
+		db = self.leveldb.LevelDB(self.name, **options)
+
+		for i in range(999, 0, -7):
+			self.assertEqual(db.Get(self._s('%06i' % i)), self._s('value %i' % i) * 10)
+
+		stats = db.CacheStats()
+		self.assertTrue(stats['categories']['index'] > 0)
+		self.assertEqual(stats['categories']['filter'], 0)
+
+	def testBloomFilter(self):
+		options = self._open_options()
+		options['bloom_filter_bits'] = -1
+		self.assertRaises(ValueError, self.leveldb.LevelDB, self.name, **options)
+
+		# a Python comparator may consider keys with different bytes equal
+		options['bloom_filter_bits'] = 10
+		self.assertRaises(ValueError, self.leveldb.LevelDB, self.name, **options)
+
+		options['comparator'] = 'bytewise'
+		db = self.leveldb.LevelDB(self.name, **options)
+
+		for i in range(0, 1000, 2):
+			db.Put(self._s('%06i' % i), self._s('value %i' % i))
+
+		db.CompactRange()
+
+		for i in range(1000):
+			if i % 2:
+				self.assertRaises(KeyError, db.Get, self._s('%06i' % i))
+			else:
+				self.assertEqual(db.Get(self._s('%06i' % i)), self._s('value %i' % i))
+
+		self.assertTrue(db.CacheStats()['categories']['filter'] > 0)
+		del db
+
+		# filters are optional when reading
+		del options['bloom_filter_bits']
+		db = self.leveldb.LevelDB(self.name, **options)
+		self.assertEqual(db.Get(self._s('000998')), self._s('value 998'))
+		del db
+
+		# the native comparators keep keys with different bytes distinct, so filters can be used with them
+		for comparator in ('tuple', self.leveldb.KeySchema(['bytes', 'u32'])):
+			self.leveldb.DestroyDB(self.name)
+			db = self.leveldb.LevelDB(self.name, comparator = comparator, bloom_filter_bits = 10)
+			db.Put(self._s('\x81\x00x\x00\x00\x00\x01'), self._s('a'))
+			db.CompactRange()
+			self.assertEqual(db.Get(self._s('\x81\x00x\x00\x00\x00\x01')), self._s('a'))
+			self.assertRaises(KeyError, db.Get, self._s('\x01x\x00\x00\x00\x01'))
+			del db
+
+	def testRowCache(self):
+		self.assertFalse('row' in self._open().CacheStats())
+
+		options = self._open_options()
+		options['row_cache_size'] = -1
+		self.assertRaises(ValueError, self.leveldb.LevelDB, self.name, **options)
+
+		# with a Python comparator, and a native one
+		for comparator in (self.comparator, 'bytewise'):
+			self.leveldb.DestroyDB(self.name)
+			options.update(row_cache_size = 1 << 20, comparator = comparator)
+			db = self.leveldb.LevelDB(self.name, **options)
+
+			for i in range(100):
+				db.Put(self._s('%03i' % i), self._s('value %i' % i))
+
+			for n in range(3):
+				for i in range(100):
+					self.assertEqual(db.Get(self._s('%03i' % i)), self._s('value %i' % i))
+
+			stats = db.CacheStats()['row']
+			self.assertEqual(stats['capacity'], 1 << 20)
+			self.assertEqual(stats['inserts'], 100)
+			self.assertEqual(stats['hits'], 200)
+			self.assertTrue(0 < stats['usage'] <= 1 << 20)
+
+			# a snapshot taken after a value was cached may use it, an older one may not
+			s = db.CreateSnapshot()
+			db.Put(self._s('000'), self._s('new'))
+			self.assertEqual(db.Get(self._s('000')), self._s('new'))
+			self.assertEqual(db.Get(self._s('000')), self._s('new'))
+			self.assertEqual(s.Get(self._s('000')), self._s('value 0'))
+			self.assertEqual(s.Get(self._s('001')), self._s('value 1'))
+
+			db.Delete(self._s('000'))
+			self.assertRaises(KeyError, db.Get, self._s('000'))
+			self.assertEqual(s.Get(self._s('000')), self._s('value 0'))
+
+			b = self.leveldb.WriteBatch()
+			b.Put(self._s('001'), self._s('batch'))
+			b.Delete(self._s('002'))
+			db.Write(b)
+			self.assertEqual(db.Get(self._s('001')), self._s('batch'))
+			self.assertEqual(db.Get(self._s('001')), self._s('batch'))
+			self.assertEqual(db.Get(self._s('002'), default = None), None)
+			self.assertEqual(s.Get(self._s('001')), self._s('value 1'))
+			self.assertEqual(db.Get(self._s('003'), fill_cache = False, verify_checksums = True), self._s('value 3'))
+			del s, db
+
+		# tuple and KeySchema keys with equal components but different bytes are different keys, so
+		# writing one leaves the cached value of the other valid
+		for comparator in ('tuple', self.leveldb.KeySchema(['bytes', 'u32'])):
+			self.leveldb.DestroyDB(self.name)
+			options.update(row_cache_size = 1 << 20, comparator = comparator)
+			db = self.leveldb.LevelDB(self.name, **options)
+			a = self._s('\x81\x00x\x00\x00\x00\x01')
+			b = self._s('\x01x\x00\x00\x00\x01')
+			db.Put(a, self._s('a'))
+			self.assertEqual(db.Get(a), self._s('a'))
+			db.Put(b, self._s('b'))
+			self.assertEqual(db.Get(a), self._s('a'))
+			self.assertEqual(db.Get(b), self._s('b'))
+			self.assertEqual(db.CacheStats()['row']['hits'], 1)
+			del db
+
+	def testPackKey(self):
+		pack_key = self.leveldb.pack_key
+		unpack_key = self.leveldb.unpack_key
+
+		items = [
+			(), (None,), (0,), (-1,), (1,), (-2 ** 63,), (2 ** 63 - 1,), (255,), (256,),
+			(0.0,), (-0.5,), (1.5,), (-1e300,), (1e300,), (float('inf'),), (float('-inf'),),
+			(self._s(''),), (self._s('a'),), (self._s('a\x00'),), (self._s('a\x00b'),), (self._s('ab'),), (self._s('b'),),
+			(u'',), (u'\xe9',), (u'a',), (u'a', 1), (u'a', -1), (u'a', 1, None), (1, u'a'), (1, self._s('a'), 2.0),
+		]
+
+		# items of different types order as None < bytes < str < int < float
+		def rank(v):
+			for (i, t) in enumerate((type(None), (bytes, bytearray), type(u''), int, float)):
+				if isinstance(v, t):
+					return (i, v if v is not None else 0)
+
+		packed = [bytes(pack_key(t)) for t in items]
+		self.assertEqual([t for (k, t) in sorted(zip(packed, items))], sorted(items, key = lambda t: [rank(v) for v in t]))
+
+		for t in items:
+			self.assertEqual(unpack_key(pack_key(t)), t)
+
+		self.assertEqual(unpack_key(pack_key([1, 2])), (1, 2))
+		self.assertRaises(OverflowError, pack_key, (2 ** 64,))
+		self.assertRaises(TypeError, pack_key, ([],))
+		self.assertRaises(TypeError, pack_key, 1)
+		self.assertRaises(ValueError, unpack_key, self._s('\x04\x00'))
+		self.assertRaises(ValueError, unpack_key, self._s('\x02a'))
+		self.assertRaises(ValueError, unpack_key, self._s('\x09'))
+
+		# packed keys keep their order in the database with the default comparator
+		db = self._open()
+
+		for t in items:
+			db.Put(pack_key(t), self._s(''))
+
+		self.assertEqual([bytes(k) for k in db.RangeIter(include_value = False)], sorted(packed))
+
 	# tried to re-produce http://code.google.com/p/leveldb/issues/detail?id=44
 	def testMe(self):
 		db = self._open()